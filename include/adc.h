@@ -0,0 +1,84 @@
+/*
+Free-running ADC with DMA
+ ==============================================
+The ADC converts its enabled channels back to back in free-running mode and the PDC
+stores every result, tagged with its channel number, into one of two ADC_BLOCK sample
+buffers. While the PDC fills one buffer, adcRead() sums the other per channel, so
+readings are oversampled for free and loop() only does work once per block.
+
+At a 1 MHz ADC clock that's roughly 40k conversions a second shared between the
+enabled channels, and a block every ~6 ms. loop() must call adcRead() at least that
+often. If both buffers fill first, the PDC is restarted and adcOverruns counted.
+
+Once adcBegin() has run, analogRead() mustn't be used: it reprograms the ADC.
+
+On the Due adcRegs is the real ADC. On any other target it points at a plain register
+bank so a host-side mock can stand in.
+*/
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+typedef Adc AdcRegs;
+#else
+//Host stand-in for the ADC and PDC registers used here
+struct AdcRegs {
+    volatile uint32_t ADC_CR;
+    volatile uint32_t ADC_MR;
+    volatile uint32_t ADC_CHER;
+    volatile uint32_t ADC_CHDR;
+    volatile uint32_t ADC_EMR;
+    volatile uintptr_t ADC_RPR;
+    volatile uint32_t ADC_RCR;
+    volatile uintptr_t ADC_RNPR;
+    volatile uint32_t ADC_RNCR;
+    volatile uint32_t ADC_PTCR;
+};
+
+#define ADC_CR_START            (1u << 1)
+#define ADC_MR_FREERUN_ON       (1u << 7)
+#define ADC_MR_PRESCAL(v)       ((0xFFu & (v)) << 8)
+#define ADC_MR_STARTUP_SUT64    (4u << 16)
+#define ADC_MR_SETTLING_AST5    (1u << 20)
+#define ADC_MR_TRACKTIM(v)      ((0xFu & (v)) << 24)
+#define ADC_MR_TRANSFER(v)      ((0x3u & (v)) << 28)
+#define ADC_EMR_TAG             (1u << 24)
+#define ADC_PTCR_RXTEN          (1u << 0)
+#define ADC_PTCR_RXTDIS         (1u << 1)
+#endif
+
+#define ADC_CHANNELS    16
+#define ADC_BLOCK       256         //samples per DMA buffer
+
+//Due analog pin to ADC channel: A0 - A7 are AD7 down to AD0, A8 - A11 are AD10 - AD13
+#define ADC_CHANNEL_A0  7
+#define ADC_CHANNEL_A1  6
+#define ADC_CHANNEL_A2  5
+#define ADC_CHANNEL_A3  4
+#define ADC_CHANNEL_A4  3
+
+//One buffer's worth of samples, summed per channel
+struct AdcBlock {
+    uint32_t sum[ADC_CHANNELS];
+    uint16_t count[ADC_CHANNELS];
+};
+
+extern AdcRegs* adcRegs;
+extern uint32_t adcOverruns;
+
+//Start converting the channels in mask (bit n = ADn)
+void adcBegin(uint16_t mask);
+
+//Sum the buffer the PDC finished last, if there's a new one. Returns false if not.
+bool adcRead(AdcBlock& block);
+
+//Mean of channel's samples in the block, scaled from 12 to 14 bits
+inline uint16_t adcMean14(const AdcBlock& block, uint8_t channel) {
+    return block.count[channel] ? (block.sum[channel] << 2) / block.count[channel] : 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+Combination action
+ ==============================================
+Keeps the registration as a bitmap (bit n = stop n) and COMBO_LEVELS memory levels of
+COMBO_PISTONS general pistons each.
+
+  - The host reports every stop change (comboStopChanged()), so stopsOn always
+    matches GrandOrgue.
+  - Set + piston captures stopsOn into that piston's memory on the current level.
+  - Piston recalls its combination. Only the stops that differ from stopsOn are sent,
+    all in one burst, so a registration change lands in one USB frame. General
+    cancel does the same with an empty combination.
+
+Memories live in RAM, so a recall never waits on flash. A set also queues the memory
+for the wear-levelled flash log (flashlog.h), which comboService() writes in the
+background, one memory per page command.
+*/
+
+#ifndef COMBINATION_H
+#define COMBINATION_H
+
+#include <stdint.h>
+
+#define STOP_COUNT      70
+#define STOP_WORDS      ((STOP_COUNT + 31) / 32)
+#define COMBO_LEVELS    8
+#define COMBO_PISTONS   10
+
+struct StopSet {
+    uint32_t word[STOP_WORDS];
+};
+
+//Sends one stop change. Returns false if it couldn't be queued.
+typedef bool (*StopSend)(uint8_t stop, bool on);
+
+extern StopSet stopsOn;                 //the registration as the host last reported it
+extern uint8_t comboLevel;              //memory level in use, 0 - COMBO_LEVELS - 1
+
+//Load the memories from flash
+void comboBegin();
+
+void comboStopChanged(uint8_t stop, bool on);
+
+//Recall piston (0 - COMBO_PISTONS - 1) on the current level. If more stops would change
+//than space, nothing is sent and it returns false so the caller can retry.
+bool comboRecall(uint8_t piston, uint16_t space, StopSend send);
+
+//All stops off, same rules as comboRecall()
+bool comboCancel(uint16_t space, StopSend send);
+
+//Capture the registration into piston on the current level
+void comboSet(uint8_t piston);
+
+//Write one changed memory to flash if the flash is free. Call from loop().
+void comboService();
+
+#endif
@@ -0,0 +1,58 @@
+/*
+Coupler engine
+ ==============================================
+Couples divisions in the firmware (Swell to Great, Great to Pedal, ...), so the host
+gets plain notes on each division's channel and does no coupling of its own.
+
+Keys are held as one 64-bit mask per division (bit n = note 36 + n, as the debouncers
+keep them). Each division's output has a bit-sliced counter, COUPLER_PLANES words
+that count for all 64 keys at once how many sources hold each key: the division itself
+and every division coupled to it. Adding or taking away a source is one carry or
+borrow ripple through the planes, however many keys it holds. A key sounds while its
+count is non-zero, so a note goes out once and is released with its last source.
+
+Engaging a coupler adds what its source holds to the output at once and disengaging
+it takes that away again, as a mechanical coupler would. Couplers don't chain: Swell
+to Great with Great to Pedal doesn't put the Swell on the Pedal.
+
+Key events are counted in batches and couplerSend() then sends each output's changes
+together, so a coupled chord reaches the host as one burst rather than one stream per
+source. A key that changes twice ends the batch (couplerKey() refuses it until the
+batch has gone), so even the shortest note makes it out.
+
+Runs in loop() only; couplerKey(), couplerSet() and couplerSend() must not race.
+*/
+
+#ifndef COUPLER_H
+#define COUPLER_H
+
+#include <stdint.h>
+
+#define COUPLER_DIVISIONS	4	//most channels coupled
+#define COUPLER_PLANES		3	//counts up to 7 sources per key
+#define COUPLER_MAX		8	//most couplers
+
+struct CouplerDef {
+    uint8_t from;               //channel whose keys are coupled
+    uint8_t to;                 //channel they sound on as well
+};
+
+//Sends the note for key (note 36 + key) on channel. Returning false (e.g. output
+//queue full) leaves it to be sent again on the next couplerSend().
+typedef bool (*CouplerEmit)(uint8_t channel, uint8_t key, bool on, uint32_t stamp);
+
+//channels: the divisions, bit n = channel n + 1. The couplers start disengaged.
+void couplerBegin(uint16_t channels, const CouplerDef* couplers, uint8_t count, CouplerEmit emit);
+
+void couplerSet(uint8_t coupler, bool on);
+bool couplerEngaged(uint8_t coupler);
+
+//key of channel went down or up. Returns false, taking nothing, if it has already
+//changed in the batch not yet sent. stamp as for midiOutMessage().
+bool couplerKey(uint8_t channel, uint8_t key, bool on, uint32_t stamp);
+
+//Send the batch's output changes, division by division, while emit takes them.
+//Returns true once everything has gone and a new batch can start.
+bool couplerSend();
+
+#endif
@@ -0,0 +1,59 @@
+/*
+Cycle counter
+ ==============================================
+The Cortex-M3 DWT cycle counter (CYCCNT) runs at the 84 MHz core clock, which gives
+12 ns resolution for short deadlines and timing without touching SysTick. It wraps
+every ~51 s, so always compare with (int32_t)(a - b).
+
+On the host the counter comes from hostCycles(), and busy waits go to hostWaitUntil(),
+both supplied by whatever is driving the simulation (see sim/).
+*/
+
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 84000000L
+#endif
+
+#define CYCLES_PER_US	(F_CPU / 1000000L)
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+
+inline void cyclesBegin() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+inline uint32_t cyclesNow() {
+    return DWT->CYCCNT;
+}
+
+//Spin until the counter passes deadline
+inline void cyclesWaitUntil(uint32_t deadline) {
+    while((int32_t)(cyclesNow() - deadline) < 0);
+}
+#else
+uint32_t hostCycles();
+void hostWaitUntil(uint32_t deadline);
+
+inline void cyclesBegin() {}
+
+inline uint32_t cyclesNow() {
+    return hostCycles();
+}
+
+inline void cyclesWaitUntil(uint32_t deadline) {
+    hostWaitUntil(deadline);
+}
+#endif
+
+inline uint32_t usToCycles(uint32_t us) {
+    return us * CYCLES_PER_US;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+Time-based key debounce
+ ==============================================
+Debounces up to 64 contacts (one division) in microseconds rather than in scan counts,
+so the release delay stays the same however often the scan happens to run.
+
+  - Note ON is sent as soon as a contact is seen closed.
+  - pressUs is the shortest note: opens during make-chatter can't end the note sooner.
+  - releaseUs is how long the contact must stay open before note OFF. Closing again
+    inside the window cancels the release.
+
+Release latency is therefore releaseUs plus at most one scan period after the last
+bounce. Only keys that are pressed, opening or waiting out a release are touched, so an
+idle or steadily held keyboard costs a few mask operations per call.
+
+No Arduino dependencies: feed it frames and timestamps from anywhere.
+*/
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+
+struct DebounceConfig {
+    uint32_t pressUs;
+    uint32_t releaseUs;
+};
+
+struct Debouncer {
+    DebounceConfig config;
+    uint64_t sounding;          //note ON has been sent
+    uint64_t releasing;         //sounding, contact open, release window running
+    uint32_t onTime[64];        //when the note went ON
+    uint32_t openTime[64];      //when the contact was last seen opening
+};
+
+//Sends the note for key. Returning false (e.g. output queue full) leaves the key's state
+//alone so the same change is retried on the next call.
+typedef bool (*DebounceEmit)(uint8_t key, bool on);
+
+void debounceBegin(Debouncer& d, const DebounceConfig& config);
+
+//Feed the contacts in keys (1 = closed in frame) sampled at time now (us)
+void debounceUpdate(Debouncer& d, uint64_t frame, uint64_t keys, uint32_t now, DebounceEmit emit);
+
+#endif
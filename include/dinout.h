@@ -0,0 +1,67 @@
+/*
+DIN MIDI output
+ ==============================================
+A second MIDI OUT on the 5-pin DIN socket, for a sound module or a second computer,
+fed from the same queue as USB (midiout.h) as a sink of its own.
+
+The bytes go out of USART0 (Serial1, TX1) at 31250 baud by PDC DMA: dinOutSend()
+encodes the queued packets into one of two small blocks and hands it to the PDC, which
+holds one block sending and one waiting, so the line never pauses between blocks and
+loop() never waits for it. Serial1.begin(31250) sets up the baud rate; dinOutBegin()
+gives TX1 (PA11) to the USART again and takes over the transmitter from there. Nothing
+may pinMode() pin 18 after that.
+
+Only channel messages are sent, with running status: a message on the same status as
+the one before leaves its status byte out, so a chord on one channel is two bytes a
+note. The status is sent again after a quiet spell in case a module was plugged in
+meanwhile. SysEx is for the host alone and is skipped.
+
+TX1 shares pin 18 with the pedal matrix, whose drive row moves to pin 34 when
+DIN_MIDI_OUT is set (main.cpp).
+
+On the Due dinUsart is the real USART0. On any other target it points at a plain
+register bank so a host-side mock can play the peripheral.
+*/
+
+#ifndef DINOUT_H
+#define DINOUT_H
+
+#include <stdint.h>
+#include "Arduino.h"
+#include <MIDIUSB.h>
+
+#if defined(ARDUINO_ARCH_SAM)
+typedef Usart UsartRegs;
+#else
+//Host stand-in for the USART PDC registers used here
+struct UsartRegs {
+    volatile uintptr_t US_TPR;
+    volatile uint32_t US_TCR;
+    volatile uintptr_t US_TNPR;
+    volatile uint32_t US_TNCR;
+    volatile uint32_t US_PTCR;
+};
+
+#define US_PTCR_TXTEN       (1u << 8)
+#define US_PTCR_TXTDIS      (1u << 9)
+#endif
+
+#define DIN_BAUD            31250
+#define DIN_BLOCK           48      //bytes per PDC block, about 15 ms of line time
+#define DIN_STATUS_REFRESH_MS 200   //quiet time after which running status starts over
+
+extern UsartRegs* dinUsart;
+
+extern uint32_t dinOutBytes;        //bytes handed to the PDC
+extern uint32_t dinOutRunning;      //status bytes left out by running status
+
+//Take over the transmitter after Serial1.begin(DIN_BAUD)
+void dinOutBegin();
+
+//MidiSink::send: encode as many packets as fit in a free block. 0 if both are busy.
+uint16_t dinOutSend(const midiEventPacket_t* packets, uint16_t count);
+
+//MidiSink::connected: a DIN socket can't tell, so always
+bool dinOutConnected();
+
+#endif
@@ -0,0 +1,80 @@
+/*
+Expression pedal filtering
+ ==============================================
+Turns oversampled pedal readings (14-bit, 0 - 16383) into a steady position:
+
+  - a median of the last three readings throws out single spikes,
+  - a one-pole IIR, y += (x - y) / 2^shift, smooths what's left,
+  - a deadband holds the output until the smoothed value has moved more than
+    deadband away, then drags it along, so pot noise doesn't become a stream of CCs
+    but slow deliberate moves still come through.
+
+The response curve is a 129-point table over the 14-bit range, interpolated between
+points, and built at compile time. linearCurve() gives a straight line, which covers
+the old map(pos, 1, 127, 35, 127).
+
+An ExpressionInput ties one ADC channel to its filter, curve and MIDI controller.
+The sketch keeps a table of them and sends each one's CC pair only when it changes.
+
+No Arduino dependencies.
+*/
+
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <stdint.h>
+
+#define EXPRESSION_MAX      16383
+#define CURVE_POINTS        129         //one every 128 input steps, plus the end
+
+struct ExpressionFilter {
+    uint16_t deadband;
+    uint8_t shift;
+    bool primed;                        //has had its first reading
+    uint16_t recent[3];
+    int32_t smooth;                     //IIR state, 14.8 fixed point
+    uint16_t out;
+};
+
+struct ExpressionCurve {
+    uint16_t point[CURVE_POINTS];
+};
+
+//One analog control: configuration first, then its running state
+struct ExpressionInput {
+    uint8_t adcChannel;
+    uint8_t midiChannel;
+    uint8_t cc;                         //MSB controller; cc + 32 carries the LSB
+    const ExpressionCurve* curve;
+    uint16_t deadband;
+    uint8_t shift;
+
+    ExpressionFilter filter;
+    uint16_t value;                     //filtered position, 14 bits
+    uint16_t sent;                      //CC value last sent, 0xFFFF = none yet
+    uint32_t sentAt;                    //when, in ms
+};
+
+void expressionBegin(ExpressionFilter& f, uint16_t deadband, uint8_t shift);
+
+//Feed one 14-bit reading, returns the filtered position
+uint16_t expressionUpdate(ExpressionFilter& f, uint16_t value);
+
+//Straight line through (inLow, outLow) and (EXPRESSION_MAX, EXPRESSION_MAX)
+constexpr ExpressionCurve linearCurve(uint16_t inLow, uint16_t outLow) {
+    ExpressionCurve c = {{0}};
+    for(uint16_t i = 0; i < CURVE_POINTS; i++) {
+        int32_t x = i * 128 < EXPRESSION_MAX ? i * 128 : EXPRESSION_MAX;
+        int32_t y = outLow + (x - inLow) * (int32_t)(EXPRESSION_MAX - outLow) / (EXPRESSION_MAX - inLow);
+        c.point[i] = y < 0 ? 0 : y > EXPRESSION_MAX ? EXPRESSION_MAX : y;
+    }
+    return c;
+}
+
+inline uint16_t curveApply(const ExpressionCurve& c, uint16_t x) {
+    uint16_t i = x >> 7;
+    uint16_t frac = x & 0x7F;
+    return c.point[i] + (((int32_t)c.point[i + 1] - c.point[i]) * frac >> 7);
+}
+
+#endif
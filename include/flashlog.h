@@ -0,0 +1,70 @@
+/*
+Wear-levelled record store in flash
+ ==============================================
+Keeps small fixed-size records (a key and four data words) in the last FLASH_LOG_PAGES
+pages of the Due's second flash bank (EFC1). Records are appended in order across the
+pages, so every write goes to a fresh slot and each page is erased only once per trip
+round the log. On start-up the log is scanned and the newest record of every key wins.
+
+A page is only erased once everything in it that is still the newest for its key has a
+copy elsewhere. Starting a page erases it and, in the same command, copies in the live
+records of the page after it, ahead of the new record. By the time the log comes
+round to that page, whatever it held lives on in the page before. Copies keep their
+sequence number, so a copy torn by a power cut leaves the original in charge and the
+copy is made again. A cut during any write loses nothing but the record being written.
+
+A write is one page command, started with flashLogWrite() and left to finish in the
+background (flashLogBusy()). Nothing reads the flash bank while it programs: callers
+keep their own copy of the data in RAM.
+
+Uploading a sketch with a full chip erase clears the log.
+
+On the Due flashRegs is EFC1 and flashBase the flash itself. On any other target
+they point at plain memory so a host-side mock can stand in.
+*/
+
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+typedef Efc EfcRegs;
+#else
+//Host stand-in for the flash controller registers used here
+struct EfcRegs {
+    volatile uint32_t EEFC_FMR;
+    volatile uint32_t EEFC_FCR;
+    volatile uint32_t EEFC_FSR;
+    volatile uint32_t EEFC_FRR;
+};
+
+#define EEFC_FCR_FCMD(v)    ((0xFFu & (v)) << 0)
+#define EEFC_FCR_FARG(v)    ((0xFFFFu & (v)) << 8)
+#define EEFC_FCR_FKEY(v)    ((0xFFu & (v)) << 24)
+#define EEFC_FSR_FRDY       (1u << 0)
+#endif
+
+#define FLASH_PAGE_WORDS    64              //256-byte pages
+#define FLASH_LOG_PAGES     32
+#define FLASH_RECORD_WORDS  8
+#define FLASH_PAGE_RECORDS  (FLASH_PAGE_WORDS / FLASH_RECORD_WORDS)
+#define FLASH_LOG_SLOTS     (FLASH_LOG_PAGES * FLASH_PAGE_RECORDS)
+#define FLASH_LOG_KEYS      128
+#define FLASH_DATA_WORDS    4
+
+extern EfcRegs* flashRegs;
+extern uint32_t* flashBase;                 //first word of the log
+extern uint16_t flashFirstPage;             //page number of flashBase within its bank
+
+//Scan the log and hand the newest record of each key to found
+void flashLogBegin(void (*found)(uint16_t key, const uint32_t* data));
+
+bool flashLogBusy();
+
+//Start writing a record. Returns false if a write is still in progress, or if starting
+//a page took the whole page for copies (write again once it's done).
+bool flashLogWrite(uint16_t key, const uint32_t* data);
+
+#endif
@@ -0,0 +1,83 @@
+/*
+Scan-frame flight recorder
+ ==============================================
+Keeps the last few minutes of what the matrix saw and what went to the host, so a
+ghost or dropped note reported after a service can be replayed offline.
+
+Everything goes into one RAM ring of variable-length records, each starting with a
+tag byte and the time since the previous record in microseconds (LEB128, 1 byte up to
+127 us, 2 up to 16 ms):
+
+    0x0r  row r changed in one contact       dt, bit (port * 32 + bit)
+    0x1r  row r changed in several           dt, byte mask (2 bytes), changed bytes
+    0x20  MIDI message sent                  dt, status, data1, data2
+    0x30  recorder frozen                    dt, cause
+
+Row records carry the XOR against that row's previous sample, masked to the sense
+lines, so a scan that sees nothing new costs three compares per row and no bytes. A
+key going down is one 3 or 4 byte record per bounce.
+
+When the ring is full the oldest records are folded into a base frame (every row's
+sense bits and the time of the first record still kept), so what is left always
+replays from a known state. Dropping is at most a few records per write; recording a
+row is bounded by that and timed as PROF_RECORD.
+
+Freezing (the panic button or SysEx) stops recording so the evidence stays put. The
+dump streams the base frame and the ring as SysEx; recording carries on once the
+host resumes it:
+
+    F0 7D 4F 07 <offset, 3 x 7 bits> <payload, 8-to-7 packed> F7
+    F0 7D 4F 07 <total length> F7       (empty payload: end of dump)
+
+The stream is: base time (4 bytes), record bytes (4), rows (1), then each row's base
+sense words (SENSE_PORTS x 4 bytes), then the records. All little endian.
+*/
+
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+#define FLIGHT_BYTES		32768	//ring size, power of two
+#define FLIGHT_ROWS		16	//most drive rows in one scan
+#define FLIGHT_CHUNK		42	//stream bytes per dump message (6 x 7, packs to 48)
+
+enum FlightTag {
+    FLIGHT_ROW_BIT = 0x00,
+    FLIGHT_ROW_XOR = 0x10,
+    FLIGHT_EVENT = 0x20,
+    FLIGHT_MARK = 0x30
+};
+
+enum FlightCause {
+    FLIGHT_PANIC = 1,
+    FLIGHT_SYSEX = 2
+};
+
+//sense: the sense lines to record; the rest of the port bits are ignored
+void flightBegin(const DriveRow& sense);
+
+//From the scan interrupt: a scan starts at now (us). Rows are numbered from here.
+void flightScan(uint32_t now);
+
+//From matrixScan(): the next row's sample
+void flightRow(const SenseSample& sense);
+
+//A channel message went to the host at now (us). Call from loop().
+void flightEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t now);
+
+void flightFreeze(uint8_t cause);
+void flightResume();
+bool flightFrozen();
+
+//Freeze if need be and start streaming the recording
+void flightDumpStart();
+
+//Queue the next dump messages while the output has plenty of room. Call from loop().
+void flightDumpService();
+
+extern uint32_t flightRecords;          //records written since power on
+extern uint32_t flightOverwritten;      //records folded into the base frame
+
+#endif
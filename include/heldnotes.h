@@ -0,0 +1,48 @@
+/*
+Held-note state
+ ==============================================
+Keeps one 128-bit map per MIDI channel of the notes the host has been told are
+sounding. midiOutFlush() updates it from the packets the endpoint actually took, so
+a write the USB stack refused never changes it.
+
+  - Resync: when the USB device is configured again (host re-enumerated) or the host
+    asks over SysEx, every resync channel gets All Notes Off followed by its held
+    notes, queued together so they go out in one burst. It waits until the output
+    queue is empty, so nothing older can land after it.
+  - Watchdog: heldNotesWatch() compares a channel's held notes with the notes the
+    firmware has sent and not released (transpose.h). A note the host has held
+    through a whole release window plus HELD_GRACE_US after the firmware released
+    it, with the output queue empty, means the note off went missing. The watchdog
+    counts it and sends the note off again.
+*/
+
+#ifndef HELDNOTES_H
+#define HELDNOTES_H
+
+#include "Arduino.h"
+
+#define HELD_GRACE_US	50000	//time past the release window before a held note counts as stuck
+
+//channels: the channels resync covers, bit n = channel n + 1
+void heldNotesBegin(uint16_t channels);
+
+//A channel message has been written to the host
+void heldNotesSent(byte status, byte data1, byte data2);
+
+bool heldNote(byte channel, byte note);
+
+//Ask for a resync on the next heldNotesService()
+void heldNotesResync();
+
+//Watch for reconnects and send a pending resync once the output has room. Call from loop().
+void heldNotesService();
+
+//Send note off for any note on channel the host has held while sounding (notes 0 - 63,
+//64 - 127) didn't, for releaseUs + HELD_GRACE_US or more. now is micros(). Returns the
+//number cleared.
+uint8_t heldNotesWatch(byte channel, const uint64_t* sounding, uint32_t releaseUs, uint32_t now);
+
+extern uint32_t heldNotesStuck;         //stuck notes the watchdog has cleared
+extern uint32_t heldNotesResyncs;       //resync bursts sent
+
+#endif
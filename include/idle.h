@@ -0,0 +1,44 @@
+/*
+Idle matrix
+ ==============================================
+Once no key has sounded for the quiet period, the scan parks the matrix and stops.
+Every drive row is pulled LOW at once and the sense lines' PIO change interrupts are
+enabled. Any key going down then pulls its sense line LOW, and that edge brings the
+scan back.
+
+  - idleCheck() is called at the end of every scan. It parks the matrix once the
+    divisions have been quiet for long enough and tells the caller to stop the
+    scan timer.
+  - idleWake() is called from the sense line interrupt. It masks the sense
+    interrupts again, releases the rows and tells the caller to restart the scan
+    straight away.
+
+A key already down when the matrix parks shows on the sense lines at once, so parking
+is abandoned and the scan carries on. The first scan after a wake sees the key like any
+other scan would, so its note goes out with normal debounce and no extra delay.
+
+Keep the sense line interrupt at the scan interrupt's priority, so the two can never
+pre-empt each other.
+*/
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+//drive: every drive row; sense: every sense line; quietUs = 0 never parks
+void idleBegin(const DriveRow& drive, const DriveRow& sense, uint32_t quietUs);
+
+//From the scan, with busy = any key sounding or releasing and now in us.
+//Returns true when the matrix has just been parked and the scan should stop.
+bool idleCheck(bool busy, uint32_t now);
+
+//From the sense line interrupt. Returns true if the matrix was parked.
+bool idleWake();
+
+extern volatile bool idleParked;
+extern uint32_t idleWakes;              //times the scan was woken
+extern uint32_t idleAborts;             //parks abandoned because a key was already down
+
+#endif
@@ -0,0 +1,237 @@
+/*
+Compile-time keyboard description
+ ==============================================
+A division (manual or pedal) is described by its drive pins, its sense pins, a
+note map [drive row][sense line] (0 = not wired) and a MIDI channel:
+
+    typedef Division<Pins<28, 29, 30, 31, 32, 33>, Pins<36, ..., 46>, manualNotes, 2> Great;
+
+From that the compiler works out the port masks for every drive row and generates one
+straight-line handler per row that picks each wired contact out of the port sample and
+drops it on its key bit (bit n = note 36 + n). Nothing is looked up at run time.
+
+Scanner<A, B, ...> drives divisions that share drive phases together (the Great and
+Pedal on this organ) and runs every division's handler on the one sample per row.
+Adding or reordering a division is a table edit; wiring mistakes such as a duplicated
+note, a note outside 36 - 99, a sense pin off ports A - C or two divisions on the same
+sense line are caught by static_assert.
+*/
+
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+#include "matrix.h"
+#include "debounce.h"
+
+//Provided by the sketch: queue a note from the scan interrupt, and the scan's timestamp
+bool postNote(uint8_t channel, uint8_t pitch, uint8_t velocity);
+extern uint32_t scanTime;
+
+//Compile-time index list 0 .. N-1
+template <uint8_t... I> struct Seq {};
+template <uint8_t N, uint8_t... I> struct MakeSeq : MakeSeq<N - 1, N - 1, I...> {};
+template <uint8_t... I> struct MakeSeq<0, I...> { typedef Seq<I...> type; };
+
+template <uint8_t... P>
+struct Pins {
+    static constexpr uint8_t count = sizeof...(P);
+
+    static constexpr uint8_t pin(uint8_t i) {
+        const uint8_t list[sizeof...(P)] = {P...};
+        return list[i];
+    }
+
+    //Port masks for all the pins together
+    static constexpr DriveRow masks() {
+        const uint8_t list[sizeof...(P)] = {P...};
+        DriveRow row = {{0, 0, 0, 0}};
+        for(uint8_t i = 0; i < count; i++)
+            row.mask[duePin(list[i]).port] |= 1UL << duePin(list[i]).bit;
+        return row;
+    }
+
+    static constexpr bool unique() {
+        const uint8_t list[sizeof...(P)] = {P...};
+        for(uint8_t i = 0; i < count; i++)
+            for(uint8_t j = i + 1; j < count; j++)
+                if(list[i] == list[j]) return false;
+        return true;
+    }
+
+    static constexpr bool onSensePorts() {
+        const uint8_t list[sizeof...(P)] = {P...};
+        for(uint8_t i = 0; i < count; i++)
+            if(list[i] > 65 || duePin(list[i]).port >= SENSE_PORTS) return false;
+        return true;
+    }
+};
+
+constexpr bool masksOverlap(const DriveRow& a, const DriveRow& b) {
+    return (a.mask[PORT_A] & b.mask[PORT_A]) || (a.mask[PORT_B] & b.mask[PORT_B]) ||
+           (a.mask[PORT_C] & b.mask[PORT_C]) || (a.mask[PORT_D] & b.mask[PORT_D]);
+}
+
+template <uint8_t R, uint8_t S>
+constexpr bool notesValid(const uint8_t (&map)[R][S]) {
+    for(uint8_t r = 0; r < R; r++)
+        for(uint8_t s = 0; s < S; s++)
+            if(map[r][s] != 0 && (map[r][s] < 36 || map[r][s] > 99)) return false;
+    return true;
+}
+
+template <uint8_t R, uint8_t S>
+constexpr bool notesUnique(const uint8_t (&map)[R][S]) {
+    for(uint16_t a = 0; a < R * S; a++)
+        for(uint16_t b = a + 1; b < R * S; b++)
+            if(map[a / S][a % S] != 0 && map[a / S][a % S] == map[b / S][b % S]) return false;
+    return true;
+}
+
+template <class Drive, class Sense, const uint8_t (&Map)[Drive::count][Sense::count], uint8_t Channel>
+struct Division {
+    static constexpr uint8_t rows = Drive::count;
+    static constexpr uint8_t channel = Channel;
+
+    static_assert(notesValid(Map), "note map entries must be 0 or 36 - 99");
+    static_assert(notesUnique(Map), "note map has a note wired twice");
+    static_assert(Drive::unique() && Sense::unique(), "pin listed twice");
+    static_assert(Sense::onSensePorts(), "sense pins must be on PIO ports A - C");
+    static_assert(!masksOverlap(Drive::masks(), Sense::masks()), "pin used for both drive and sense");
+
+    //Pins pulled LOW for drive row r
+    static constexpr DriveRow drive(uint8_t r) {
+        DriveRow row = {{0, 0, 0, 0}};
+        row.mask[duePin(Drive::pin(r)).port] = 1UL << duePin(Drive::pin(r)).bit;
+        return row;
+    }
+
+    static constexpr DriveRow senseMasks() {
+        return Sense::masks();
+    }
+
+    //Key bits read on drive row r
+    static constexpr uint64_t rowKeys(uint8_t r) {
+        uint64_t keys = 0;
+        for(uint8_t s = 0; s < Sense::count; s++)
+            if(Map[r][s]) keys |= 1ULL << (Map[r][s] - 36);
+        return keys;
+    }
+
+    //Key bits of the whole division
+    static constexpr uint64_t allKeys() {
+        uint64_t keys = 0;
+        for(uint8_t r = 0; r < rows; r++)
+            keys |= rowKeys(r);
+        return keys;
+    }
+
+    //Contact (R, S) as a key bit: one shift and mask, resolved entirely at compile time
+    template <uint8_t R, uint8_t S>
+    struct Contact {
+        static constexpr uint8_t note = Map[R][S];
+        static constexpr PinBit pin = duePin(Sense::pin(S));
+        static constexpr uint8_t key = note ? note - 36 : 0;
+
+        static inline uint64_t read(const SenseSample& sense) {
+            return note ? (uint64_t)((sense.port[pin.port] >> pin.bit) & 1) << key : 0;
+        }
+    };
+
+    template <uint8_t R, uint8_t... S>
+    static inline uint64_t gather(const SenseSample& sense, Seq<S...>) {
+        uint64_t frame = 0;
+        int unroll[] = {0, (frame |= Contact<R, S>::read(sense), 0)...};
+        (void)unroll;
+        return frame;
+    }
+
+    //Closed keys on drive row R
+    template <uint8_t R>
+    static inline uint64_t frame(const SenseSample& sense) {
+        return gather<R>(sense, typename MakeSeq<Sense::count>::type());
+    }
+
+    //Per-row handler: debounce the row's keys and queue any note changes
+    template <uint8_t R>
+    static void process(const SenseSample& sense) {
+        debounceUpdate(keys, frame<R>(sense), rowKeys(R), scanTime, emit);
+    }
+
+    static bool emit(uint8_t key, bool on) {
+        return postNote(Channel, 36 + key, on ? 127 : 0);
+    }
+
+    static void begin(const DebounceConfig& windows) {
+        debounceBegin(keys, windows);
+    }
+
+    static Debouncer keys;
+};
+
+template <class Drive, class Sense, const uint8_t (&Map)[Drive::count][Sense::count], uint8_t Channel>
+Debouncer Division<Drive, Sense, Map, Channel>::keys;
+
+//Scan table for a Scanner, one step per drive row, built at compile time
+template <class Scan, class Rows> struct ScanProgram;
+
+template <class Scan, uint8_t... R>
+struct ScanProgram<Scan, Seq<R...> > {
+    static constexpr ScanStep steps[sizeof...(R)] = {{Scan::drive(R), &Scan::template process<R>}...};
+};
+
+template <class Scan, uint8_t... R>
+constexpr ScanStep ScanProgram<Scan, Seq<R...> >::steps[sizeof...(R)];
+
+template <class First, class... Rest>
+constexpr uint8_t firstRows() {
+    return First::rows;
+}
+
+template <class... D>
+constexpr bool sameRows() {
+    const uint8_t r[sizeof...(D)] = {D::rows...};
+    for(uint8_t i = 1; i < sizeof...(D); i++)
+        if(r[i] != r[0]) return false;
+    return true;
+}
+
+template <class... D>
+constexpr bool senseDisjoint() {
+    const DriveRow m[sizeof...(D)] = {D::senseMasks()...};
+    for(uint8_t i = 0; i < sizeof...(D); i++)
+        for(uint8_t j = i + 1; j < sizeof...(D); j++)
+            if(masksOverlap(m[i], m[j])) return false;
+    return true;
+}
+
+//Divisions scanned together: row r drives every division's row r at once and each
+//division takes its own contacts from the shared sample
+template <class... D>
+struct Scanner {
+    static constexpr uint8_t rows = firstRows<D...>();
+
+    static_assert(sameRows<D...>(), "divisions sharing drive phases need the same number of rows");
+    static_assert(senseDisjoint<D...>(), "divisions sharing drive phases can't share sense lines");
+
+    static constexpr DriveRow drive(uint8_t r) {
+        const DriveRow m[sizeof...(D)] = {D::drive(r)...};
+        DriveRow row = {{0, 0, 0, 0}};
+        for(uint8_t i = 0; i < sizeof...(D); i++)
+            for(uint8_t p = 0; p < PORT_COUNT; p++)
+                row.mask[p] |= m[i].mask[p];
+        return row;
+    }
+
+    template <uint8_t R>
+    static void process(const SenseSample& sense) {
+        int each[] = {0, (D::template process<R>(sense), 0)...};
+        (void)each;
+    }
+
+    static void run() {
+        matrixScan(ScanProgram<Scanner, typename MakeSeq<rows>::type>::steps, rows);
+    }
+};
+
+#endif
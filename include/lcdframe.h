@@ -0,0 +1,54 @@
+/*
+Shadow framebuffer for the 20x4 LCD
+ ==============================================
+The sketch writes text and numbers into a RAM copy of the screen, which costs nothing
+on the bus. lcdFrameService() then sends only the cells that differ from what the
+display is showing, at most budget bytes per call, so an unchanged screen costs no
+I2C at all and a changed one is spread over several passes of loop().
+
+Cells are kept in the controller's DDRAM order (row 0, row 2, row 1, row 3). That is
+the order a whole 80-char screen string comes out in with lcd.print(), and the order
+the HD44780 auto-increments its address in, so runs of dirty cells need only one
+cursor command.
+
+Numbers are formatted straight into the frame, no sprintf and no buffers.
+*/
+
+#ifndef LCDFRAME_H
+#define LCDFRAME_H
+
+#include <stdint.h>
+
+#define LCD_COLS    20
+#define LCD_ROWS    4
+#define LCD_CELLS   (LCD_COLS * LCD_ROWS)
+
+//Sends one byte to the display: a character when data is true, otherwise a command.
+//Returns false if the transport can't take it right now; it is retried next service.
+typedef bool (*LcdSend)(uint8_t value, bool data);
+
+//Start with the display cleared and the address counter unknown (e.g. after createChar)
+void lcdFrameBegin(LcdSend send);
+
+//Replace the whole frame with an 80-char screen in DDRAM order
+void lcdFrameLoad(const char* screen);
+
+void lcdFrameChar(uint8_t col, uint8_t row, char c);
+void lcdFrameText(uint8_t col, uint8_t row, const char* text);
+
+//Decimal, right-aligned in width cells filled with pad ('0' or ' '). Width 0 uses just
+//as many cells as the number needs. Returns the column after the number.
+uint8_t lcdFrameNumber(uint8_t col, uint8_t row, uint32_t value, uint8_t width, char pad);
+
+//Send up to budget bytes (cursor commands included). Returns true when the display
+//matches the frame.
+bool lcdFrameService(uint8_t budget);
+
+//The display's contents are unknown (e.g. the transport dropped bytes): resend every cell
+void lcdFrameInvalidate();
+
+//Send everything now, for start-up screens. service, if given, is called between
+//attempts to keep the transport moving.
+void lcdFrameFlush(void (*service)() = 0);
+
+#endif
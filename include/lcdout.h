@@ -0,0 +1,44 @@
+/*
+Non-blocking LCD transport
+ ==============================================
+Queues HD44780 command and character bytes and sends them to the PCF8574 backpack
+through the non-blocking I2C master (twi.h). Each LCD byte becomes four expander
+writes: high nibble with E set, high nibble with E clear, then the same for the low
+nibble. One byte time on the bus (~90 us at 100 kHz) holds E high and covers the
+controller's 37 us execution time. Up to LCD_OUT_BATCH queued bytes go out in one
+transfer. lcdOutByte() only copies into the queue, so it is cheap to call from loop().
+
+Clear and home need 1.5 ms and aren't used here. The frame (lcdframe.h) only moves
+the cursor and writes characters.
+
+If a transfer fails, whatever the display missed is unknown, and it may be left half
+way through a byte in 4-bit mode. The queue is dropped and the display is put back
+into 4-bit mode with the usual 3-3-3-2 nibble sequence. The lost() callback runs so
+the frame can mark every cell for redraw. All of this happens from lcdOutService().
+*/
+
+#ifndef LCDOUT_H
+#define LCDOUT_H
+
+#include <stdint.h>
+
+#define LCD_OUT_QUEUE       64      //LCD bytes, power of two
+#define LCD_OUT_BATCH       8       //LCD bytes per I2C transfer
+
+//Start sending to the expander at address. lcd.init() must already have set the
+//display up; lost() is called whenever output had to be dropped.
+void lcdOutBegin(uint8_t address, void (*lost)());
+
+//Queue a character (data = true) or command byte. Returns false if the queue is full.
+bool lcdOutByte(uint8_t value, bool data);
+
+//Move the I2C transfer along and start the next one. Call every pass of loop().
+void lcdOutService();
+
+//Nothing queued or in flight
+bool lcdOutIdle();
+
+//Times the display had to be put back in step after a bus error
+extern uint32_t lcdOutResyncs;
+
+#endif
@@ -0,0 +1,51 @@
+/*
+Timed keystroke macros
+ ==============================================
+A macro is a table of steps, each an action followed by a wait, ending in MACRO_END.
+macroService() runs from loop() and does at most one step (or one typed character)
+per call, never sleeping, so key scanning, MIDI and the display carry on while a
+macro plays out.
+
+    const MacroStep escape[] = {
+        {MACRO_PRESS, KEY_ESC, 0, 10},          //press ESC, wait 10 ms
+        {MACRO_RELEASE_ALL, 0, 0, 0},
+        {MACRO_END}
+    };
+
+MACRO_SCREEN puts an 80-char screen on the LCD and keeps it there: macroScreen() is
+true until the macro ends so the sketch can hold off its own display updates.
+MACRO_PROGRESS waits for its time while showing the percentage done on row 2.
+*/
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stdint.h>
+
+enum MacroAction {
+    MACRO_END,
+    MACRO_PRESS,            //Keyboard.press(key)
+    MACRO_RELEASE_ALL,      //Keyboard.releaseAll()
+    MACRO_TYPE,             //type text, one character per call
+    MACRO_SCREEN,           //show text (80 chars, DDRAM order) on the LCD
+    MACRO_PROGRESS          //wait ms, showing the percentage done
+};
+
+struct MacroStep {
+    uint8_t action;
+    uint8_t key;
+    const char* text;
+    uint32_t ms;            //wait after the step; the length of a MACRO_PROGRESS
+};
+
+//Start a macro. Returns false (and does nothing) if one is already playing.
+bool macroStart(const MacroStep* steps);
+
+void macroService();
+
+bool macroRunning();
+
+//A macro has the LCD
+bool macroScreen();
+
+#endif
@@ -0,0 +1,152 @@
+/*
+Key matrix port access
+ ==============================================
+Drives and samples the Allen key matrix a whole PIO port at a time instead of one
+digitalWrite()/digitalRead() per contact. A drive row is pulled LOW with one PIO_CODR
+write per port and released with one PIO_SODR write; every sense line is sampled with
+a single PIO_PDSR read of ports A, B and C.
+
+On the Due the ports are the real PIO controllers. On any other target pioPorts[]
+points at a plain register bank so the scan logic can be run against a simulated
+matrix on the host.
+*/
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+typedef Pio PioRegs;
+#else
+//Host stand-in for the PIO registers the scanner (and the I2C bus recovery and idle
+//wake) touches
+struct PioRegs {
+    volatile uint32_t PIO_PER;
+    volatile uint32_t PIO_PDR;
+    volatile uint32_t PIO_OER;
+    volatile uint32_t PIO_ODR;
+    volatile uint32_t PIO_SODR;
+    volatile uint32_t PIO_CODR;
+    volatile uint32_t PIO_ODSR;
+    volatile uint32_t PIO_PDSR;
+    volatile uint32_t PIO_IER;
+    volatile uint32_t PIO_IDR;
+    volatile uint32_t PIO_ISR;
+};
+#endif
+
+enum { PORT_A, PORT_B, PORT_C, PORT_D, PORT_COUNT };
+
+#define SENSE_PORTS         3       //sense lines are all on ports A - C
+
+//PIO port and bit behind an Arduino Due pin number
+struct PinBit {
+    uint8_t port;
+    uint8_t bit;
+};
+
+#define PA(b) {PORT_A, b}
+#define PB(b) {PORT_B, b}
+#define PC(b) {PORT_C, b}
+#define PD(b) {PORT_D, b}
+
+//Arduino Due pin -> PIO port/bit, pins 0 - 65 (from the Due variant pin table)
+constexpr PinBit duePinTable[66] = {
+    PA(8),  PA(9),  PB(25), PC(28), PC(26), PC(25), PC(24), PC(23),    //0 - 7
+    PC(22), PC(21), PC(29), PD(7),  PD(8),  PB(27), PD(4),  PD(5),     //8 - 15
+    PA(13), PA(12), PA(11), PA(10), PB(12), PB(13), PB(26), PA(14),    //16 - 23
+    PA(15), PD(0),  PD(1),  PD(2),  PD(3),  PD(6),  PD(9),  PA(7),     //24 - 31
+    PD(10), PC(1),  PC(2),  PC(3),  PC(4),  PC(5),  PC(6),  PC(7),     //32 - 39
+    PC(8),  PC(9),  PA(19), PA(20), PC(19), PC(18), PC(17), PC(16),    //40 - 47
+    PC(15), PC(14), PC(13), PC(12), PB(21), PB(14), PA(16), PA(24),    //48 - 55
+    PA(23), PA(22), PA(6),  PA(4),  PA(3),  PA(2),  PB(17), PB(18),    //56 - 63
+    PB(19), PB(20)                                                     //64 - 65
+};
+
+#undef PA
+#undef PB
+#undef PC
+#undef PD
+
+constexpr PinBit duePin(uint8_t pin) {
+    return duePinTable[pin];
+}
+
+//Bits to pull LOW on each port for one drive row
+struct DriveRow {
+    uint32_t mask[PORT_COUNT];
+};
+
+//One sample of the sense ports, active HIGH (1 = contact closed)
+struct SenseSample {
+    uint32_t port[SENSE_PORTS];
+};
+
+#define ROW_SETTLE_US       17      //drive row to sense line settle time
+
+//One step of a scan: the row to drive and what to do with its sample
+struct ScanStep {
+    DriveRow drive;
+    void (*process)(const SenseSample& sense);
+};
+
+extern PioRegs* pioPorts[PORT_COUNT];
+
+void matrixScan(const ScanStep* steps, uint8_t count);
+
+//Pull every pin of the row LOW
+inline void matrixDrive(const DriveRow& row) {
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        if(row.mask[p])
+            pioPorts[p]->PIO_CODR = row.mask[p];
+    }
+}
+
+//Return every pin of the row to HIGH
+inline void matrixRelease(const DriveRow& row) {
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        if(row.mask[p])
+            pioPorts[p]->PIO_SODR = row.mask[p];
+    }
+}
+
+//Pin levels gathered up and then written with one PIO_SODR and one PIO_CODR per port
+struct PortWrite {
+    uint32_t set[PORT_COUNT];
+    uint32_t clear[PORT_COUNT];
+};
+
+inline void portWritePin(PortWrite& w, uint8_t pin, bool high) {
+    PinBit b = duePin(pin);
+    uint32_t m = 1UL << b.bit;
+    if(high) {
+        w.set[b.port] |= m;
+        w.clear[b.port] &= ~m;
+    }
+    else {
+        w.clear[b.port] |= m;
+        w.set[b.port] &= ~m;
+    }
+}
+
+inline void portWriteApply(PortWrite& w) {
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        if(w.set[p])
+            pioPorts[p]->PIO_SODR = w.set[p];
+        if(w.clear[p])
+            pioPorts[p]->PIO_CODR = w.clear[p];
+        w.set[p] = w.clear[p] = 0;
+    }
+}
+
+//Read ports A, B and C once each. Contacts pull LOW, so the words are inverted.
+inline SenseSample matrixSense() {
+    SenseSample s;
+    for(uint8_t p = 0; p < SENSE_PORTS; p++)
+        s.port[p] = ~pioPorts[p]->PIO_PDSR;
+    return s;
+}
+
+#endif
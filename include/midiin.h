@@ -0,0 +1,67 @@
+/*
+Inbound USB-MIDI
+ ==============================================
+midiInService() empties the MIDI bulk OUT endpoint one bank (up to 16 event packets) at
+a time and keeps going until the endpoint is empty or the time budget is spent, so a
+burst from the host is handled in one pass of loop() instead of one message per pass.
+
+Channel voice messages are dispatched through a table indexed by message type
+(MidiInHandlers). A NoteOn with velocity 0 goes to the NoteOff handler. A packet whose
+status byte doesn't match its code index number is dropped.
+
+SysEx is parsed byte by byte as the packets arrive, without reassembling the message.
+Messages are taken as F0 <id> <id> <command> <args...> F7. The two ID bytes are not
+checked, which matches what the sketch has always accepted from GrandOrgue. Only the
+first MIDI_IN_SYSEX_ARGS argument bytes are kept. The command is looked up in a
+SysExCommand table, and a message whose arguments don't fit is dropped and counted.
+
+On the host the endpoint is read through hostMidiRecv(), supplied by whatever is
+driving the simulation.
+*/
+
+#ifndef MIDIIN_H
+#define MIDIIN_H
+
+#include "Arduino.h"
+
+#define MIDI_IN_SYSEX_ARGS	8	//longest SysEx argument list handled
+
+//Channel voice message types, status >> 4 less 8
+enum {
+    MIDI_IN_NOTE_OFF,
+    MIDI_IN_NOTE_ON,
+    MIDI_IN_POLY_PRESSURE,
+    MIDI_IN_CONTROL,
+    MIDI_IN_PROGRAM,
+    MIDI_IN_PRESSURE,
+    MIDI_IN_PITCH_BEND,
+    MIDI_IN_TYPES
+};
+
+//Channel is 1 - 16. Messages with one data byte get data2 = 0.
+typedef void (*MidiInHandler)(byte channel, byte data1, byte data2);
+
+struct MidiInHandlers {
+    MidiInHandler voice[MIDI_IN_TYPES];      //0 = ignore
+};
+
+struct SysExCommand {
+    byte command;
+    void (*run)(const byte* args, uint8_t length);
+};
+
+void midiInBegin(const MidiInHandlers* handlers, const SysExCommand* commands, uint8_t count);
+
+//Handle everything the host has sent, stopping early after budget cycles.
+//Returns the number of event packets read.
+uint16_t midiInService(uint32_t budget);
+
+//SysEx messages dropped for unknown commands or too many arguments
+extern uint32_t midiInSysExDropped;
+
+#if !defined(ARDUINO_ARCH_SAM)
+//Copy up to len bytes of received packets into data; returns the count, 0 when empty
+uint32_t hostMidiRecv(uint8_t* data, uint32_t len);
+#endif
+
+#endif
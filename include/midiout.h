@@ -0,0 +1,94 @@
+/*
+Batched USB-MIDI output
+ ==============================================
+Outgoing messages are packed straight into 4-byte USB-MIDI event packets and held in
+a small FIFO. midiOutFlush() writes them to the MIDI bulk IN endpoint up to 16 packets
+(one 64-byte full-speed transfer) at a time, so a whole chord leaves in one USB
+transaction instead of one per note.
+
+There are no sleeps: the flush only writes while the endpoint has a free bank. When the
+host is slow the packets stay queued and the queue functions start refusing new ones,
+which the callers treat as "try again later".
+
+The queue fans out to a table of sinks (midiOutBegin()): the USB endpoint, and the DIN
+OUT port (dinout.h). A message is queued once and every sink reads the same packets
+through its own cursor, so each has its own backlog, stall and drop counts and none
+waits for another:
+
+  - A lossless sink (USB) holds its packets until it takes them. Its backlog is what
+    midiOutSpace() reports, so a slow host pushes back on the callers as before.
+  - Any other sink (DIN, at 31250 baud) may fall up to MIDI_OUT_RING packets
+    behind. Past that its oldest packets are dropped for it alone.
+  - A sink that isn't connected drops its backlog, so an unplugged host can't stop
+    the DIN port and vice versa. heldnotes.h resyncs the host when it comes back.
+
+Housekeeping traffic that the host wants spaced out (e.g. the transpose reset's
+stream of piston notes) goes through midiOutPaced() instead. Those messages wait in
+their own queue and are moved to the output one at a time, each no sooner than its
+spacing after the previous one, and only when nothing else is waiting to go. Key
+events therefore never queue behind them.
+*/
+
+#ifndef MIDIOUT_H
+#define MIDIOUT_H
+
+#include "Arduino.h"
+#include <MIDIUSB.h>
+
+#define MIDI_OUT_PACKETS	128	//queue depth in event packets (a full registration change fits)
+#define MIDI_OUT_RING		256	//packets kept for the slower sinks, power of two
+#define MIDI_SINKS_MAX		4
+#define MIDI_OUT_BURST		16	//packets per bulk transfer (64 bytes)
+#define MIDI_PACED_MESSAGES	64	//paced queue depth, power of two
+
+//One output. send() gets packets in queue order and returns how many it took; 0 means
+//busy, and the same packets come round again on the next flush.
+struct MidiSink {
+    uint16_t (*send)(const midiEventPacket_t* packets, uint16_t count);
+    bool (*connected)();
+    bool lossless;          //callers wait for this sink (see above)
+};
+
+struct MidiSinkStats {
+    uint32_t sent;          //packets taken
+    uint32_t stalls;        //flushes put off because the sink was busy
+    uint32_t dropped;       //packets it never got: fell too far behind, or not connected
+};
+
+extern MidiSinkStats midiSinkStats[MIDI_SINKS_MAX];
+
+void midiOutBegin(const MidiSink* sinks, uint8_t count);
+
+//Queue a channel voice message. status includes the channel (e.g. 0x90 | (ch - 1)).
+//A non-zero stamp (cyclesNow() when the event happened) is recorded as PROF_KEY_LATENCY
+//when the packet is written. Returns false if the queue is full.
+bool midiOutMessage(byte status, byte data1, byte data2, uint32_t stamp = 0);
+
+//Queue a complete SysEx message, F0 ... F7 included. All or nothing: returns false,
+//queueing none of it, if there isn't room for the whole message.
+bool midiOutSysEx(const byte* data, uint16_t length);
+
+//Queue a low priority message to go out at least spacingUs after the previous paced
+//one. Returns false if the paced queue is full.
+bool midiOutPaced(byte status, byte data1, byte data2, uint16_t spacingUs);
+
+//Free slots in the paced queue
+uint16_t midiOutPacedSpace();
+
+//Free packet slots in the queue
+uint16_t midiOutSpace();
+
+//Hand each sink as much of its backlog as it will take without waiting.
+//Returns true once every lossless sink is empty.
+bool midiOutFlush();
+
+//The USB sink: up to MIDI_OUT_BURST packets per bulk transfer
+uint16_t midiOutUsbSend(const midiEventPacket_t* packets, uint16_t count);
+
+//True while the host has the USB device configured
+bool midiOutConnected();
+
+//Packets the USB stack refused to send. They are dropped; heldnotes.h repairs the damage.
+extern uint32_t midiOutLost;
+
+#endif
@@ -0,0 +1,104 @@
+/*
+Stage profiler
+ ==============================================
+Times each stage of loop() and the key scan interrupt with the DWT cycle counter and
+keeps, per stage, the call count, min, max, running total (for the mean) and a log2
+histogram: bucket b counts calls of 2^(b-1) to 2^b - 1 cycles, so the buckets run from
+12 ns up to the last one, which collects everything from ~50 ms.
+
+PROF_SCAN_JITTER isn't a stage. It records how far each scan interrupt lands from
+its nominal period, in cycles either way. PROF_KEY_LATENCY is the time from the scan
+that saw a key change to the USB transfer carrying its note, covering the event ring,
+the output queue and any host stalls. Add up to one scan period for the contact
+closing just after its row was sampled, except for the first notes after an idle
+wake, which are stamped with the wake edge itself. PROF_WAKE is the part of that from
+the edge to the start of the wake scan. PROF_RECORD is the flight recorder's share of
+each scanned row (flightrec.h).
+
+A record is a subtract, two compares, an add and a count-leading-zeros, ~20 cycles.
+Against a key scan of several thousand cycles that's well under 1%, so the profiler
+stays enabled in normal builds.
+
+Stats are read and cleared over SysEx (see sysExProfile()). profileReport() formats one
+stage as a reply message with every number split into 7-bit bytes. A stage that drains
+a ring (spsc_ring.h) reports the ring's high watermark and overflows with it.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "cycles.h"
+
+enum ProfileStage {
+    PROF_SCAN,              //scanKeys() interrupt
+    PROF_SCAN_JITTER,       //|actual - nominal| scan period
+    PROF_MIDI_READ,         //midiInService()
+    PROF_SEND_KEYS,         //sendKeyEvents()
+    PROF_DISPLAY,           //drawDisplay() + lights()
+    PROF_PISTONS,           //scanPistons()
+    PROF_TRANSPOSE,         //scanTranspose()
+    PROF_EXPRESSION,        //scanExpression()
+    PROF_FLUSH,             //midiOutFlush()
+    PROF_LOOP,              //one whole pass of loop()
+    PROF_KEY_LATENCY,       //key scan to note leaving on USB
+    PROF_LCD,               //lcdFrameService() + lcdOutService()
+    PROF_WAKE,              //sense line edge to the first scan after idle
+    PROF_RECORD,            //flightRow(), per row
+    PROF_STAGES
+};
+
+#define PROFILE_BUCKETS     24
+
+struct ProfileStat {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[PROFILE_BUCKETS];
+};
+
+//SysEx reply: F0 7D 4F 02 stage, count/min/max/mean (5 bytes each), buckets (3 bytes each),
+//ring high watermark/overflows (5 bytes each, 0 if the stage has no ring), F7
+#define PROFILE_REPORT_BYTES    (5 + 4 * 5 + PROFILE_BUCKETS * 3 + 2 * 5 + 1)
+
+extern ProfileStat profileStats[PROF_STAGES];
+
+void profileReset();
+
+//Copy one stage's stats without the scan interrupt updating them halfway through
+void profileSnapshot(uint8_t stage, ProfileStat& out);
+
+//The top of the histogram bucket that holds the given percentile of a stage's calls,
+//no more than its max: an upper bound good to a factor of two. 0 if it has none.
+uint32_t profilePercentile(const ProfileStat& s, uint8_t percent);
+
+//Write the SysEx reply for stage into out (PROFILE_REPORT_BYTES long), returns its length.
+//ringHigh and ringLost are the counters of the ring the stage drains, if it has one.
+uint16_t profileReport(uint8_t stage, uint8_t* out, uint32_t ringHigh = 0, uint32_t ringLost = 0);
+
+//Write value as a SysEx field of 7-bit bytes (bytes of them), least significant first
+uint8_t* profilePut7(uint8_t* out, uint32_t value, uint8_t bytes);
+
+//Note the scan interrupt's entry time; records the jitter against periodCycles
+void profileScanTick(uint32_t now, uint32_t periodCycles);
+
+//The scan stopped (idle); don't count the gap before the next tick as jitter
+void profileScanPause();
+
+inline void profileRecord(uint8_t stage, uint32_t cycles) {
+    ProfileStat& s = profileStats[stage];
+    if(cycles < s.min) s.min = cycles;
+    if(cycles > s.max) s.max = cycles;
+    s.total += cycles;
+    s.count++;
+    uint8_t b = cycles ? 32 - __builtin_clz(cycles) : 0;
+    s.hist[b < PROFILE_BUCKETS ? b : PROFILE_BUCKETS - 1]++;
+}
+
+//Time a stage: uint32_t t = cyclesNow(); work(); profileEnd(PROF_x, t);
+inline void profileEnd(uint8_t stage, uint32_t start) {
+    profileRecord(stage, cyclesNow() - start);
+}
+
+#endif
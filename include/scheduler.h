@@ -0,0 +1,70 @@
+/*
+Cooperative task scheduler
+ ==============================================
+Runs loop()'s work from a fixed task table. Nothing is allocated; the table is const
+and the per-task state is sized by SCHED_MAX_TASKS.
+
+  - Each task has a period, a time budget and a priority class. A period of 0 makes
+    it a poll task, released on every round.
+  - A round (schedRun()) first releases the poll tasks and every periodic task whose
+    release time has come. It then runs them, the lowest class first and the
+    earliest deadline first within a class. A periodic task's deadline is one period
+    after its release. Ties go to the task listed first.
+  - Tasks that become due during a round wait for the next one, so a round stays
+    bounded and the poll tasks come round again promptly. TASK_IDLE work only runs
+    once everything more urgent in the round is done.
+
+Nothing is dropped silently. Per task the scheduler counts runs, late starts (after
+the deadline), skipped periods (a whole period went by with no run) and overruns
+(longer than the budget), and keeps the worst lateness. The key scan doesn't appear
+here: it runs from the timer interrupt and pre-empts all of this.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS		16
+
+enum TaskPriority {
+    TASK_URGENT,            //MIDI in and out
+    TASK_NORMAL,            //console controls
+    TASK_IDLE               //display and housekeeping
+};
+
+struct Task {
+    void (*run)();
+    uint32_t periodUs;      //0 = every round
+    uint32_t budgetUs;      //a longer run counts as an overrun
+    uint8_t priority;       //TaskPriority
+    uint8_t stage;          //profile stage to time each run in, PROF_STAGES = none
+};
+
+struct TaskStat {
+    uint32_t runs;
+    uint32_t late;          //started after the deadline
+    uint32_t skipped;       //periods with no run at all
+    uint32_t overruns;      //ran past the budget
+    uint32_t maxLateness;   //worst release to start, cycles
+};
+
+extern TaskStat taskStats[SCHED_MAX_TASKS];
+
+void schedBegin(const Task* tasks, uint8_t count);
+
+//One round: run every task that is due
+void schedRun();
+
+void schedReset();
+
+//cyclesNow() of the next periodic release, so a simulation can skip the time in between
+uint32_t schedNextRelease();
+
+//SysEx reply: F0 7D 4F 06 task, runs/late/skipped/overruns/max lateness (5 bytes each), F7
+#define SCHED_REPORT_BYTES	(5 + 5 * 5 + 1)
+
+//Write the SysEx reply for task into out (SCHED_REPORT_BYTES long), returns its length
+uint16_t schedReport(uint8_t task, uint8_t* out);
+
+#endif
@@ -0,0 +1,83 @@
+/*
+Single-producer / single-consumer ring buffer
+ ==============================================
+Lock-free queue for handing events from one interrupt to loop() (or back). Only the
+producer writes head and only the consumer writes tail, so neither side ever has to
+disable interrupts. The size must be a power of two; indices run freely and wrap.
+
+The producer keeps an overflow count (pushes refused because the ring was full) and
+a high watermark (deepest fill seen) so the ring can be sized from real playing.
+*/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+
+template <typename T, uint32_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0), overflowCount(0), highWater(0) {}
+
+    //Producer side. Returns false (and counts an overflow) when the ring is full.
+    bool push(const T& item) {
+        uint32_t h = head;
+        uint32_t used = h - tail;
+        if(used >= N) {
+            overflowCount++;
+            return false;
+        }
+        buf[h & (N - 1)] = item;
+        __sync_synchronize();           //item must be visible before the new head
+        head = h + 1;
+        if(used + 1 > highWater)
+            highWater = used + 1;
+        return true;
+    }
+
+    //Consumer side. Returns false when the ring is empty.
+    bool pop(T& item) {
+        uint32_t t = tail;
+        if(t == head)
+            return false;
+        __sync_synchronize();           //read the item only after seeing the head
+        item = buf[t & (N - 1)];
+        __sync_synchronize();           //finish reading before handing the slot back
+        tail = t + 1;
+        return true;
+    }
+
+    //Consumer side: the next item without taking it. Returns false when the ring is empty.
+    bool peek(T& item) const {
+        uint32_t t = tail;
+        if(t == head)
+            return false;
+        __sync_synchronize();
+        item = buf[t & (N - 1)];
+        return true;
+    }
+
+    bool empty() const { return head == tail; }
+    uint32_t count() const { return head - tail; }
+    uint32_t capacity() const { return N; }
+
+    uint32_t overflows() const { return overflowCount; }
+    uint32_t highWatermark() const { return highWater; }
+
+    //Clear the counters. Called from the consumer; a push racing with it may survive.
+    void resetStats() {
+        overflowCount = 0;
+        highWater = 0;
+    }
+
+private:
+    T buf[N];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t overflowCount;
+    volatile uint32_t highWater;
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*
+Firmware transposer
+ ==============================================
+Shifts the divisions' notes on their way to the output (sendKeyEvents()), so the host
+receives them already transposed and the transpose buttons need no round trip.
+
+The shift is a 128-entry table rebuilt whenever the transposition changes. A note
+shifted off either end of the MIDI range maps to TRANSPOSE_NONE and isn't sent.
+
+Every held key remembers the note it actually sent, and its note off goes to that
+note whatever the transposition is by then. A change mid-chord leaves the held notes
+alone and only shifts what is played next. Two keys can then land on one note (C held
+at +2, D pressed at 0), so each sent note counts the keys holding it: the note on goes
+out with the first and the note off with the last.
+
+transposeSounding() is the firmware's own record of what it has sent, for the
+watchdog in heldnotes.h to check the host against.
+*/
+
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include "Arduino.h"
+
+#define TRANSPOSE_NONE		0xFF	//no note to send
+#define TRANSPOSE_RANGE		12	//most semitones either way
+#define TRANSPOSE_CHANNELS	4	//most channels tracked
+
+//channels: the channels shifted and tracked, bit n = channel n + 1. Others pass through.
+void transposeBegin(uint16_t channels);
+
+//Shift from the next note on. Clamped to +/- TRANSPOSE_RANGE.
+void transposeSet(int8_t offset);
+int8_t transposeOffset();
+
+//key went down: the note on to send, or TRANSPOSE_NONE if there's none to send
+uint8_t transposeOn(byte channel, byte key);
+
+//key went up: the note off to send, or TRANSPOSE_NONE if another key still holds it
+uint8_t transposeOff(byte channel, byte key);
+
+//Notes sent on and not yet off: [0] = notes 0 - 63, [1] = 64 - 127. 0 if untracked.
+const uint64_t* transposeSounding(byte channel);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+Non-blocking I2C master
+ ==============================================
+Sends I2C writes on TWI1 (SDA 20 / SCL 21, the Wire bus) by PDC DMA, with no waiting
+anywhere. twiWrite() copies the bytes and starts the transfer; twiService(), called
+from loop(), moves the state machine on and reports how the transfer ended.
+
+No interrupt is used: Wire already owns TWI1_Handler, and one status read per pass of
+loop() is all the LCD needs. Wire.begin() sets up the pins, clock and bus speed;
+twiBegin() takes over from there.
+
+A bus that stops answering (a slave holding SDA, a noisy ribbon cable) times out
+instead of hanging. The controller is then reset and the bus is recovered in the
+background by clocking SCL by hand until SDA is released and ending with a STOP, one
+clock edge per service call.
+
+On the Due twiRegs is the real TWI1. On any other target it points at a plain register
+bank so a host-side mock can play the peripheral.
+*/
+
+#ifndef TWI_H
+#define TWI_H
+
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+typedef Twi TwiRegs;
+#else
+//Host stand-in for the TWI and PDC registers used here
+struct TwiRegs {
+    volatile uint32_t TWI_CR;
+    volatile uint32_t TWI_MMR;
+    volatile uint32_t TWI_CWGR;
+    volatile uint32_t TWI_SR;
+    volatile uint32_t TWI_THR;
+    volatile uintptr_t TWI_TPR;
+    volatile uint32_t TWI_TCR;
+    volatile uint32_t TWI_PTCR;
+};
+
+#define TWI_CR_START        (1u << 0)
+#define TWI_CR_STOP         (1u << 1)
+#define TWI_CR_MSEN         (1u << 2)
+#define TWI_CR_MSDIS        (1u << 3)
+#define TWI_CR_SVDIS        (1u << 5)
+#define TWI_CR_SWRST        (1u << 7)
+#define TWI_SR_TXCOMP       (1u << 0)
+#define TWI_SR_TXRDY        (1u << 2)
+#define TWI_SR_NACK         (1u << 8)
+#define TWI_SR_ARBLST       (1u << 9)
+#define TWI_SR_ENDTX        (1u << 13)
+#define TWI_MMR_DADR(a)     ((0x7Fu & (a)) << 16)
+#define TWI_PTCR_TXTEN      (1u << 8)
+#define TWI_PTCR_TXTDIS     (1u << 9)
+#endif
+
+#define TWI_MAX_WRITE       40      //bytes per transfer
+#define TWI_TIMEOUT_US      1000    //plus TWI_BYTE_US per byte before a transfer is given up
+#define TWI_BYTE_US         100     //one byte at 100 kHz, with margin
+
+enum TwiResult {
+    TWI_DONE,               //idle, last transfer acknowledged
+    TWI_BUSY,               //transfer or bus recovery in progress
+    TWI_NACK,               //slave didn't acknowledge; bus is fine
+    TWI_FAULT               //timed out or lost arbitration; bus recovered
+};
+
+extern TwiRegs* twiRegs;
+
+//Bus faults recovered and NACKs seen since start-up
+extern uint32_t twiFaults;
+extern uint32_t twiNacks;
+
+//Take over the controller after Wire.begin()
+void twiBegin();
+
+//Start writing length bytes to a 7-bit address. Returns false if still busy.
+bool twiWrite(uint8_t address, const uint8_t* data, uint16_t length);
+
+//Move the transfer along. Returns TWI_BUSY until it ends, then how it ended; the
+//result of a finished transfer is reported once, after which it reads TWI_DONE.
+TwiResult twiService();
+
+bool twiIdle();
+
+#endif
@@ -0,0 +1,373 @@
+#include "sim.h"
+#include "matrix.h"
+
+uint32_t consoleEdges;
+
+static PioRegs ports[PORT_COUNT];
+static uint32_t outputs[PORT_COUNT];    //output enabled (PIO_OSR)
+static uint32_t peripheral[PORT_COUNT]; //lines handed to a peripheral (PIO_PSR clear)
+static uint32_t watched[PORT_COUNT];    //change interrupt enabled (PIO_IMR)
+static uint32_t lowInputs[PORT_COUNT];  //inputs a contact holds LOW
+static bool dirty = true;
+
+//Allen MDC 20 wiring: [drive row][sense line] -> note, 0 = not wired. Row by row the
+//drive pins are listed in scan order; the Great and Swell are wired alike.
+static const uint8_t manualRows[6][11] = {
+    { 0, 37, 43, 49, 55, 61, 67, 73, 79, 85, 91},
+    { 0, 38, 44, 50, 56, 62, 68, 74, 80, 86, 92},
+    { 0, 39, 45, 51, 57, 63, 69, 75, 81, 87, 93},
+    { 0, 40, 46, 52, 58, 64, 70, 76, 82, 88, 94},
+    { 0, 41, 47, 53, 59, 65, 71, 77, 83, 89, 95},
+    {36, 42, 48, 54, 60, 66, 72, 78, 84, 90, 96}
+};
+
+static const uint8_t pedalRows[6][7] = {
+    { 0, 37, 43, 49, 55, 61, 67},
+    { 0, 38, 44, 50, 56, 62,  0},
+    { 0, 39, 45, 51, 57, 63,  0},
+    { 0, 40, 46, 52, 58, 64,  0},
+    { 0, 41, 47, 53, 59, 65,  0},
+    {36, 42, 48, 54, 60, 66,  0}
+};
+
+struct DivisionWiring {
+    uint8_t channel;
+    uint8_t drive[6];           //drive row pins in scan order
+    uint8_t firstSense;
+    uint8_t senseLines;
+    uint8_t keys;
+};
+
+static const DivisionWiring divisions[SIM_DIVISIONS] = {
+    {1, {22, 23, 24, 25, 26, 27}, 36, 11, 61},     //Swell
+    {2, {28, 29, 30, 31, 32, 33}, 36, 11, 61},     //Great
+#if DIN_MIDI_OUT
+    {3, {14, 15, 16, 17, 34, 19}, 47, 7, 32},      //Pedal, 18 being DIN MIDI OUT (TX1)
+#else
+    {3, {14, 15, 16, 17, 18, 19}, 47, 7, 32},      //Pedal
+#endif
+};
+
+uint8_t consoleChannel(uint8_t division) {
+    return divisions[division].channel;
+}
+
+uint8_t consoleKeys(uint8_t division) {
+    return divisions[division].keys;
+}
+
+bool consoleKey(uint8_t division, uint8_t note, SimKeyWiring& w) {
+    const DivisionWiring& d = divisions[division];
+    for(uint8_t r = 0; r < 6; r++) {
+        for(uint8_t s = 0; s < d.senseLines; s++) {
+            uint8_t n = division == SIM_PEDAL ? pedalRows[r][s] : manualRows[r][s];
+            if(n && n == note) {
+                w.drive = d.drive[r];
+                w.sense = d.firstSense + s;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool consolePiston(uint8_t n, SimKeyWiring& w) {
+    if(n < 6 || (n >= 56 && n <= 58)) {
+        w.drive = SIM_GROUND;
+        w.sense = n;
+        return true;
+    }
+    if(n >= 6 && n < 18) {
+        w.drive = 59 + (n - 6) / 4;
+        w.sense = 62 + (n - 6) % 4;
+        return true;
+    }
+    return false;
+}
+
+//Contacts ===============================================================
+//A contact that has just moved chatters for bounceUs. Time is cut into slots of
+//BOUNCE_SLOT_US; in each the contact is at its new position with a chance that rises
+//from 0 to 1 over the bounce, the first slot (first touch) always being the new one.
+#define MAX_CONTACTS        256
+#define BOUNCE_SLOT_US      25
+
+struct Contact {
+    uint8_t drive;
+    uint8_t sense;
+    bool closed;                //where it is going
+    bool active;                //on the active list: closed or still chattering
+    uint64_t movedAt;
+    uint64_t bounceEnd;
+    uint32_t seed;
+};
+
+static Contact contacts[MAX_CONTACTS];
+static uint16_t contactCount;
+static uint16_t bouncing;               //contacts still chattering
+static uint32_t bounceUs;
+
+//Only the contacts that can pull a line are looked at on each step
+static uint16_t active[MAX_CONTACTS];
+static uint16_t activeCount;
+
+static uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+static bool contactClosed(const Contact& c, uint64_t now) {
+    if(now >= c.bounceEnd)
+        return c.closed;
+    uint64_t slot = (now - c.movedAt) / (BOUNCE_SLOT_US * SIM_CYCLES_PER_US);
+    if(slot == 0)
+        return c.closed;
+    uint64_t chance = (now - c.movedAt) * 1000 / (c.bounceEnd - c.movedAt);
+    bool settled = hash(c.seed + (uint32_t)slot) % 1000 < chance;
+    return settled ? c.closed : !c.closed;
+}
+
+static Contact* findContact(uint8_t drive, uint8_t sense) {
+    for(uint16_t n = 0; n < contactCount; n++) {
+        if(contacts[n].drive == drive && contacts[n].sense == sense)
+            return &contacts[n];
+    }
+    if(contactCount == MAX_CONTACTS)
+        return 0;
+    Contact& c = contacts[contactCount++];
+    c = Contact();
+    c.drive = drive;
+    c.sense = sense;
+    return &c;
+}
+
+void consoleContact(uint8_t drive, uint8_t sense, bool closed) {
+    Contact* c = findContact(drive, sense);
+    if(!c || c->closed == closed)
+        return;
+    if(c->bounceEnd > c->movedAt)
+        bouncing--;
+    c->closed = closed;
+    c->movedAt = simClock;
+    c->bounceEnd = simClock + (uint64_t)bounceUs * SIM_CYCLES_PER_US;
+    c->seed = hash(simConfig.seed ^ (drive << 8 | sense) ^ (uint32_t)simClock);
+    if(simClock < c->bounceEnd)
+        bouncing++;
+    if(!c->active) {
+        c->active = true;
+        active[activeCount++] = c - contacts;
+    }
+    dirty = true;
+}
+
+//Sense lines ============================================================
+//A sense line follows what pulls it settleUs late, both ways: LOW through a closed
+//contact to a row driven LOW or to ground, HIGH through its pull-up otherwise.
+#define LINE_HISTORY        16
+
+struct SenseLine {
+    bool level;                 //as the PIO sees it
+    uint8_t head, tail;         //changes of target not yet through
+    uint64_t at[LINE_HISTORY];
+    bool to[LINE_HISTORY];
+};
+
+static SenseLine lines[66];
+static uint32_t senseLines[PORT_COUNT]; //bits with a contact on them
+static uint32_t pulledLow[PORT_COUNT];  //lines the contacts are pulling LOW (the target)
+static uint32_t inFlight[PORT_COUNT];   //lines with a change of target not yet through
+static uint8_t linePin[PORT_COUNT][32];
+static uint64_t next = SIM_NEVER;
+
+static bool driveLow(uint8_t pin) {
+    if(pin == SIM_GROUND)
+        return true;
+    PinBit b = duePin(pin);
+    uint32_t m = 1UL << b.bit;
+    return (outputs[b.port] & m) && !(ports[b.port].PIO_ODSR & m);
+}
+
+void consoleBounce(uint32_t us) {
+    bounceUs = us;
+}
+
+void consoleBegin() {
+    bounceUs = simConfig.bounceUs;
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        ports[p] = PioRegs();
+        ports[p].PIO_PDSR = 0xFFFFFFFF;
+        outputs[p] = watched[p] = lowInputs[p] = peripheral[p] = 0;
+        senseLines[p] = pulledLow[p] = inFlight[p] = 0;
+        pioPorts[p] = &ports[p];
+    }
+    //The core's init() gives TX1 (pin 18) to USART0 before setup(); Serial1.begin()
+    //doesn't, so a pinMode() on it keeps it from the USART for good
+    PinBit tx = duePin(18);
+    peripheral[tx.port] |= 1UL << tx.bit;
+
+    //Every contact on the console, open
+    SimKeyWiring w;
+    for(uint8_t d = 0; d < SIM_DIVISIONS; d++) {
+        for(uint8_t note = 36; note < 36 + consoleKeys(d); note++) {
+            if(consoleKey(d, note, w))
+                findContact(w.drive, w.sense);
+        }
+    }
+    for(uint8_t n = 0; n < 59; n++) {
+        if(consolePiston(n, w))
+            findContact(w.drive, w.sense);
+    }
+    findContact(SIM_GROUND, 6);         //transpose up
+    findContact(SIM_GROUND, 7);         //transpose down
+    activeCount = 0;
+
+    for(uint8_t pin = 0; pin < 66; pin++) {
+        lines[pin] = SenseLine();
+        lines[pin].level = true;
+        PinBit b = duePin(pin);
+        linePin[b.port][b.bit] = pin;
+    }
+    for(uint16_t n = 0; n < contactCount; n++) {
+        PinBit b = duePin(contacts[n].sense);
+        senseLines[b.port] |= 1UL << b.bit;
+    }
+    dirty = true;
+}
+
+//Take up what the sketch wrote to the write-only registers since the last step. Two
+//writes to the same register in between keep only the last, so write-only register
+//writes must be separated by a clock read (every HAL call is one).
+static void applyWrites() {
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        PioRegs& r = ports[p];
+        if(!(r.PIO_SODR | r.PIO_CODR | r.PIO_OER | r.PIO_ODR | r.PIO_PER | r.PIO_PDR |
+             r.PIO_IER | r.PIO_IDR))
+            continue;
+        r.PIO_ODSR = (r.PIO_ODSR | r.PIO_SODR) & ~r.PIO_CODR;
+        outputs[p] = (outputs[p] | r.PIO_OER) & ~r.PIO_ODR;
+        peripheral[p] = (peripheral[p] | r.PIO_PDR) & ~r.PIO_PER;
+        watched[p] = (watched[p] | r.PIO_IER) & ~r.PIO_IDR;
+        r.PIO_SODR = r.PIO_CODR = r.PIO_OER = r.PIO_ODR = 0;
+        r.PIO_PER = r.PIO_PDR = r.PIO_IER = r.PIO_IDR = 0;
+        r.PIO_ISR = 0;
+        dirty = true;
+    }
+}
+
+//What the active contacts pull LOW now. Contacts that are open and done chattering
+//leave the list.
+static void pullLines(uint64_t now, uint32_t* pulled, uint64_t& soonest) {
+    uint64_t slot = BOUNCE_SLOT_US * SIM_CYCLES_PER_US;
+    for(uint16_t n = 0; n < activeCount;) {
+        Contact& c = contacts[active[n]];
+        if(c.bounceEnd > c.movedAt && now >= c.bounceEnd) {
+            c.bounceEnd = c.movedAt;                //done chattering
+            bouncing--;
+        }
+        else if(now < c.bounceEnd) {
+            uint64_t edge = now + slot - (now - c.movedAt) % slot;
+            if(edge > c.bounceEnd)
+                edge = c.bounceEnd;
+            if(edge < soonest)
+                soonest = edge;
+        }
+        if(contactClosed(c, now) && driveLow(c.drive)) {
+            PinBit b = duePin(c.sense);
+            pulled[b.port] |= 1UL << b.bit;
+        }
+        if(!c.closed && c.bounceEnd <= c.movedAt) {
+            c.active = false;
+            active[n] = active[--activeCount];
+        }
+        else
+            n++;
+    }
+}
+
+void consoleStep(uint64_t now) {
+    applyWrites();
+    if(!dirty && !bouncing && next == SIM_NEVER)
+        return;
+
+    uint64_t soonest = SIM_NEVER;
+    if(dirty || bouncing) {
+        uint32_t pulled[PORT_COUNT] = {0, 0, 0, 0};
+        pullLines(now, pulled, soonest);
+
+        //Note each line whose target moved
+        for(uint8_t p = 0; p < PORT_COUNT; p++) {
+            uint32_t changed = (pulled[p] ^ pulledLow[p]) & senseLines[p];
+            pulledLow[p] = pulled[p];
+            inFlight[p] |= changed;
+            for(; changed; changed &= changed - 1) {
+                uint8_t bit = __builtin_ctz(changed);
+                SenseLine& l = lines[linePin[p][bit]];
+                if((uint8_t)(l.head - l.tail) == LINE_HISTORY)
+                    l.tail++;                       //ringing faster than we keep; drop the oldest
+                l.at[l.head % LINE_HISTORY] = now;
+                l.to[l.head % LINE_HISTORY] = !(pulled[p] & (1UL << bit));
+                l.head++;
+            }
+        }
+        dirty = false;
+    }
+
+    //What has had time to get through
+    uint64_t settle = (uint64_t)simConfig.settleUs * SIM_CYCLES_PER_US;
+    for(uint8_t p = 0; p < PORT_COUNT; p++) {
+        for(uint32_t pending = inFlight[p]; pending; pending &= pending - 1) {
+            uint8_t bit = __builtin_ctz(pending);
+            uint8_t pin = linePin[p][bit];
+            uint32_t m = 1UL << bit;
+            SenseLine& l = lines[pin];
+            while(l.head != l.tail && l.at[l.tail % LINE_HISTORY] + settle <= now) {
+                bool high = l.to[l.tail % LINE_HISTORY];
+                l.tail++;
+                if(high == l.level)
+                    continue;
+                l.level = high;
+                if(high)
+                    lowInputs[p] &= ~m;
+                else {
+                    lowInputs[p] |= m;
+                    if(watched[p] & m) {
+                        consoleEdges++;
+                        simPinEdge(pin);
+                    }
+                }
+            }
+            if(l.head == l.tail)
+                inFlight[p] &= ~m;
+            else if(l.at[l.tail % LINE_HISTORY] + settle < soonest)
+                soonest = l.at[l.tail % LINE_HISTORY] + settle;
+        }
+    }
+    next = soonest;
+
+    for(uint8_t p = 0; p < PORT_COUNT; p++)
+        ports[p].PIO_PDSR = (ports[p].PIO_ODSR & outputs[p]) | (~outputs[p] & ~lowInputs[p]);
+}
+
+uint64_t consoleNext() {
+    return next;
+}
+
+bool consolePinHigh(uint8_t pin) {
+    PinBit b = duePin(pin);
+    return ports[b.port].PIO_PDSR & (1UL << b.bit);
+}
+
+bool consolePeripheral(uint8_t pin) {
+    applyWrites();
+    PinBit b = duePin(pin);
+    return peripheral[b.port] & (1UL << b.bit);
+}
+
+bool consoleOutputHigh(uint8_t pin) {
+    PinBit b = duePin(pin);
+    return ports[b.port].PIO_ODSR & (1UL << b.bit);
+}
@@ -0,0 +1,338 @@
+#include "sim.h"
+#include "Arduino.h"
+#include <MIDIUSB.h>
+#include <Keyboard.h>
+#include <Mouse.h>
+#include <Wire.h>
+#include <DueTimer.h>
+#include <LiquidCrystal_I2C.h>
+#include "matrix.h"
+#include "twi.h"
+#include <stdio.h>
+
+SimConfig simConfig;
+uint64_t simClock;
+
+uint32_t keyboardPresses;
+uint32_t timerTicks;
+
+MIDI_ MidiUSB;
+Keyboard_ Keyboard;
+Mouse_ Mouse;
+TwoWire Wire;
+DueTimer Timer3;
+USARTClass Serial1;
+
+static void (*pinCallback[66])();
+static uint8_t pendingEdge[66];         //edge interrupts waiting to run, by pin
+static bool edgesPending;
+static bool inInterrupt;
+static bool masked;                     //__disable_irq()
+static bool interruptRan;               //for simSkip()
+
+//Clock ==================================================================
+static uint64_t nextEvent() {
+    uint64_t next = Timer3.running ? Timer3.next : SIM_NEVER;
+    uint64_t n;
+    if((n = playerNext()) < next) next = n;
+    if((n = consoleNext()) < next) next = n;
+    if((n = peripheralsNext()) < next) next = n;
+    if((n = hostNext()) < next) next = n;
+    return next;
+}
+
+static void stepAll() {
+    playerStep(simClock);
+    hostStep(simClock);
+    consoleStep(simClock);
+    peripheralsStep(simClock);
+}
+
+//Run what the NVIC would at this point: edges first (PIOA - C sit below TC3), one
+//interrupt at a time, none while one is already running
+static void interrupts() {
+    if(inInterrupt || masked)
+        return;
+
+    if(Timer3.running && simClock >= Timer3.next) {
+        Timer3.pending = true;
+        while(Timer3.next <= simClock)
+            Timer3.next += Timer3.period;
+    }
+
+    while(edgesPending || Timer3.pending) {
+        inInterrupt = true;
+        interruptRan = true;
+        if(edgesPending) {
+            edgesPending = false;
+            for(uint8_t pin = 0; pin < 66; pin++) {
+                if(pendingEdge[pin]) {
+                    pendingEdge[pin] = 0;
+                    edgesPending = true;
+                    if(pinCallback[pin])
+                        pinCallback[pin]();
+                    break;
+                }
+            }
+        }
+        else {
+            Timer3.pending = false;
+            timerTicks++;
+            if(Timer3.callback)
+                Timer3.callback();
+        }
+        inInterrupt = false;
+
+        if(Timer3.running && simClock >= Timer3.next) {
+            Timer3.pending = true;
+            while(Timer3.next <= simClock)
+                Timer3.next += Timer3.period;
+        }
+    }
+}
+
+void simAdvance(uint64_t until) {
+    do {
+        uint64_t next = nextEvent();
+        if(next > until)
+            next = until;
+        if(next > simClock)
+            simClock = next;
+        stepAll();
+        interrupts();
+    } while(simClock < until);
+}
+
+void simSkip(uint64_t until) {
+    interruptRan = false;
+    while(simClock < until && !interruptRan && !hostPending()) {
+        uint64_t next = nextEvent();
+        if(next > until)
+            next = until;
+        if(next > simClock)
+            simClock = next;
+        stepAll();
+        interrupts();
+    }
+}
+
+void simCall() {
+    uint64_t cost = (uint64_t)simConfig.callNs * SIM_CYCLES_PER_US / 1000;
+    simAdvance(simClock + (cost ? cost : 1));
+}
+
+void simPinEdge(uint8_t pin) {
+    pendingEdge[pin] = 1;
+    edgesPending = true;
+}
+
+uint32_t hostCycles() {
+    simCall();
+    return (uint32_t)simClock;
+}
+
+void hostWaitUntil(uint32_t deadline) {
+    int32_t left = (int32_t)(deadline - (uint32_t)simClock);
+    if(left > 0)
+        simAdvance(simClock + left);
+    else
+        simCall();
+}
+
+//Arduino core ===========================================================
+static PioRegs* pinPort(uint32_t pin) {
+    return pioPorts[duePin(pin).port];
+}
+
+static uint32_t pinMask(uint32_t pin) {
+    return 1UL << duePin(pin).bit;
+}
+
+void pinMode(uint32_t pin, uint32_t mode) {
+    if(pin >= 66)
+        return;
+    PioRegs* pio = pinPort(pin);
+    pio->PIO_PER = pinMask(pin);
+    if(mode == OUTPUT)
+        pio->PIO_OER = pinMask(pin);
+    else
+        pio->PIO_ODR = pinMask(pin);
+    simCall();
+}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+    if(pin >= 66)
+        return;
+    if(value)
+        pinPort(pin)->PIO_SODR = pinMask(pin);
+    else
+        pinPort(pin)->PIO_CODR = pinMask(pin);
+    simCall();
+}
+
+int digitalRead(uint32_t pin) {
+    simCall();
+    return pin < 66 && consolePinHigh(pin) ? HIGH : LOW;
+}
+
+//Only good before adcBegin() (see adc.h), which the sketch never does
+int analogRead(uint32_t pin) {
+    simCall();
+    return 0;
+}
+
+unsigned long millis() {
+    simCall();
+    return (uint32_t)(simClock / (SIM_CYCLES_PER_US * 1000));
+}
+
+unsigned long micros() {
+    simCall();
+    return (uint32_t)(simClock / SIM_CYCLES_PER_US);
+}
+
+void delay(unsigned long ms) {
+    simAdvance(simClock + ms * SIM_CYCLES_PER_US * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    simAdvance(simClock + us * SIM_CYCLES_PER_US);
+}
+
+void yield() {
+    simCall();
+}
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh) {
+    return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
+
+//As on the Due: the pin's change interrupt is enabled straight away
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode) {
+    if(pin >= 66)
+        return;
+    pinCallback[pin] = callback;
+    pinPort(pin)->PIO_IER = pinMask(pin);
+    simCall();
+}
+
+void detachInterrupt(uint32_t pin) {
+    if(pin >= 66)
+        return;
+    pinPort(pin)->PIO_IDR = pinMask(pin);
+    pinCallback[pin] = 0;
+    simCall();
+}
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {}
+
+void NVIC_SetPendingIRQ(IRQn_Type irq) {
+    if(irq == TC3_IRQn)
+        Timer3.pending = true;
+}
+
+void __disable_irq() {
+    masked = true;
+}
+
+void __enable_irq() {
+    masked = false;
+}
+
+size_t Print::write(const uint8_t* data, size_t length) {
+    for(size_t n = 0; n < length; n++)
+        write(data[n]);
+    return length;
+}
+
+size_t Print::print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(int value) {
+    char text[12];
+    snprintf(text, sizeof(text), "%d", value);
+    return print(text);
+}
+
+//Libraries ==============================================================
+size_t MIDI_::write(const uint8_t* data, size_t length) {
+    simCall();
+    hostReceive(data, length);
+    return length;
+}
+
+size_t Keyboard_::press(uint8_t key) {
+    keyboardPresses++;
+    return 1;
+}
+
+size_t Keyboard_::release(uint8_t key) {
+    return 1;
+}
+
+void Keyboard_::releaseAll() {}
+
+size_t Keyboard_::write(uint8_t c) {
+    keyboardPresses++;
+    return 1;
+}
+
+void USARTClass::begin(unsigned long baud) {
+    usartBegin(baud);
+}
+
+//100 kHz, as Wire sets up TWI1
+void TwoWire::begin() {
+    twiRegs->TWI_CWGR = 0x1D1D;
+}
+
+DueTimer& DueTimer::attachInterrupt(void (*isr)()) {
+    callback = isr;
+    return *this;
+}
+
+DueTimer& DueTimer::setFrequency(double hz) {
+    period = (uint64_t)(SIM_CYCLES_PER_US * 1000000 / hz);
+    return *this;
+}
+
+//The counter restarts, so the first tick is a whole period away
+DueTimer& DueTimer::start() {
+    running = true;
+    next = simClock + period;
+    return *this;
+}
+
+DueTimer& DueTimer::stop() {
+    running = false;
+    return *this;
+}
+
+void LiquidCrystal_I2C::init() {
+    lcdInit();
+}
+
+void LiquidCrystal_I2C::createChar(uint8_t location, uint8_t* pattern) {
+    lcdCommand(0x40 | (location & 7) << 3);
+    for(uint8_t n = 0; n < 8; n++)
+        lcdData(pattern[n]);
+}
+
+void LiquidCrystal_I2C::setCursor(uint8_t col, uint8_t row) {
+    static const uint8_t rowStart[4] = {0x00, 0x40, 0x14, 0x54};
+    lcdCommand(0x80 | (col + rowStart[row & 3]));
+}
+
+void LiquidCrystal_I2C::command(uint8_t value) {
+    lcdCommand(value);
+}
+
+size_t LiquidCrystal_I2C::write(uint8_t c) {
+    lcdData(c);
+    return 1;
+}
@@ -0,0 +1,643 @@
+#include "sim.h"
+#include "midiin.h"
+#include "flightrec.h"
+#include "transpose.h"
+#include "profile.h"
+#include "combination.h"
+#include <stdio.h>
+#include <string.h>
+
+//GrandOrgue's side of the cable. Every packet the sketch writes is checked against
+//the keys the player is holding, coupled and shifted as the console does it: a key
+//sounds on its own division and on each one an engaged coupler takes it to, shifted by
+//the transposition when it got there, and a note counts the keys on it.
+#define HOST_INBOX          4096        //bytes of packets waiting for the sketch
+#define HOST_LOG            8192        //channel messages kept to check a flight dump against
+#define HOST_SYSEX          256
+#define LATENCY_US          20000       //histogram range; anything longer counts in the last us
+#define STOP_CHANNEL        6           //as main.cpp
+
+//What the host knows about one note on a checked channel
+struct HostNote {
+    bool down;                  //a key for it is down on the console
+    uint8_t keys;               //keys down on it
+    bool pending;               //pressed, note on not here yet
+    bool sounding;              //note on received, no note off since
+    bool resent;                //All Notes Off cleared it while sounding; a resync may resend it
+    bool overlap;               //pressed while still sounding for a released key
+    uint64_t downAt;
+    uint64_t upAt;
+};
+
+struct Latency {
+    uint32_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t hist[LATENCY_US];  //count per us
+
+    void add(uint64_t us) {
+        count++;
+        total += us;
+        if(us > max)
+            max = us;
+        hist[us < LATENCY_US ? us : LATENCY_US - 1]++;
+    }
+
+    uint64_t percentile(uint8_t percent) const {
+        uint64_t want = ((uint64_t)count * percent + 99) / 100;
+        uint64_t seen = 0;
+        for(uint32_t us = 0; us < LATENCY_US - 1; us++) {
+            seen += hist[us];
+            if(seen >= want)
+                return us;
+        }
+        return max;
+    }
+};
+
+static HostNote notes[16][128];
+static const struct { uint8_t from, to; } couplers[] = {{1, 2}, {1, 3}, {2, 3}};    //as main.cpp
+#define COUPLERS            (sizeof(couplers) / sizeof(couplers[0]))
+
+static bool keyDown[16][128];
+static uint8_t keyNote[16][16][128];    //[from - 1][to - 1][key]: the note it's expected on
+static bool engaged[COUPLERS];
+static int8_t transposition;
+static uint16_t checked;                //channels the player plays, bit n = channel n + 1
+
+//Checks
+static uint32_t ghosts;                 //note on with no key down to account for it
+static uint32_t retriggers;             //a second note on for one press of a held key
+static uint32_t doubleOns;              //note on for a note already sounding
+static uint32_t strayOffs;              //note off for a note not sounding
+static uint32_t cutOffs;                //note off while the key is still down
+static uint32_t missed;                 //key pressed, no note on by the end
+static uint32_t stuck;                  //note still sounding after every key is up
+
+//Traffic
+static uint32_t transfers;
+static uint32_t packets;
+static uint32_t noteOns;
+static uint32_t noteOffs;
+static uint32_t controls;
+static uint32_t allNotesOff;
+static uint32_t resyncNotes;
+static uint32_t sysExBytes;
+static Latency pressLatency, releaseLatency;
+static Latency benchLatency[SIM_BENCH_CASES];
+static uint8_t benchCase = SIM_BENCH_CASES;     //none
+static const char* const patternNames[SIM_PATTERNS] = {
+    "single notes", "10-note chords", "glissandi", "bouncing contacts"
+};
+
+//DIN MIDI in: every channel message heard on USB, in the same order
+static uint8_t dinStatus;               //running status, 0 = none yet
+static uint8_t dinData[2];
+static uint8_t dinCount;
+static uint32_t dinMessages;            //complete messages; index into hostLog
+static uint32_t dinMismatches;          //not the USB message in its place, or too late to tell
+static uint32_t dinBytes;
+
+//Every channel message, newest last
+static uint8_t hostLog[HOST_LOG][3];
+static uint32_t logCount;
+
+//Flight recorder dump being put back together
+static uint8_t sysEx[HOST_SYSEX];
+static uint16_t sysExLength;
+static uint8_t dump[FLIGHT_BYTES + 4 + 4 + 1 + FLIGHT_ROWS * SENSE_PORTS * 4];
+static uint32_t dumpLength;
+static bool dumpDone;
+static uint32_t dumpBroken;             //chunks out of order or too long
+static uint32_t dumpMismatches;         //events that don't match what the host heard
+static uint32_t dumpRowsLeft;           //replayed sense bits still set with every key up
+static uint32_t dumpRecords, dumpEvents;
+static double dumpSeconds;
+
+//The registration as GrandOrgue keeps it. The organist's stop changes go to the console
+//and the console's come back, all as notes on STOP_CHANNEL, and GrandOrgue reports each
+//change it takes from the console back to it.
+static bool stops[STOP_COUNT];
+static bool memory[COMBO_PISTONS][STOP_COUNT];      //what set stored on each general piston
+static uint32_t stopChanges;            //from the console
+static uint32_t idleStops;              //from the console, and changed nothing
+static uint32_t recalls;                //registrations checked after a recall or cancel
+static uint32_t recallMismatches;       //not as set
+
+//The key event ring's counters, from the sendKeyEvents() profile report
+static bool ringReported;
+static uint32_t ringHigh, ringLost;
+
+//To the sketch
+static uint8_t inbox[HOST_INBOX];
+static uint32_t inHead, inTail;
+
+static void fail(const char* what, uint8_t channel, uint8_t note) {
+    if(simConfig.verbose)
+        printf("%10.3f s  %s: channel %u note %u\n", simMicros() / 1e6, what, channel, note);
+}
+
+void hostBegin() {
+    memset(notes, 0, sizeof(notes));
+    logCount = 0;
+    sysExLength = 0;
+    dumpLength = 0;
+    dumpDone = false;
+    ringReported = false;
+    memset(stops, 0, sizeof(stops));
+    memset(memory, 0, sizeof(memory));
+    checked = 0;
+    transposition = 0;
+    memset(keyDown, 0, sizeof(keyDown));
+    memset(engaged, 0, sizeof(engaged));
+    inHead = inTail = 0;
+    dinStatus = 0;
+    dinCount = 0;
+    dinMessages = 0;
+}
+
+static void noteOn(uint8_t channel, uint8_t note) {
+    noteOns++;
+    if(!(checked & (1 << (channel - 1))))
+        return;
+    HostNote& n = notes[channel - 1][note];
+    if(n.sounding) {
+        doubleOns++;
+        fail("note on twice", channel, note);
+    }
+    else if(n.pending) {
+        uint64_t us = (simClock - n.downAt) / SIM_CYCLES_PER_US;
+        pressLatency.add(us);
+        if(benchCase < SIM_BENCH_CASES)
+            benchLatency[benchCase].add(us);
+    }
+    else if(n.resent)
+        resyncNotes++;
+    else if(n.down) {
+        retriggers++;
+        fail("retriggered", channel, note);
+    }
+    else {
+        ghosts++;
+        fail("ghost note", channel, note);
+    }
+    n.pending = false;
+    n.resent = false;
+    n.overlap = false;
+    n.sounding = true;
+}
+
+static void noteOff(uint8_t channel, uint8_t note) {
+    noteOffs++;
+    if(!(checked & (1 << (channel - 1))))
+        return;
+    HostNote& n = notes[channel - 1][note];
+    if(!n.sounding) {
+        strayOffs++;
+        fail("note off without note on", channel, note);
+    }
+    else if(n.down && n.overlap)
+        n.pending = true;       //the released key's note off was already on its way
+    else if(n.down) {
+        cutOffs++;
+        fail("note off with the key down", channel, note);
+    }
+    else
+        releaseLatency.add((simClock - n.upAt) / SIM_CYCLES_PER_US);
+    n.sounding = false;
+    n.resent = false;
+    n.overlap = false;
+}
+
+static void controlChange(uint8_t channel, uint8_t control) {
+    controls++;
+    if(control != 123)
+        return;
+    allNotesOff++;
+    for(uint8_t note = 0; note < 128; note++) {
+        HostNote& n = notes[channel - 1][note];
+        if(n.sounding)
+            n.resent = true;       //held, or still inside its release window
+        n.sounding = false;
+    }
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+//Replay a whole dump: the rows from their base frame, and the events against the log
+static void checkDump() {
+    if(dumpLength < 9)
+        return;
+    uint32_t time = get32(dump);
+    uint32_t length = get32(dump + 4);
+    uint8_t rows = dump[8];
+    uint32_t pos = 9 + rows * SENSE_PORTS * 4;
+    if(pos + length != dumpLength || rows > FLIGHT_ROWS) {
+        dumpBroken++;
+        return;
+    }
+    uint32_t sense[FLIGHT_ROWS][SENSE_PORTS];
+    for(uint8_t r = 0; r < rows; r++) {
+        for(uint8_t p = 0; p < SENSE_PORTS; p++)
+            sense[r][p] = get32(dump + 9 + (r * SENSE_PORTS + p) * 4);
+    }
+
+    uint32_t start = time, events = 0;
+    static uint8_t seen[HOST_LOG][3];
+    while(pos < dumpLength) {
+        uint8_t tag = dump[pos++];
+        uint32_t dt = 0;
+        for(uint8_t shift = 0;; shift += 7) {
+            uint8_t b = dump[pos++];
+            dt |= (uint32_t)(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                break;
+        }
+        time += dt;
+        uint8_t r = tag & 0x0F;
+        switch(tag & 0xF0) {
+        case FLIGHT_ROW_BIT:
+            sense[r][dump[pos] >> 5] ^= 1UL << (dump[pos] & 31);
+            pos++;
+            break;
+        case FLIGHT_ROW_XOR: {
+            uint16_t bytes = dump[pos] | dump[pos + 1] << 8;
+            pos += 2;
+            for(; bytes; bytes &= bytes - 1) {
+                uint8_t n = __builtin_ctz(bytes);
+                sense[r][n >> 2] ^= (uint32_t)dump[pos++] << (8 * (n & 3));
+            }
+            break;
+        }
+        case FLIGHT_EVENT:
+            memcpy(seen[events++ % HOST_LOG], dump + pos, 3);
+            pos += 3;
+            break;
+        default:
+            pos++;
+            break;
+        }
+        dumpRecords++;
+    }
+    dumpEvents = events;
+    dumpSeconds = (time - start) / 1e6;
+
+    for(uint8_t r = 0; r < rows; r++) {
+        for(uint8_t p = 0; p < SENSE_PORTS; p++)
+            dumpRowsLeft += __builtin_popcount(sense[r][p]);
+    }
+
+    //The player is done by the time it asks, so the dump's events end where the log does
+    uint32_t compare = events < HOST_LOG ? events : HOST_LOG;
+    for(uint32_t n = 1; n <= compare; n++) {
+        if(n > logCount || memcmp(seen[(events - n) % HOST_LOG], hostLog[(logCount - n) % HOST_LOG], 3))
+            dumpMismatches++;
+    }
+}
+
+//F0 7D 4F 07 <offset> <packed> F7, in order
+static void dumpChunk(const uint8_t* msg, uint16_t length) {
+    if(length < 8)
+        return;
+    uint32_t offset = msg[4] | msg[5] << 7 | (uint32_t)msg[6] << 14;
+    const uint8_t* p = msg + 7;
+    const uint8_t* end = msg + length - 1;
+    if(p == end) {
+        dumpDone = true;
+        if(offset != dumpLength)
+            dumpBroken++;
+        else
+            checkDump();
+        return;
+    }
+    if(offset != dumpLength) {
+        dumpBroken++;
+        return;
+    }
+    while(p < end) {
+        uint8_t high = *p++;
+        for(uint8_t i = 0; i < 7 && p < end; i++) {
+            if(dumpLength == sizeof(dump)) {
+                dumpBroken++;
+                return;
+            }
+            dump[dumpLength++] = *p++ | ((high >> i) & 1) << 7;
+        }
+    }
+}
+
+static uint32_t get7(const uint8_t* p, uint8_t bytes) {
+    uint32_t v = 0;
+    for(uint8_t i = bytes; i--; )
+        v = v << 7 | p[i];
+    return v;
+}
+
+//F0 7D 4F 02 <stage> <stats> <ring high watermark> <ring overflows> F7 (profile.h)
+static void profileReply(const uint8_t* msg, uint16_t length) {
+    if(length != PROFILE_REPORT_BYTES || msg[4] != PROF_SEND_KEYS)
+        return;
+    ringHigh = get7(msg + length - 11, 5);
+    ringLost = get7(msg + length - 6, 5);
+    ringReported = true;
+}
+
+static void sysExByte(uint8_t b) {
+    if(b == 0xF0)
+        sysExLength = 0;
+    if(sysExLength < HOST_SYSEX)
+        sysEx[sysExLength++] = b;
+    if(b == 0xF7 && sysExLength >= 5 && sysEx[0] == 0xF0 && sysEx[3] == 0x07)
+        dumpChunk(sysEx, sysExLength);
+    if(b == 0xF7 && sysExLength >= 5 && sysEx[0] == 0xF0 && sysEx[3] == 0x02)
+        profileReply(sysEx, sysExLength);
+}
+
+static void sendStop(uint8_t stop, bool on) {
+    uint8_t p[4] = {(uint8_t)(on ? 0x09 : 0x08), (uint8_t)((on ? 0x90 : 0x80) | (STOP_CHANNEL - 1)),
+                    stop, (uint8_t)(on ? 127 : 0)};
+    hostSend(p);
+}
+
+//A recall or cancel sends only the stops that change
+static void consoleStop(uint8_t stop, bool on) {
+    stopChanges++;
+    if(stop >= STOP_COUNT || stops[stop] == on) {
+        idleStops++;
+        fail("stop change that changed nothing", STOP_CHANNEL, stop);
+        return;
+    }
+    stops[stop] = on;
+    sendStop(stop, on);
+}
+
+void hostStop(uint8_t stop) {
+    if(stop >= STOP_COUNT)
+        return;
+    stops[stop] = !stops[stop];
+    sendStop(stop, stops[stop]);
+}
+
+void hostComboSet(uint8_t piston) {
+    memcpy(memory[piston], stops, sizeof(stops));
+}
+
+void hostComboCheck(uint8_t piston) {
+    static const bool none[STOP_COUNT] = {false};
+    recalls++;
+    if(memcmp(stops, piston < COMBO_PISTONS ? memory[piston] : none, sizeof(stops))) {
+        recallMismatches++;
+        fail("registration not as set", STOP_CHANNEL, piston);
+    }
+}
+
+void hostReceive(const uint8_t* data, uint32_t length) {
+    transfers++;
+    for(uint32_t i = 0; i + 4 <= length; i += 4) {
+        const uint8_t* p = data + i;
+        uint8_t cin = p[0] & 0x0F;
+        uint8_t channel = (p[1] & 0x0F) + 1;
+        packets++;
+        if(cin >= 0x08)
+            memcpy(hostLog[logCount++ % HOST_LOG], p + 1, 3);
+        if(channel == STOP_CHANNEL && (cin == 0x08 || cin == 0x09))
+            consoleStop(p[2] & 0x7F, cin == 0x09 && p[3]);
+        else if(cin == 0x09 && p[3])
+            noteOn(channel, p[2] & 0x7F);
+        else if(cin == 0x08 || cin == 0x09)
+            noteOff(channel, p[2] & 0x7F);
+        else if(cin == 0x0B)
+            controlChange(channel, p[2]);
+        else if(cin >= 0x04 && cin <= 0x07) {
+            uint8_t n = cin == 0x04 ? 3 : cin - 0x04;
+            sysExBytes += n;
+            for(uint8_t b = 1; b <= n; b++)
+                sysExByte(p[b]);
+        }
+    }
+}
+
+void hostDinByte(uint8_t b) {
+    dinBytes++;
+    if(b >= 0x80) {
+        dinStatus = b < 0xF0 ? b : 0;
+        dinCount = 0;
+        return;
+    }
+    if(!dinStatus)
+        return;
+    dinData[dinCount++] = b;
+    uint8_t size = (dinStatus & 0xE0) == 0xC0 ? 1 : 2;
+    if(dinCount < size)
+        return;
+    dinCount = 0;
+
+    const uint8_t* heard = hostLog[dinMessages % HOST_LOG];
+    if(logCount - dinMessages > HOST_LOG || dinMessages >= logCount || heard[0] != dinStatus ||
+       heard[1] != dinData[0] || (size == 2 && heard[2] != dinData[1])) {
+        dinMismatches++;
+        fail("DIN message not as on USB", (dinStatus & 0x0F) + 1, dinData[0]);
+    }
+    dinMessages++;
+}
+
+void hostSend(const uint8_t* packet) {
+    if(inHead - inTail > HOST_INBOX - 4)
+        return;
+    for(uint8_t n = 0; n < 4; n++)
+        inbox[inHead++ % HOST_INBOX] = packet[n];
+}
+
+void hostSysEx(const uint8_t* data, uint8_t length) {
+    for(uint8_t n = 0; n < length; n += 3) {
+        uint8_t left = length - n;
+        uint8_t p[4] = {(uint8_t)(left > 3 ? 0x04 : 0x04 + left), data[n],
+                        left > 1 ? data[n + 1] : (uint8_t)0, left > 2 ? data[n + 2] : (uint8_t)0};
+        hostSend(p);
+    }
+}
+
+//The sketch reads what the endpoint holds, at most one bank at a time
+uint32_t hostMidiRecv(uint8_t* data, uint32_t len) {
+    uint32_t n = 0;
+    while(n + 4 <= len && inTail != inHead) {
+        for(uint8_t b = 0; b < 4; b++)
+            data[n++] = inbox[inTail++ % HOST_INBOX];
+    }
+    return n;
+}
+
+bool hostPending() {
+    return inHead != inTail;
+}
+
+//Everything the host sends is there at once, so there's nothing to wait for
+void hostStep(uint64_t now) {}
+
+uint64_t hostNext() {
+    return SIM_NEVER;
+}
+
+//Key of channel from now sounds on channel to. The divisions are transposed, the
+//pistons aren't.
+static void hold(uint8_t from, uint8_t to, uint8_t key, uint64_t at) {
+    checked |= 1 << (to - 1);
+    uint8_t note = to <= 3 ? key + transposition : key;
+    keyNote[from - 1][to - 1][key] = note;
+    HostNote& n = notes[to - 1][note];
+    if(!n.keys++) {
+        n.overlap = n.sounding;
+        n.pending = !n.sounding;
+        n.downAt = at;
+    }
+    n.down = true;
+}
+
+static void release(uint8_t from, uint8_t to, uint8_t key, uint64_t at) {
+    HostNote& n = notes[to - 1][keyNote[from - 1][to - 1][key]];
+    if(n.keys && --n.keys)
+        return;
+    n.down = false;
+    n.upAt = at;
+}
+
+void hostKeyDown(uint8_t channel, uint8_t key, uint64_t at) {
+    keyDown[channel - 1][key] = true;
+    hold(channel, channel, key, at);
+    for(uint8_t c = 0; c < COUPLERS; c++) {
+        if(engaged[c] && couplers[c].from == channel)
+            hold(channel, couplers[c].to, key, at);
+    }
+}
+
+void hostKeyUp(uint8_t channel, uint8_t key, uint64_t at) {
+    keyDown[channel - 1][key] = false;
+    release(channel, channel, key, at);
+    for(uint8_t c = 0; c < COUPLERS; c++) {
+        if(engaged[c] && couplers[c].from == channel)
+            release(channel, couplers[c].to, key, at);
+    }
+}
+
+//The keys held on the coupler's source join or leave its destination at once
+void hostCoupler(uint8_t coupler) {
+    engaged[coupler] = !engaged[coupler];
+    uint8_t from = couplers[coupler].from, to = couplers[coupler].to;
+    for(uint8_t key = 0; key < 128; key++) {
+        if(!keyDown[from - 1][key])
+            continue;
+        if(engaged[coupler])
+            hold(from, to, key, simClock);
+        else
+            release(from, to, key, simClock);
+    }
+}
+
+void hostTranspose(int8_t step) {
+    int8_t t = transposition + step;
+    if(t >= -TRANSPOSE_RANGE && t <= TRANSPOSE_RANGE)
+        transposition = t;
+}
+
+void hostSettled() {
+    for(uint8_t c = 0; c < 16; c++) {
+        if(!(checked & (1 << c)))
+            continue;
+        for(uint8_t note = 0; note < 128; note++) {
+            HostNote& n = notes[c][note];
+            if(n.pending) {
+                missed++;
+                fail("key never sounded", c + 1, note);
+            }
+            if(n.sounding) {
+                stuck++;
+                fail("stuck note", c + 1, note);
+            }
+            n.pending = n.sounding = false;
+        }
+    }
+}
+
+static bool check(const char* what, uint32_t count) {
+    printf("  %-28s %10u%s\n", what, count, count ? "  FAIL" : "");
+    return count == 0;
+}
+
+static void latency(const char* what, const Latency& l) {
+    if(l.count)
+        printf("  %-28s %10.1f us mean, p50 %llu, p99 %llu, max %llu us\n", what,
+               (double)l.total / l.count, (unsigned long long)l.percentile(50),
+               (unsigned long long)l.percentile(99), (unsigned long long)l.max);
+}
+
+void hostBenchCase(uint8_t c) {
+    benchCase = c;
+}
+
+void hostBenchLatency(uint8_t c, SimLatency& out) {
+    const Latency& l = benchLatency[c];
+    out.count = l.count;
+    out.p50 = l.percentile(50);
+    out.p99 = l.percentile(99);
+    out.max = l.max;
+}
+
+bool hostReport() {
+    printf("Host\n");
+    printf("  %-28s %10u\n", "USB transfers", transfers);
+    printf("  %-28s %10u (%.2f per transfer)\n", "packets", packets,
+           transfers ? (double)packets / transfers : 0.0);
+    printf("  %-28s %10u on, %u off\n", "notes", noteOns, noteOffs);
+    printf("  %-28s %10u\n", "control changes", controls);
+    printf("  %-28s %10u, %u notes resent\n", "all notes off", allNotesOff, resyncNotes);
+    printf("  %-28s %10u\n", "SysEx bytes", sysExBytes);
+    latency("key down to note on", pressLatency);
+    latency("key up to note off", releaseLatency);
+    if(simConfig.bench) {
+        printf("Benchmark, key down to note on\n");
+        for(uint8_t c = 0; c < SIM_BENCH_CASES; c++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s", patternNames[c % SIM_PATTERNS],
+                     c < SIM_PATTERNS ? "" : ", loaded");
+            latency(name, benchLatency[c]);
+        }
+    }
+
+    if(usartStarted)
+        printf("  %-28s %10u bytes, %u messages\n", "DIN MIDI in", dinBytes, dinMessages);
+
+    if(dumpDone)
+        printf("  %-28s %10u bytes, %.1f s, %u records, %u events\n", "flight recorder dump",
+               dumpLength, dumpSeconds, dumpRecords, dumpEvents);
+    if(ringReported)
+        printf("  %-28s %10u deep at most, %u overflows\n", "key event ring", ringHigh, ringLost);
+#if FIRMWARE_COMBINATIONS
+    printf("  %-28s %10u from the console, %u recalls checked\n", "stop changes", stopChanges, recalls);
+#endif
+
+    printf("Checks\n");
+    bool ok = true;
+    ok &= check("ghost notes", ghosts);
+    ok &= check("retriggered notes", retriggers);
+    ok &= check("note on twice", doubleOns);
+    ok &= check("note off without note on", strayOffs);
+    ok &= check("note off with the key down", cutOffs);
+    ok &= check("keys that never sounded", missed);
+    ok &= check("stuck notes", stuck);
+#if FIRMWARE_COMBINATIONS
+    ok &= check("stop changes that did nothing", idleStops);
+    ok &= check("recalls not as set", recallMismatches);
+#endif
+    if(usartStarted) {
+        ok &= check("DIN messages not as on USB", dinMismatches);
+        ok &= check("DIN messages never sent", logCount - dinMessages);
+    }
+    ok &= check("flight dump missing", !dumpDone);
+    ok &= check("key ring report missing", !ringReported);
+    ok &= check("flight dump broken", dumpBroken);
+    ok &= check("flight events not as heard", dumpMismatches);
+    ok &= check("flight replay keys left down", dumpRowsLeft);
+    return ok;
+}
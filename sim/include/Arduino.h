@@ -0,0 +1,128 @@
+/*
+Arduino core for the simulation
+ ==============================================
+Just enough of the Arduino Due core for the sketch to build and run natively. Pins,
+time and interrupts are all played by the simulated console (sim.h): digitalWrite()
+and digitalRead() go to the virtual PIO ports, micros() and millis() read the
+simulated clock, and attachInterrupt() hooks a sense line edge.
+*/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define F_CPU           84000000L
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH            1
+#define LOW             0
+
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+
+#define CHANGE          2
+#define FALLING         3
+#define RISING          4
+
+#define A0              54
+#define A1              55
+#define A2              56
+#define A3              57
+#define A4              58
+#define A5              59
+#define A6              60
+#define A7              61
+#define A8              62
+#define A9              63
+#define A10             64
+#define A11             65
+
+//Binary constants for 5x8 LCD characters (the core's binary.h has the rest)
+#define B00000 0
+#define B00001 1
+#define B00010 2
+#define B00011 3
+#define B00100 4
+#define B00101 5
+#define B00110 6
+#define B00111 7
+#define B01000 8
+#define B01001 9
+#define B01010 10
+#define B01011 11
+#define B01100 12
+#define B01101 13
+#define B01110 14
+#define B01111 15
+#define B10000 16
+#define B10001 17
+#define B10010 18
+#define B10011 19
+#define B10100 20
+#define B10101 21
+#define B10110 22
+#define B10111 23
+#define B11000 24
+#define B11001 25
+#define B11010 26
+#define B11011 27
+#define B11100 28
+#define B11101 29
+#define B11110 30
+#define B11111 31
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+int analogRead(uint32_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh);
+
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode);
+void detachInterrupt(uint32_t pin);
+
+//Interrupt controller: only the lines the sketch touches
+enum IRQn_Type {
+    PIOA_IRQn = 11,
+    PIOB_IRQn = 12,
+    PIOC_IRQn = 13,
+    PIOD_IRQn = 14,
+    TC3_IRQn = 31
+};
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void __disable_irq();
+void __enable_irq();
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    size_t write(const uint8_t* data, size_t length);
+    size_t print(const char* text);
+    size_t print(char c);
+    size_t print(int value);
+};
+
+//Serial1 only takes its baud rate; dinout.cpp drives the USART itself
+class USARTClass {
+public:
+    void begin(unsigned long baud);
+};
+
+extern USARTClass Serial1;
+
+#endif
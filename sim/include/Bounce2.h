@@ -0,0 +1,82 @@
+/*
+Bounce2 for the simulation
+ ==============================================
+The same stable-interval debounce as the library, reading the simulated pins.
+*/
+
+#ifndef BOUNCE2_SIM_H
+#define BOUNCE2_SIM_H
+
+#include "Arduino.h"
+
+class Bounce {
+public:
+    Bounce() : pin(0), intervalMs(10), state(HIGH), changed(false), since(0) {}
+
+    void attach(int p) {
+        pin = p;
+        state = digitalRead(pin);
+        since = millis();
+    }
+
+    void interval(uint16_t ms) {
+        intervalMs = ms;
+    }
+
+    //Take a new reading once the old one has been stable for the interval
+    bool update() {
+        changed = false;
+        int now = digitalRead(pin);
+        if(now != state && millis() - since >= intervalMs) {
+            state = now;
+            since = millis();
+            changed = true;
+        }
+        else if(now == state)
+            since = millis();
+        return changed;
+    }
+
+    bool read() const {
+        return state;
+    }
+
+    bool fell() const {
+        return changed && state == LOW;
+    }
+
+    bool rose() const {
+        return changed && state == HIGH;
+    }
+
+protected:
+    uint8_t pin;
+    uint16_t intervalMs;
+    int state;
+    bool changed;
+    unsigned long since;
+};
+
+namespace Bounce2 {
+class Button : public Bounce {
+public:
+    Button() : pressedState(LOW) {}
+
+    void setPressedState(bool s) {
+        pressedState = s;
+    }
+
+    bool pressed() const {
+        return changed && state == pressedState;
+    }
+
+    bool released() const {
+        return changed && state != pressedState;
+    }
+
+private:
+    bool pressedState;
+};
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+DueTimer for the simulation
+ ==============================================
+Timer3 fires its callback from the simulated clock at the set frequency, as an
+interrupt: between any two reads of the clock in loop(), never inside another
+interrupt.
+*/
+
+#ifndef DUETIMER_SIM_H
+#define DUETIMER_SIM_H
+
+#include "Arduino.h"
+
+class DueTimer {
+public:
+    DueTimer& attachInterrupt(void (*isr)());
+    DueTimer& setFrequency(double hz);
+    DueTimer& start();
+    DueTimer& stop();
+
+    void (*callback)();
+    uint64_t period;            //cycles
+    uint64_t next;              //cycles of the next tick
+    bool running;
+    bool pending;
+};
+
+extern DueTimer Timer3;
+
+#endif
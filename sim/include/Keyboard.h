@@ -0,0 +1,32 @@
+/*
+USB keyboard for the simulation
+ ==============================================
+Keystrokes only go as far as a count (keyboardPresses in sim.h).
+*/
+
+#ifndef KEYBOARD_SIM_H
+#define KEYBOARD_SIM_H
+
+#include "Arduino.h"
+
+#define KEY_LEFT_CTRL   0x80
+#define KEY_LEFT_SHIFT  0x81
+#define KEY_LEFT_ALT    0x82
+#define KEY_LEFT_GUI    0x83
+#define KEY_RETURN      0xB0
+#define KEY_ESC         0xB1
+#define KEY_BACKSPACE   0xB2
+#define KEY_TAB         0xB3
+
+class Keyboard_ : public Print {
+public:
+    void begin() {}
+    size_t press(uint8_t key);
+    size_t release(uint8_t key);
+    void releaseAll();
+    size_t write(uint8_t c);
+};
+
+extern Keyboard_ Keyboard;
+
+#endif
@@ -0,0 +1,26 @@
+/*
+LiquidCrystal_I2C for the simulation
+ ==============================================
+The set-up calls the sketch makes before lcdout.h takes over. They act on the
+simulated HD44780 directly; after that everything reaches it through the I2C
+expander, as on the console.
+*/
+
+#ifndef LIQUIDCRYSTAL_I2C_SIM_H
+#define LIQUIDCRYSTAL_I2C_SIM_H
+
+#include "Arduino.h"
+
+class LiquidCrystal_I2C : public Print {
+public:
+    LiquidCrystal_I2C(uint8_t address, uint8_t cols, uint8_t rows) {}
+    void init();
+    void backlight() {}
+    void noCursor() {}
+    void createChar(uint8_t location, uint8_t* pattern);
+    void setCursor(uint8_t col, uint8_t row);
+    void command(uint8_t value);
+    size_t write(uint8_t c);
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*
+MIDIUSB for the simulation
+ ==============================================
+Packets written here go to the simulated host (sim.h), which plays GrandOrgue: it
+keeps track of the notes it has been sent and checks them against the keys the
+virtual organist is holding.
+*/
+
+#ifndef MIDIUSB_H
+#define MIDIUSB_H
+
+#include "Arduino.h"
+
+typedef struct {
+    uint8_t header;
+    uint8_t byte1;
+    uint8_t byte2;
+    uint8_t byte3;
+} midiEventPacket_t;
+
+class MIDI_ {
+public:
+    size_t write(const uint8_t* data, size_t length);
+    void flush() {}
+};
+
+extern MIDI_ MidiUSB;
+
+#endif
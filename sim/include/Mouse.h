@@ -0,0 +1,11 @@
+#ifndef MOUSE_SIM_H
+#define MOUSE_SIM_H
+
+class Mouse_ {
+public:
+    void begin() {}
+};
+
+extern Mouse_ Mouse;
+
+#endif
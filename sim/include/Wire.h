@@ -0,0 +1,22 @@
+/*
+Wire for the simulation
+ ==============================================
+Only the set-up calls. The LCD traffic itself goes through the TWI registers (twi.h),
+which the simulation plays.
+*/
+
+#ifndef WIRE_SIM_H
+#define WIRE_SIM_H
+
+#include "Arduino.h"
+
+class TwoWire {
+public:
+    void begin();
+    void setTimeout(int ms) {}
+    void setClock(uint32_t hz) {}
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,168 @@
+/*
+Console simulation
+ ==============================================
+Runs the sketch natively against a model of the whole console: the Allen MDC 20 key
+matrix and pistons, the expression pedals, the LCD on its I2C backpack, the flash
+and a USB host playing GrandOrgue. A scripted organist plays it, and the host
+checks every note that comes out against the keys that were actually down.
+
+Time is simulated. The clock (simClock, in 84 MHz core cycles) only moves when the
+sketch reads it (cyclesNow(), micros(), millis()), touches a pin, or waits, and each
+of those costs callNs. When loop() has nothing left to do, the run jumps straight to
+the next thing that can happen: a scan tick, a scheduler release, a contact moving,
+a host message. Hours of playing take seconds.
+
+Interrupts are played the way the NVIC would at one priority level: the scan timer
+and the sense line edges run between two clock reads of loop(), never inside each
+other, and one that comes due while another runs waits for it to finish.
+
+  - hal.cpp: clock, pins, interrupts and the library stand-ins
+  - console.cpp: PIO ports, matrix wiring, contact bounce and RC settle
+  - peripherals.cpp: TWI + PCF8574 + HD44780, ADC with PDC, flash controller, USART
+  - host.cpp: USB-MIDI both ways, DIN MIDI in, and the checks on what the host hears
+  - player.cpp: the scripted organist
+  - run.cpp: simRun(), main(), options and the report
+
+The sketch's build options (DIN_MIDI_OUT, ...) are modelled as the build sets them: the
+console, host and report follow the same -D flags as main.cpp.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_CYCLES_PER_US   84ULL
+#define SIM_NEVER           UINT64_MAX
+
+struct SimConfig {
+    uint32_t seconds;           //simulated playing time
+    uint32_t seed;
+    uint32_t settleUs;          //time for a sense line to follow its drive row
+    uint32_t bounceUs;          //how long a contact chatters after it moves
+    uint32_t callNs;            //cost of each clock read or pin access
+    bool verbose;
+    bool bench;                 //play the latency benchmark, seconds per case
+};
+
+extern SimConfig simConfig;
+
+//Set simConfig to the defaults the command line starts from
+void simDefaults();
+
+//Play simConfig.seconds and print the report. Returns true if every check passed.
+bool simRun();
+extern uint64_t simClock;               //core cycles since power on
+
+inline uint64_t simMicros() {
+    return simClock / SIM_CYCLES_PER_US;
+}
+
+//Move the clock to at least until, running everything that falls due on the way
+void simAdvance(uint64_t until);
+
+//From the run loop when loop() is idle: as simAdvance(), but return early once an
+//interrupt has run or the host has sent something, so loop() can deal with it
+void simSkip(uint64_t until);
+
+//Charge one HAL call's worth of time
+void simCall();
+
+//Raise a pin's edge interrupt (console.cpp, on a falling sense line)
+void simPinEdge(uint8_t pin);
+
+//The sketch, from src/main.cpp
+void setup();
+void loop();
+
+//Console: PIO ports, contacts and the sense lines they pull
+#define SIM_GROUND          0xFF        //contact to ground instead of a drive row
+
+void consoleBegin();
+void consoleStep(uint64_t now);
+uint64_t consoleNext();
+void consoleContact(uint8_t drive, uint8_t sense, bool closed);
+void consoleBounce(uint32_t us);        //contacts that move from now on chatter this long
+bool consolePinHigh(uint8_t pin);       //level on the pin as the PIO sees it
+bool consoleOutputHigh(uint8_t pin);    //output latch, e.g. a lamp
+bool consolePeripheral(uint8_t pin);    //the pin is a peripheral's, not the PIO's
+void consoleAttach(uint8_t pin, void (*callback)());
+void consoleDetach(uint8_t pin);
+extern uint32_t consoleEdges;           //falling edges that raised an interrupt
+
+//Wiring of the divisions, as on the Allen schematic
+enum SimDivision { SIM_SWELL, SIM_GREAT, SIM_PEDAL, SIM_DIVISIONS };
+
+struct SimKeyWiring {
+    uint8_t drive;
+    uint8_t sense;
+};
+
+uint8_t consoleChannel(uint8_t division);
+uint8_t consoleKeys(uint8_t division);
+bool consoleKey(uint8_t division, uint8_t note, SimKeyWiring& w);
+
+//Pistons: n = 0 - 5 and 56 - 58 to ground, 6 - 17 on the piston matrix
+bool consolePiston(uint8_t n, SimKeyWiring& w);
+
+//Peripherals
+void peripheralsBegin();
+void peripheralsStep(uint64_t now);
+uint64_t peripheralsNext();
+void lcdInit();
+void lcdCommand(uint8_t value);
+void lcdData(uint8_t value);
+void lcdText(char* out, uint8_t row);   //20 characters and a terminator
+void adcSet(uint8_t channel, uint16_t value);
+void usartBegin(uint32_t baud);
+extern uint32_t lcdBytes;               //bytes the PCF8574 latched
+extern uint32_t flashWrites;            //page programs
+extern bool usartStarted;               //Serial1.begin() has run, so DIN MIDI is expected
+
+//USB host
+void hostBegin();
+void hostStep(uint64_t now);
+uint64_t hostNext();
+bool hostPending();                     //messages waiting for the sketch to read
+void hostReceive(const uint8_t* data, uint32_t length);
+void hostSend(const uint8_t* packet);   //one 4-byte USB-MIDI packet to the sketch
+void hostSysEx(const uint8_t* data, uint8_t length);
+void hostDinByte(uint8_t b);            //one byte off the DIN MIDI OUT line
+void hostKeyDown(uint8_t channel, uint8_t note, uint64_t at);
+void hostKeyUp(uint8_t channel, uint8_t note, uint64_t at);
+void hostTranspose(int8_t step);        //a transpose button went down
+void hostCoupler(uint8_t coupler);      //a coupler piston went down
+void hostStop(uint8_t stop);            //the organist flips a stop in GrandOrgue
+void hostComboSet(uint8_t piston);      //set + general piston: it holds the registration now
+void hostComboCheck(uint8_t piston);    //after a recall (COMBO_PISTONS: general cancel)
+void hostSettled();                     //every key is up and has had time to go quiet
+bool hostReport();                      //print the checks, false if any failed
+
+//Latency benchmark: the player plays each pattern for simConfig.seconds, then each
+//again with the LCD and MIDI in kept busy, and the host keeps the key down to note
+//on latency of every case apart
+enum SimPattern { SIM_NOTES, SIM_CHORDS, SIM_GLISSANDI, SIM_BOUNCING, SIM_PATTERNS };
+#define SIM_BENCH_CASES     (2 * SIM_PATTERNS)  //case n + SIM_PATTERNS = pattern n, loaded
+
+struct SimLatency {             //us
+    uint32_t count;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+};
+
+void hostBenchCase(uint8_t benchCase);  //notes from now on count for this case
+void hostBenchLatency(uint8_t benchCase, SimLatency& out);
+
+//Player
+void playerBegin();
+void playerStep(uint64_t now);
+uint64_t playerNext();
+bool playerDone();
+void playerReport();
+
+//Library stand-ins that keep counts for the report
+extern uint32_t keyboardPresses;
+extern uint32_t timerTicks;
+
+#endif
@@ -0,0 +1,318 @@
+#include "sim.h"
+#include "twi.h"
+#include "adc.h"
+#include "flashlog.h"
+#include "dinout.h"
+#include <string.h>
+
+uint32_t lcdBytes;
+uint32_t flashWrites;
+
+//LCD: HD44780 on a PCF8574 ===============================================
+//Backpack wiring as in lcdout.cpp: P0 = RS, P2 = E, P4 - P7 = D4 - D7. A nibble is
+//taken on E falling.
+#define EXP_RS          0x01
+#define EXP_EN          0x04
+
+static char ddram[128];
+static uint8_t address;                 //DDRAM address counter
+static bool toCgram;                    //data goes to the character generator
+static bool eightBit;                   //interface width, per the last function set
+static bool lowNext;                    //4-bit: the next nibble is the low half
+static uint8_t highNibble;
+static uint8_t expander;                //PCF8574 output latch
+
+void lcdInit() {
+    memset(ddram, ' ', sizeof(ddram));
+    address = 0;
+    toCgram = false;
+    eightBit = false;
+    lowNext = false;
+}
+
+void lcdCommand(uint8_t value) {
+    if(value & 0x80) {
+        address = value & 0x7F;
+        toCgram = false;
+    }
+    else if(value & 0x40)
+        toCgram = true;
+    else if(value & 0x20) {
+        eightBit = value & 0x10;
+        lowNext = false;
+    }
+    else if(value == 0x01) {
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+    }
+    else if((value & 0xFE) == 0x02)
+        address = 0;
+}
+
+void lcdData(uint8_t value) {
+    if(toCgram)
+        return;
+    ddram[address & 0x7F] = value;
+    address++;
+    if(address == 0x28)
+        address = 0x40;
+    else if(address == 0x68)
+        address = 0;
+}
+
+static void lcdNibble(uint8_t nibble, bool data) {
+    uint8_t value;
+    if(eightBit)
+        value = nibble;
+    else if(!lowNext) {
+        highNibble = nibble;
+        lowNext = true;
+        return;
+    }
+    else {
+        value = highNibble | nibble >> 4;
+        lowNext = false;
+    }
+    if(data)
+        lcdData(value);
+    else
+        lcdCommand(value);
+}
+
+static void expanderWrite(uint8_t value) {
+    if((expander & EXP_EN) && !(value & EXP_EN))
+        lcdNibble(value & 0xF0, value & EXP_RS);
+    expander = value;
+    lcdBytes++;
+}
+
+void lcdText(char* out, uint8_t row) {
+    static const uint8_t rowStart[4] = {0x00, 0x40, 0x14, 0x54};
+    for(uint8_t n = 0; n < 20; n++) {
+        char c = ddram[rowStart[row & 3] + n];
+        out[n] = c >= ' ' && c < 0x7F ? c : '#';
+    }
+    out[20] = 0;
+}
+
+//TWI1 with its PDC channel ==============================================
+//One byte takes nine SCL periods at 100 kHz. The address byte goes first whenever the
+//controller starts from idle. Nothing NACKs and the bus never sticks.
+#define TWI_HOLDING_EMPTY   0xFFFF
+#define TWI_BYTE_CYCLES     (90 * SIM_CYCLES_PER_US)
+
+static TwiRegs twi;
+static uint64_t shiftEnd;               //when the byte being sent is out, 0 = none
+static uint8_t shifting;
+static bool shiftingData;               //false for the address byte
+static uint64_t freeAt;                 //when the shifter last became free
+static bool waiting;                    //shifter free and nothing to send at the last step
+
+static void twiStep(uint64_t now) {
+    for(;;) {
+        if(shiftEnd && now >= shiftEnd) {
+            if(shiftingData)
+                expanderWrite(shifting);
+            freeAt = shiftEnd;
+            shiftEnd = 0;
+        }
+        if(shiftEnd)
+            break;
+
+        bool pdc = twi.TWI_PTCR == TWI_PTCR_TXTEN && twi.TWI_TCR;
+        bool holding = twi.TWI_THR != TWI_HOLDING_EMPTY;
+        if(!pdc && !holding) {
+            waiting = true;
+            break;
+        }
+
+        uint64_t start = waiting ? now : freeAt;
+        if(waiting) {
+            //START and the address byte
+            waiting = false;
+            shiftingData = false;
+            shiftEnd = start + TWI_BYTE_CYCLES;
+            continue;
+        }
+        if(pdc) {
+            shifting = *(const uint8_t*)twi.TWI_TPR;
+            twi.TWI_TPR = twi.TWI_TPR + 1;
+            twi.TWI_TCR = twi.TWI_TCR - 1;
+        }
+        else {
+            shifting = twi.TWI_THR;
+            twi.TWI_THR = TWI_HOLDING_EMPTY;
+        }
+        shiftingData = true;
+        shiftEnd = start + TWI_BYTE_CYCLES;
+    }
+
+    uint32_t sr = 0;
+    if(twi.TWI_THR == TWI_HOLDING_EMPTY)
+        sr |= TWI_SR_TXRDY;
+    if(twi.TWI_TCR == 0)
+        sr |= TWI_SR_ENDTX;
+    if(!shiftEnd && twi.TWI_THR == TWI_HOLDING_EMPTY && !(twi.TWI_PTCR == TWI_PTCR_TXTEN && twi.TWI_TCR))
+        sr |= TWI_SR_TXCOMP;
+    twi.TWI_SR = sr;
+}
+
+//ADC with its PDC channel ===============================================
+//Free running over the enabled channels in turn, one conversion every ADC_SAMPLE_US.
+//The buffers are filled when the sketch next looks, not sample by sample.
+#define ADC_SAMPLE_US       25
+
+static AdcRegs adc;
+static uint16_t level[ADC_CHANNELS];
+static uint64_t lastSample;
+static uint8_t nextChannel;
+static uint32_t noise = 1;
+
+void adcSet(uint8_t channel, uint16_t value) {
+    level[channel & (ADC_CHANNELS - 1)] = value > 4095 ? 4095 : value;
+}
+
+static void adcStep(uint64_t now) {
+    uint64_t period = ADC_SAMPLE_US * SIM_CYCLES_PER_US;
+    if(adc.ADC_PTCR != ADC_PTCR_RXTEN || !(adc.ADC_MR & ADC_MR_FREERUN_ON) || !adc.ADC_CHER) {
+        lastSample = now;
+        return;
+    }
+
+    uint64_t due = (now - lastSample) / period;
+    lastSample += due * period;
+    if(due > 2 * ADC_BLOCK)
+        due = 2 * ADC_BLOCK;
+
+    while(due-- && adc.ADC_RCR) {
+        while(!(adc.ADC_CHER & (1u << nextChannel)))
+            nextChannel = (nextChannel + 1) % ADC_CHANNELS;
+        uint8_t c = nextChannel;
+        nextChannel = (nextChannel + 1) % ADC_CHANNELS;
+
+        //A couple of LSBs of noise
+        noise = noise * 1103515245 + 12345;
+        int32_t v = level[c] + (int32_t)(noise >> 16) % 5 - 2;
+        v = v < 0 ? 0 : v > 4095 ? 4095 : v;
+
+        uint16_t* p = (uint16_t*)adc.ADC_RPR;
+        *p = c << 12 | v;
+        adc.ADC_RPR = adc.ADC_RPR + 2;
+        adc.ADC_RCR = adc.ADC_RCR - 1;
+        if(adc.ADC_RCR == 0 && adc.ADC_RNCR) {
+            adc.ADC_RPR = adc.ADC_RNPR;
+            adc.ADC_RCR = adc.ADC_RNCR;
+            adc.ADC_RNCR = 0;
+        }
+    }
+}
+
+//Flash controller =======================================================
+//The log's pages are plain memory, so the page latch writes land straight in them.
+//A command keeps FRDY low for as long as the part takes.
+#define FCMD_WP             0x01
+#define FCMD_EWP            0x03
+
+static EfcRegs efc;
+static uint32_t flash[FLASH_LOG_PAGES * FLASH_PAGE_WORDS];
+static uint64_t readyAt;
+
+static void efcStep(uint64_t now) {
+    if(efc.EEFC_FCR) {
+        uint8_t cmd = efc.EEFC_FCR & 0xFF;
+        efc.EEFC_FCR = 0;
+        uint32_t us = cmd == FCMD_EWP ? 4000 : cmd == FCMD_WP ? 1500 : 0;
+        if(us) {
+            flashWrites++;
+            efc.EEFC_FSR = 0;
+            readyAt = now + us * SIM_CYCLES_PER_US;
+        }
+    }
+    if(readyAt && now >= readyAt) {
+        efc.EEFC_FSR = EEFC_FSR_FRDY;
+        readyAt = 0;
+    }
+}
+
+//USART0 with its PDC channel ============================================
+//Ten bit times a byte at the rate Serial1.begin() set; each byte reaches the host's DIN
+//input as its stop bit ends, as long as TX1 still belongs to the USART.
+bool usartStarted;
+
+static UsartRegs usart;
+static uint64_t usartByteCycles;
+static uint64_t usartEnd;               //when the byte being sent is out, 0 = none
+static uint8_t usartShifting;
+
+void usartBegin(uint32_t baud) {
+    usartByteCycles = 10 * SIM_CYCLES_PER_US * 1000000 / baud;
+    usartStarted = true;
+}
+
+static void usartStep(uint64_t now) {
+    for(;;) {
+        uint64_t start = now;
+        if(usartEnd) {
+            if(now < usartEnd)
+                break;
+            if(consolePeripheral(18))
+                hostDinByte(usartShifting);
+            start = usartEnd;
+            usartEnd = 0;
+        }
+        if(usart.US_PTCR != US_PTCR_TXTEN || !usart.US_TCR)
+            break;
+
+        usartShifting = *(const uint8_t*)usart.US_TPR;
+        usart.US_TPR = usart.US_TPR + 1;
+        usart.US_TCR = usart.US_TCR - 1;
+        if(usart.US_TCR == 0 && usart.US_TNCR) {
+            usart.US_TPR = usart.US_TNPR;
+            usart.US_TCR = usart.US_TNCR;
+            usart.US_TNCR = 0;
+        }
+        usartEnd = start + usartByteCycles;
+    }
+}
+
+//========================================================================
+void peripheralsBegin() {
+    lcdInit();
+
+    twi = TwiRegs();
+    twi.TWI_THR = TWI_HOLDING_EMPTY;
+    twi.TWI_SR = TWI_SR_TXRDY | TWI_SR_TXCOMP;
+    twiRegs = &twi;
+    waiting = true;
+
+    adc = AdcRegs();
+    adcRegs = &adc;
+
+    efc = EfcRegs();
+    efc.EEFC_FSR = EEFC_FSR_FRDY;
+    memset(flash, 0xFF, sizeof(flash));
+    flashRegs = &efc;
+    flashBase = flash;
+    flashFirstPage = 1024 - FLASH_LOG_PAGES;        //the top of bank 1
+
+    usart = UsartRegs();
+    dinUsart = &usart;
+    usartEnd = 0;
+    usartStarted = false;
+}
+
+void peripheralsStep(uint64_t now) {
+    twiStep(now);
+    adcStep(now);
+    efcStep(now);
+    usartStep(now);
+}
+
+uint64_t peripheralsNext() {
+    uint64_t next = shiftEnd ? shiftEnd : SIM_NEVER;
+    if(readyAt && readyAt < next)
+        next = readyAt;
+    if(usartEnd && usartEnd < next)
+        next = usartEnd;
+    return next;
+}
@@ -0,0 +1,528 @@
+#include "sim.h"
+#include "adc.h"
+#include "profile.h"
+#include "combination.h"
+#include <stdio.h>
+
+//The scripted organist: chords, legato lines and trills on all three divisions,
+//pistons, the coupler pistons and transpose buttons (often mid-chord), the swell
+//pedal, the odd resync from the host and long rests that let the matrix park. It sets
+//registrations it pulls in GrandOrgue on the general pistons, recalls them and cancels
+//them, and the host checks what each recall sends. At the end it asks for the key event ring's counters and the flight recorder dump.
+//Everything is drawn from simConfig.seed, so a run can be repeated.
+//
+//With simConfig.bench it plays the latency benchmark instead (sim.h): single notes,
+//10-note chords, glissandi and notes and chords on bouncing contacts, each for
+//simConfig.seconds, then all four again with the host sending a piston number to show
+//every LOAD_US and the swell pedal moving. Only the bouncing case's contacts chatter.
+#define PLAYER_ACTIONS      512
+#define PISTONS             SIM_DIVISIONS       //key table index for the pistons
+#define PISTON_CHANNEL      5
+
+#define KEY_GAP_US          60000       //shortest time between a key's release and its next press
+#define PISTON_GAP_US       100000
+#define REST_MS             12000       //long enough for the matrix to park (IDLE_AFTER_MS)
+#define SETTLE_MS           500         //after the last release, before the flight dump
+#define DUMP_MS             3000        //for the flight recorder dump to come through
+#define TRANSPOSE_UP_PIN    6
+#define TRANSPOSE_DOWN_PIN  7
+#define COUPLER_PISTON      56          //pistons 56 - 58 work the couplers
+#define BUTTON_CLEAR_US     50000       //no key moves this close to a coupler or transpose press
+#define LOAD_US             1000
+#define GENERAL_PISTON      6           //general pistons 1 - 10, then GC and set (main.cpp)
+#define CANCEL_PISTON       16
+#define SET_PISTON          17
+#define RECALL_CHECK_MS     300         //after a recall, for its stops to reach the host
+
+enum ActionKind { KEY_DOWN, KEY_UP, PHRASE, RESYNC, SWELL, BUTTON, BUTTON_UP, BENCH_CASE, LOAD,
+                  STOP, COMBO_SET, COMBO_CHECK, DUMP, FINISH };
+
+struct Action {
+    uint64_t at;
+    uint8_t kind;
+    uint8_t keys;               //division, or PISTONS
+    uint8_t note;
+};
+
+//Pending actions, a binary heap on at
+static Action heap[PLAYER_ACTIONS];
+static uint16_t heapSize;
+
+static uint64_t freeAt[SIM_DIVISIONS + 1][128];     //earliest the key may go down again
+static uint64_t lastUp;                             //latest release scheduled so far
+static uint64_t pistonUpAt;                         //latest piston release scheduled so far
+static uint64_t keyUpAt;                            //last division key to go up
+static uint64_t buttonFreeAt;                       //earliest the next button may go down
+static uint64_t endAt;                              //of the playing, or of the benchmark case
+static uint8_t benchCase;
+static uint32_t rng;
+static bool done;
+
+//For the report
+static uint32_t presses[SIM_DIVISIONS + 1];
+static uint32_t chords, trills, glissandi, rests, resyncs, swellMoves, transposes, couplings, dropped;
+#if FIRMWARE_COMBINATIONS
+static uint32_t comboSets, comboRecalls, comboCancels;
+#endif
+static int8_t transposition;            //where the player means to be, to steer back to 0
+
+static uint32_t roll(uint32_t range) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return range ? rng % range : 0;
+}
+
+static uint32_t between(uint32_t low, uint32_t high) {
+    return low + roll(high - low + 1);
+}
+
+static uint64_t us(uint64_t t) {
+    return t * SIM_CYCLES_PER_US;
+}
+
+static void push(uint64_t at, uint8_t kind, uint8_t keys = 0, uint8_t note = 0) {
+    if(heapSize == PLAYER_ACTIONS) {
+        dropped++;
+        return;
+    }
+    uint16_t n = heapSize++;
+    while(n && heap[(n - 1) / 2].at > at) {
+        heap[n] = heap[(n - 1) / 2];
+        n = (n - 1) / 2;
+    }
+    heap[n] = {at, kind, keys, note};
+}
+
+static Action pop() {
+    Action top = heap[0];
+    Action last = heap[--heapSize];
+    uint16_t n = 0;
+    for(;;) {
+        uint16_t c = 2 * n + 1;
+        if(c >= heapSize)
+            break;
+        if(c + 1 < heapSize && heap[c + 1].at < heap[c].at)
+            c++;
+        if(last.at <= heap[c].at)
+            break;
+        heap[n] = heap[c];
+        n = c;
+    }
+    heap[n] = last;
+    return top;
+}
+
+//Press a key from down until up, if it's free by then. Room is left in the heap for
+//the release so a press never goes without one.
+static bool press(uint8_t keys, uint8_t note, uint64_t down, uint64_t up) {
+    if(down < freeAt[keys][note] || heapSize + 2 > PLAYER_ACTIONS)
+        return false;
+    freeAt[keys][note] = up + us(keys == PISTONS ? PISTON_GAP_US : KEY_GAP_US);
+    push(down, KEY_DOWN, keys, note);
+    push(up, KEY_UP, keys, note);
+    if(up > lastUp)
+        lastUp = up;
+    if(keys == PISTONS && up > pistonUpAt)
+        pistonUpAt = up;
+    return true;
+}
+
+static uint8_t randomNote(uint8_t division, int root, uint8_t spread) {
+    int note = root + (int)roll(2 * spread + 1) - spread;
+    int top = 36 + consoleKeys(division) - 1;
+    return note < 36 ? 36 : note > top ? top : note;
+}
+
+static uint8_t randomDivision() {
+    uint32_t r = roll(100);
+    return r < 45 ? SIM_GREAT : r < 80 ? SIM_SWELL : SIM_PEDAL;
+}
+
+//Up to four notes around a root (one or two on the pedal), each a little apart
+static uint64_t chord(uint64_t now) {
+    uint8_t d = randomDivision();
+    uint8_t count = d == SIM_PEDAL ? between(1, 2) : between(1, 4);
+    int root = 36 + roll(consoleKeys(d));
+    uint64_t hold = us(between(40, 1500) * 1000);
+
+    for(uint8_t n = 0; n < count; n++) {
+        uint64_t down = now + us(roll(15000));
+        press(d, randomNote(d, root, d == SIM_PEDAL ? 5 : 12), down, down + hold);
+    }
+    chords++;
+    return now + hold * between(30, 110) / 100;         //overlap into the next for legato
+}
+
+//Two neighbouring keys in turn
+static uint64_t trill(uint64_t now) {
+    uint8_t d = roll(2) ? SIM_GREAT : SIM_SWELL;
+    uint8_t low = randomNote(d, 36 + roll(consoleKeys(d)), 0);
+    uint8_t high = low < 36 + consoleKeys(d) - 1 ? low + 1 : low - 1;
+    uint64_t step = us(between(70, 120) * 1000);
+    uint8_t turns = between(4, 12);
+
+    uint64_t t = now;
+    for(uint8_t n = 0; n < turns; n++, t += step)
+        press(d, n & 1 ? high : low, t, t + step - us(5000));
+    trills++;
+    return t;
+}
+
+static uint64_t piston(uint64_t now) {
+    static const uint8_t pistons[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+#if !FIRMWARE_COMBINATIONS
+                                      16, 17,
+#endif
+#if !FIRMWARE_COUPLERS
+                                      56, 57, 58,
+#endif
+    };
+    uint8_t n = pistons[roll(sizeof(pistons))];
+    press(PISTONS, n, now, now + us(between(80, 300) * 1000));
+    return now + us(between(50, 400) * 1000);
+}
+
+#if FIRMWARE_COMBINATIONS
+//A few stops flipped in GrandOrgue, then set on a general piston (set held), or a
+//general piston recalled, or general cancel. Every other piston is let go first, and
+//the host checks the registration once the recall's stops are through.
+static uint64_t registration(uint64_t now) {
+    uint64_t t = (pistonUpAt > now ? pistonUpAt : now) + us(PISTON_GAP_US);
+    uint8_t flips = between(0, 4);
+    for(uint8_t n = 0; n < flips; n++)
+        push(t + us(n * 10000), STOP, 0, roll(STOP_COUNT));
+    t += us(100000);
+
+    uint8_t general = roll(COMBO_PISTONS);
+    uint32_t r = roll(4);
+    if(r == 0) {
+        if(press(PISTONS, SET_PISTON, t, t + us(300000)) &&
+           press(PISTONS, GENERAL_PISTON + general, t + us(50000), t + us(200000))) {
+            push(t + us(50000), COMBO_SET, 0, general);
+            comboSets++;
+        }
+    }
+    else if(r < 3) {
+        if(press(PISTONS, GENERAL_PISTON + general, t, t + us(150000))) {
+            push(t + us(RECALL_CHECK_MS * 1000), COMBO_CHECK, 0, general);
+            comboRecalls++;
+        }
+    }
+    else if(press(PISTONS, CANCEL_PISTON, t, t + us(150000))) {
+        push(t + us(RECALL_CHECK_MS * 1000), COMBO_CHECK, 0, COMBO_PISTONS);
+        comboCancels++;
+    }
+    return t + us((RECALL_CHECK_MS + 100) * 1000);
+}
+#endif
+
+//One key at a time, anywhere. The benchmark's presses land anywhere in a scan period.
+static uint64_t note(uint64_t now) {
+    uint8_t d = randomDivision();
+    uint64_t down = now + us(roll(1000));
+    uint64_t hold = us(between(80, 600) * 1000);
+    press(d, 36 + roll(consoleKeys(d)), down, down + hold);
+    return down + hold + us(between(20, 300) * 1000);
+}
+
+//Ten keys of one manual together, within 3 ms
+static uint64_t bigChord(uint64_t now) {
+    uint8_t d = roll(2) ? SIM_GREAT : SIM_SWELL;
+    uint64_t hold = us(between(200, 1500) * 1000);
+    uint64_t taken = 0;
+    for(uint8_t n = 0; n < 10; ) {
+        uint8_t k = roll(consoleKeys(d));
+        if(taken & (1ULL << k))
+            continue;
+        taken |= 1ULL << k;
+        uint64_t down = now + us(roll(3000));
+        press(d, 36 + k, down, down + hold);
+        n++;
+    }
+    chords++;
+    return now + hold + us(between(100, 400) * 1000);
+}
+
+//Every key of a manual in turn, up or down, each let go just after the next goes down
+static uint64_t glissando(uint64_t now) {
+    uint8_t d = roll(2) ? SIM_GREAT : SIM_SWELL;
+    uint8_t keys = consoleKeys(d);
+    bool up = roll(2);
+    uint64_t step = us(between(8000, 25000));
+    uint64_t t = now;
+    for(uint8_t n = 0; n < keys; n++, t += step)
+        press(d, 36 + (up ? n : keys - 1 - n), t, t + step + us(roll(5000)));
+    glissandi++;
+    return t + us(between(100, 400) * 1000);
+}
+
+static uint64_t benchPhrase(uint64_t now) {
+    switch(benchCase % SIM_PATTERNS) {
+    case SIM_NOTES:
+        return note(now);
+    case SIM_CHORDS:
+        return bigChord(now);
+    case SIM_GLISSANDI:
+        return glissando(now);
+    default:
+        return roll(2) ? note(now) : bigChord(now);
+    }
+}
+
+static void benchStart(uint64_t now) {
+    hostBenchCase(benchCase);
+    consoleBounce(benchCase % SIM_PATTERNS == SIM_BOUNCING ? simConfig.bounceUs : 0);
+    endAt = now + us((uint64_t)simConfig.seconds * 1000000);
+    if(benchCase >= SIM_PATTERNS)
+        push(now, LOAD);
+    push(now, PHRASE);
+}
+
+//GrandOrgue sending a piston number for the LCD, and the swell pedal on the move
+static void load(uint64_t now) {
+    if(now >= endAt)
+        return;
+    uint8_t on[4] = {0x09, 0x90 | (PISTON_CHANNEL - 1), (uint8_t)roll(15), 127};
+    hostSend(on);
+    if(roll(20) == 0) {
+        adcSet(ADC_CHANNEL_A1, roll(4096));
+        swellMoves++;
+    }
+    push(now + us(LOAD_US), LOAD);
+}
+
+static void phrase(uint64_t now) {
+    if(now >= endAt) {
+        uint64_t settled = (lastUp > now ? lastUp : now) + us(SETTLE_MS * 1000);
+        if(simConfig.bench && ++benchCase < SIM_BENCH_CASES) {
+            push(settled, BENCH_CASE);
+            return;
+        }
+        push(settled, DUMP);
+        push(settled + us(DUMP_MS * 1000), FINISH);
+        return;
+    }
+    if(simConfig.bench) {
+        push(benchPhrase(now), PHRASE);
+        return;
+    }
+
+    uint32_t r = roll(100);
+    uint64_t next;
+    if(r < 2) {
+        //Everything up, then wait for the matrix to park
+        next = (lastUp > now ? lastUp : now) + us((REST_MS + roll(4000)) * 1000ULL);
+        rests++;
+    }
+    else if(r < 8)
+        next = piston(now);
+    else if(r < 10) {
+        push(now, RESYNC);
+        next = now + us(between(10, 200) * 1000);
+    }
+    else if(r < 12) {
+        push(now, SWELL);
+        next = now + us(roll(100) * 1000);
+    }
+#if FIRMWARE_TRANSPOSE
+    else if(r < 13) {
+        int8_t step = transposition ? (transposition > 0 ? -1 : 1) : (roll(2) ? 1 : -1);
+        if(roll(4) == 0)
+            step = -step;
+        push(now, BUTTON, 0, step > 0 ? TRANSPOSE_UP_PIN : TRANSPOSE_DOWN_PIN);
+        next = now + us(between(80, 200) * 1000);
+    }
+#endif
+#if FIRMWARE_COUPLERS
+    else if(r < 15) {
+        push(now, BUTTON, 0, COUPLER_PISTON + roll(3));
+        next = now + us(between(80, 200) * 1000);
+    }
+#endif
+#if FIRMWARE_COMBINATIONS
+    else if(r < 17)
+        next = registration(now);
+#endif
+    else if(r < 20)
+        next = trill(now);
+    else
+        next = chord(now);
+    push(next, PHRASE);
+}
+
+//Where a key press lands depends on the transposition and couplers when the sketch
+//takes it, and a coupler also takes in a key the sketch holds for its release window
+//after it opens, so key presses and releases are both kept clear of those buttons
+static bool buttonClear(uint64_t at) {
+    if(keyUpAt + us(BUTTON_CLEAR_US) > at)
+        return false;
+    for(uint16_t n = 0; n < heapSize; n++) {
+        const Action& a = heap[n];
+        if((a.kind == KEY_DOWN || a.kind == KEY_UP) && a.keys != PISTONS &&
+           (a.at > at ? a.at - at : at - a.at) < us(BUTTON_CLEAR_US))
+            return false;
+    }
+    return true;
+}
+
+//A transpose button or coupler piston, both wired to ground. Each press is let go
+//before the next, and long enough before it to be seen as a press of its own.
+static void button(uint64_t at, uint8_t pin) {
+    if(at < buttonFreeAt || !buttonClear(at) || heapSize + 1 > PLAYER_ACTIONS) {
+        push(at + us(20000), BUTTON, 0, pin);
+        return;
+    }
+    consoleContact(SIM_GROUND, pin, true);
+    if(pin >= COUPLER_PISTON) {
+        hostCoupler(pin - COUPLER_PISTON);
+        couplings++;
+    }
+    else {
+        int8_t step = pin == TRANSPOSE_UP_PIN ? 1 : -1;
+        hostTranspose(step);
+        transposition += step;
+        transposes++;
+    }
+    uint64_t up = at + us(between(80, 300) * 1000);
+    buttonFreeAt = up + us(PISTON_GAP_US);
+    push(up, BUTTON_UP, 0, pin);
+}
+
+static void key(uint8_t keys, uint8_t note, bool down) {
+    SimKeyWiring w;
+    uint8_t channel;
+    if(keys == PISTONS) {
+        if(!consolePiston(note, w))
+            return;
+        channel = PISTON_CHANNEL;
+    }
+    else {
+        if(!consoleKey(keys, note, w))
+            return;
+        channel = consoleChannel(keys);
+    }
+    consoleContact(w.drive, w.sense, down);
+    if(down)
+        presses[keys]++;
+    else if(keys != PISTONS)
+        keyUpAt = simClock;
+
+#if FIRMWARE_COMBINATIONS
+    //The general pistons, GC and set work the combination action rather than send notes
+    if(keys == PISTONS && note >= GENERAL_PISTON && note <= SET_PISTON)
+        return;
+#endif
+    if(down)
+        hostKeyDown(channel, note, simClock);
+    else
+        hostKeyUp(channel, note, simClock);
+}
+
+void playerBegin() {
+    rng = simConfig.seed ? simConfig.seed : 1;
+    heapSize = 0;
+    for(uint8_t k = 0; k <= SIM_DIVISIONS; k++) {
+        for(uint8_t n = 0; n < 128; n++)
+            freeAt[k][n] = 0;
+    }
+    lastUp = 0;
+    pistonUpAt = 0;
+    keyUpAt = 0;
+    buttonFreeAt = 0;
+    transposition = 0;
+    done = false;
+
+    //Start playing once setup() has had its start-up screens
+    uint64_t start = us(5000000);
+    benchCase = 0;
+    endAt = start + us((uint64_t)simConfig.seconds * 1000000);
+    push(start, simConfig.bench ? BENCH_CASE : PHRASE);
+}
+
+void playerStep(uint64_t now) {
+    while(heapSize && heap[0].at <= now) {
+        Action a = pop();
+        switch(a.kind) {
+        case KEY_DOWN:
+        case KEY_UP:
+            key(a.keys, a.note, a.kind == KEY_DOWN);
+            break;
+        case PHRASE:
+            phrase(a.at);
+            break;
+        case RESYNC: {
+            static const uint8_t resync[] = {0xF0, 0x7D, 0x4F, 0x05, 0xF7};
+            hostSysEx(resync, sizeof(resync));
+            resyncs++;
+            break;
+        }
+        case SWELL:
+            adcSet(ADC_CHANNEL_A1, roll(4096));
+            swellMoves++;
+            break;
+        case BUTTON:
+            button(a.at, a.note);
+            break;
+        case BUTTON_UP:
+            consoleContact(SIM_GROUND, a.note, false);
+            break;
+        case BENCH_CASE:
+            benchStart(a.at);
+            break;
+        case LOAD:
+            load(a.at);
+            break;
+        case STOP:
+            hostStop(a.note);
+            break;
+        case COMBO_SET:
+            hostComboSet(a.note);
+            break;
+        case COMBO_CHECK:
+            hostComboCheck(a.note);
+            break;
+        case DUMP: {
+            static const uint8_t dump[] = {0xF0, 0x7D, 0x4F, 0x07, 0x01, 0xF7};
+            static const uint8_t ring[] = {0xF0, 0x7D, 0x4F, 0x02, PROF_SEND_KEYS, 0xF7};
+            hostSysEx(ring, sizeof(ring));
+            hostSysEx(dump, sizeof(dump));
+            break;
+        }
+        case FINISH:
+            hostSettled();
+            done = true;
+            break;
+        }
+    }
+}
+
+uint64_t playerNext() {
+    return heapSize ? heap[0].at : SIM_NEVER;
+}
+
+bool playerDone() {
+    return done;
+}
+
+void playerReport() {
+    printf("Player\n");
+    printf("  %-28s %10u swell, %u great, %u pedal\n", "keys pressed",
+           presses[SIM_SWELL], presses[SIM_GREAT], presses[SIM_PEDAL]);
+    printf("  %-28s %10u\n", "pistons pressed", presses[PISTONS]);
+    printf("  %-28s %10u chords, %u trills, %u glissandi\n", "phrases", chords, trills, glissandi);
+    printf("  %-28s %10u\n", "rests", rests);
+    printf("  %-28s %10u\n", "resync requests", resyncs);
+    printf("  %-28s %10u\n", "swell pedal moves", swellMoves);
+#if FIRMWARE_TRANSPOSE
+    printf("  %-28s %10u, ending at %+d\n", "transpose presses", transposes, transposition);
+#endif
+#if FIRMWARE_COUPLERS
+    printf("  %-28s %10u\n", "coupler presses", couplings);
+#endif
+#if FIRMWARE_COMBINATIONS
+    printf("  %-28s %10u sets, %u recalls, %u cancels\n", "combinations", comboSets, comboRecalls, comboCancels);
+#endif
+    if(dropped)
+        printf("  %-28s %10u\n", "actions dropped", dropped);
+}
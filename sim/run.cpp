@@ -0,0 +1,150 @@
+#include "sim.h"
+#include "scheduler.h"
+#include "profile.h"
+#include "midiout.h"
+#include "heldnotes.h"
+#include "idle.h"
+#include "flightrec.h"
+#include "dinout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+void simDefaults() {
+    simConfig.seconds = 600;
+    simConfig.seed = 1;
+    simConfig.settleUs = 5;
+    simConfig.bounceUs = 3000;
+    simConfig.callNs = 50;
+    simConfig.verbose = false;
+    simConfig.bench = false;
+}
+
+//The test runner brings its own main()
+#ifndef PIO_UNIT_TESTING
+
+static const char usage[] =
+    "usage: program [options]\n"
+    "  --seconds n   simulated playing time (600)\n"
+    "  --seed n      for the player and the contact bounce (1)\n"
+    "  --settle us   drive row to sense line settle time (5)\n"
+    "  --bounce us   contact bounce after a key moves (3000)\n"
+    "  --call ns     cost of each clock read or pin access (50)\n"
+    "  --verbose     print each failed check as it happens\n"
+    "  --bench       play the latency benchmark, --seconds for each case\n";
+
+static bool options(int argc, char** argv) {
+    simDefaults();
+
+    for(int n = 1; n < argc; n++) {
+        const char* o = argv[n];
+        if(!strcmp(o, "--verbose")) {
+            simConfig.verbose = true;
+            continue;
+        }
+        if(!strcmp(o, "--bench")) {
+            simConfig.bench = true;
+            continue;
+        }
+        if(n + 1 == argc)
+            return false;
+        uint32_t v = strtoul(argv[++n], 0, 10);
+        if(!strcmp(o, "--seconds"))
+            simConfig.seconds = v;
+        else if(!strcmp(o, "--seed"))
+            simConfig.seed = v;
+        else if(!strcmp(o, "--settle"))
+            simConfig.settleUs = v;
+        else if(!strcmp(o, "--bounce"))
+            simConfig.bounceUs = v;
+        else if(!strcmp(o, "--call"))
+            simConfig.callNs = v;
+        else
+            return false;
+    }
+    return true;
+}
+#endif
+
+static void stage(const char* name, uint8_t s) {
+    ProfileStat p;
+    profileSnapshot(s, p);
+    if(p.count)
+        printf("  %-28s %10u runs %8.1f us mean %8.1f us max\n", name, p.count,
+               (double)p.total / p.count / SIM_CYCLES_PER_US, (double)p.max / SIM_CYCLES_PER_US);
+}
+
+//Percentiles from the log2 histogram, so each is an upper bound within a factor of two
+static void spread(const char* name, uint8_t s) {
+    ProfileStat p;
+    profileSnapshot(s, p);
+    if(p.count)
+        printf("  %-28s p50 <= %.1f us, p99 <= %.1f us, max %.1f us\n", name,
+               (double)profilePercentile(p, 50) / SIM_CYCLES_PER_US,
+               (double)profilePercentile(p, 99) / SIM_CYCLES_PER_US, (double)p.max / SIM_CYCLES_PER_US);
+}
+
+bool simRun() {
+    auto started = std::chrono::steady_clock::now();
+    consoleBegin();
+    peripheralsBegin();
+    hostBegin();
+    playerBegin();
+    setup();
+
+    //loop() as fast as it goes while it has work, otherwise straight on to the next
+    //scheduler release or whatever wakes it first
+    uint64_t loops = 0;
+    while(!playerDone()) {
+        loop();
+        loops++;
+        int32_t wait = (int32_t)(schedNextRelease() - (uint32_t)simClock);
+        if(wait > 0)
+            simSkip(simClock + wait);
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double simulated = simMicros() / 1e6;
+
+    printf("Simulated %.1f s in %.2f s wall (%.0fx real time), seed %u\n",
+           simulated, wall, simulated / wall, simConfig.seed);
+    printf("  settle %u us, bounce %u us, %u ns per call\n",
+           simConfig.settleUs, simConfig.bounceUs, simConfig.callNs);
+    playerReport();
+
+    printf("Sketch\n");
+    printf("  %-28s %10llu\n", "loop() passes", (unsigned long long)loops);
+    printf("  %-28s %10u\n", "scan interrupts", timerTicks);
+    printf("  %-28s %10u from %u edges, %u aborted\n", "idle wakes", idleWakes, consoleEdges, idleAborts);
+    printf("  %-28s %10u packets, %u stalls, %u dropped, %u lost\n", "USB-MIDI out",
+           midiSinkStats[0].sent, midiSinkStats[0].stalls, midiSinkStats[0].dropped, midiOutLost);
+#if DIN_MIDI_OUT
+    printf("  %-28s %10u packets, %u stalls, %u dropped, %u bytes\n", "DIN MIDI out",
+           midiSinkStats[1].sent, midiSinkStats[1].stalls, midiSinkStats[1].dropped, dinOutBytes);
+    printf("  %-28s %10u status bytes left out\n", "DIN running status", dinOutRunning);
+#endif
+    printf("  %-28s %10u resyncs, %u stuck cleared\n", "held notes", heldNotesResyncs, heldNotesStuck);
+    printf("  %-28s %10u\n", "LCD bytes", lcdBytes);
+    printf("  %-28s %10u\n", "flash writes", flashWrites);
+    printf("  %-28s %10u\n", "keystrokes", keyboardPresses);
+    stage("key scan", PROF_SCAN);
+    stage("key to USB", PROF_KEY_LATENCY);
+    spread("key to USB percentiles", PROF_KEY_LATENCY);
+    stage("loop()", PROF_LOOP);
+    stage("flight record, per row", PROF_RECORD);
+    printf("  %-28s %10u written, %u overwritten\n", "flight records", flightRecords, flightOverwritten);
+
+    bool ok = hostReport();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char** argv) {
+    if(!options(argc, argv)) {
+        fputs(usage, stderr);
+        return 2;
+    }
+    return simRun() ? 0 : 1;
+}
+#endif
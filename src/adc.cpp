@@ -0,0 +1,70 @@
+#include "adc.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+AdcRegs* adcRegs = ADC;
+#else
+AdcRegs* adcRegs;
+#endif
+
+uint32_t adcOverruns;
+
+static uint16_t samples[2][ADC_BLOCK];
+static uint8_t filling;                 //buffer the PDC is writing now
+
+//Current buffer and the one after it; the PDC moves on by itself
+static void adcQueue() {
+    adcRegs->ADC_PTCR = ADC_PTCR_RXTDIS;
+    adcRegs->ADC_RPR = (uintptr_t)samples[0];
+    adcRegs->ADC_RCR = ADC_BLOCK;
+    adcRegs->ADC_RNPR = (uintptr_t)samples[1];
+    adcRegs->ADC_RNCR = ADC_BLOCK;
+    filling = 0;
+    adcRegs->ADC_PTCR = ADC_PTCR_RXTEN;
+}
+
+void adcBegin(uint16_t mask) {
+#if defined(ARDUINO_ARCH_SAM)
+    pmc_enable_periph_clk(ID_ADC);
+#endif
+    //1 MHz ADC clock (84 MHz / (2 * 42)), converting the enabled channels continuously
+    adcRegs->ADC_MR = ADC_MR_PRESCAL(41) | ADC_MR_STARTUP_SUT64 | ADC_MR_SETTLING_AST5 |
+                      ADC_MR_TRACKTIM(15) | ADC_MR_TRANSFER(1) | ADC_MR_FREERUN_ON;
+    adcRegs->ADC_EMR = ADC_EMR_TAG;             //channel number in bits 12 - 15
+    adcRegs->ADC_CHDR = 0xFFFF;
+    adcRegs->ADC_CHER = mask;
+    adcQueue();
+    adcRegs->ADC_CR = ADC_CR_START;
+}
+
+bool adcRead(AdcBlock& block) {
+    //The next-buffer count drops to 0 when the PDC moves on to it
+    if(adcRegs->ADC_RNCR != 0)
+        return false;
+
+    //Both buffers full means the PDC has stopped: use the newer one, then start over
+    bool overrun = adcRegs->ADC_RCR == 0;
+    const uint16_t* done = samples[overrun ? filling ^ 1 : filling];
+    if(!overrun) {
+        //The finished buffer goes to the back of the line; it won't be written again
+        //until the one now filling is full
+        adcRegs->ADC_RNPR = (uintptr_t)done;
+        adcRegs->ADC_RNCR = ADC_BLOCK;
+        filling ^= 1;
+    }
+
+    for(uint8_t c = 0; c < ADC_CHANNELS; c++) {
+        block.sum[c] = 0;
+        block.count[c] = 0;
+    }
+    for(uint16_t i = 0; i < ADC_BLOCK; i++) {
+        uint8_t c = done[i] >> 12;
+        block.sum[c] += done[i] & 0x0FFF;
+        block.count[c]++;
+    }
+
+    if(overrun) {
+        adcOverruns++;
+        adcQueue();
+    }
+    return true;
+}
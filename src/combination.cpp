@@ -0,0 +1,90 @@
+#include "combination.h"
+#include "flashlog.h"
+
+#define COMBO_SLOTS     (COMBO_LEVELS * COMBO_PISTONS)
+
+static_assert(STOP_WORDS <= FLASH_DATA_WORDS, "a combination must fit in one flash record");
+static_assert(COMBO_SLOTS <= FLASH_LOG_KEYS, "too many memories for the flash log");
+
+StopSet stopsOn;
+uint8_t comboLevel;
+
+static StopSet memory[COMBO_SLOTS];     //key = level * COMBO_PISTONS + piston
+static bool unsaved[COMBO_SLOTS];
+
+static void loaded(uint16_t key, const uint32_t* data) {
+    if(key >= COMBO_SLOTS)
+        return;
+    for(uint8_t w = 0; w < STOP_WORDS; w++)
+        memory[key].word[w] = data[w];
+}
+
+void comboBegin() {
+    flashLogBegin(loaded);
+}
+
+void comboStopChanged(uint8_t stop, bool on) {
+    if(stop >= STOP_COUNT)
+        return;
+    if(on)
+        stopsOn.word[stop >> 5] |= 1UL << (stop & 31);
+    else
+        stopsOn.word[stop >> 5] &= ~(1UL << (stop & 31));
+}
+
+//Send the stops that differ between stopsOn and target, offs first
+static bool apply(const StopSet& target, uint16_t space, StopSend send) {
+    uint16_t changes = 0;
+    for(uint8_t w = 0; w < STOP_WORDS; w++)
+        changes += __builtin_popcount(stopsOn.word[w] ^ target.word[w]);
+    if(changes > space)
+        return false;
+
+    for(uint8_t on = 0; on < 2; on++) {
+        for(uint8_t w = 0; w < STOP_WORDS; w++) {
+            uint32_t bits = (stopsOn.word[w] ^ target.word[w]) & (on ? target.word[w] : stopsOn.word[w]);
+            while(bits) {
+                uint8_t b = __builtin_ctz(bits);
+                bits &= bits - 1;
+                if(send(w * 32 + b, on))
+                    stopsOn.word[w] ^= 1UL << b;
+            }
+        }
+    }
+    return true;
+}
+
+bool comboRecall(uint8_t piston, uint16_t space, StopSend send) {
+    if(piston >= COMBO_PISTONS)
+        return true;
+    return apply(memory[comboLevel * COMBO_PISTONS + piston], space, send);
+}
+
+bool comboCancel(uint16_t space, StopSend send) {
+    StopSet none = {{0}};
+    return apply(none, space, send);
+}
+
+void comboSet(uint8_t piston) {
+    if(piston >= COMBO_PISTONS)
+        return;
+    uint8_t key = comboLevel * COMBO_PISTONS + piston;
+    memory[key] = stopsOn;
+    unsaved[key] = true;
+}
+
+void comboService() {
+    if(flashLogBusy())
+        return;
+
+    for(uint8_t key = 0; key < COMBO_SLOTS; key++) {
+        if(!unsaved[key])
+            continue;
+        uint32_t data[FLASH_DATA_WORDS] = {0};
+        for(uint8_t w = 0; w < STOP_WORDS; w++)
+            data[w] = memory[key].word[w];
+        if(flashLogWrite(key, data))
+            unsaved[key] = false;
+        return;
+    }
+}
@@ -0,0 +1,138 @@
+#include "coupler.h"
+
+static_assert((1 << COUPLER_PLANES) - 1 >= COUPLER_DIVISIONS, "a key's count must fit every division");
+
+struct CouplerOutput {
+    uint64_t count[COUPLER_PLANES];     //bit-sliced source count, plane p = bit p
+    uint64_t sent;                      //keys emit has taken as on
+};
+
+static int8_t slot[16];                 //channel - 1 -> divisions, -1 = not a division
+static uint8_t channelOf[COUPLER_DIVISIONS];
+static uint8_t divisions;
+static uint64_t held[COUPLER_DIVISIONS];        //keys down
+static uint64_t batch[COUPLER_DIVISIONS];       //keys changed since the last send
+static CouplerOutput out[COUPLER_DIVISIONS];
+static uint32_t batchStamp;
+
+static const CouplerDef* table;
+static uint8_t couplerCount;
+static uint8_t engaged;                 //bit c = coupler c
+static CouplerEmit emit;
+
+static int8_t divisionOf(uint8_t channel) {
+    return slot[(channel - 1) & 0x0F];
+}
+
+//Count every key in m once more / once less
+static void countUp(CouplerOutput& o, uint64_t m) {
+    for(uint8_t p = 0; p < COUPLER_PLANES && m; p++) {
+        uint64_t carry = o.count[p] & m;
+        o.count[p] ^= m;
+        m = carry;
+    }
+}
+
+static void countDown(CouplerOutput& o, uint64_t m) {
+    for(uint8_t p = 0; p < COUPLER_PLANES && m; p++) {
+        uint64_t borrow = ~o.count[p] & m;
+        o.count[p] ^= m;
+        m = borrow;
+    }
+}
+
+static uint64_t sounding(const CouplerOutput& o) {
+    uint64_t any = 0;
+    for(uint8_t p = 0; p < COUPLER_PLANES; p++)
+        any |= o.count[p];
+    return any;
+}
+
+void couplerBegin(uint16_t channels, const CouplerDef* couplers, uint8_t count, CouplerEmit e) {
+    divisions = 0;
+    for(uint8_t ch = 0; ch < 16; ch++) {
+        slot[ch] = -1;
+        if(!(channels & (1 << ch)) || divisions == COUPLER_DIVISIONS)
+            continue;
+        channelOf[divisions] = ch + 1;
+        held[divisions] = batch[divisions] = 0;
+        out[divisions] = CouplerOutput();
+        slot[ch] = divisions++;
+    }
+    table = couplers;
+    couplerCount = count < COUPLER_MAX ? count : COUPLER_MAX;
+    engaged = 0;
+    emit = e;
+}
+
+void couplerSet(uint8_t coupler, bool on) {
+    if(coupler >= couplerCount || on == couplerEngaged(coupler))
+        return;
+    int8_t from = divisionOf(table[coupler].from);
+    int8_t to = divisionOf(table[coupler].to);
+    if(from < 0 || to < 0)
+        return;
+
+    engaged ^= 1 << coupler;
+    if(on)
+        countUp(out[to], held[from]);
+    else
+        countDown(out[to], held[from]);
+}
+
+bool couplerEngaged(uint8_t coupler) {
+    return engaged & (1 << coupler);
+}
+
+bool couplerKey(uint8_t channel, uint8_t key, bool on, uint32_t stamp) {
+    int8_t d = divisionOf(channel);
+    uint64_t bit = 1ULL << (key & 63);
+    if(d < 0 || (batch[d] & bit))
+        return false;
+    if(on == !!(held[d] & bit))
+        return true;                    //no change
+
+    bool first = true;
+    for(uint8_t n = 0; n < divisions; n++)
+        first &= !batch[n];
+    if(first)
+        batchStamp = stamp;
+    batch[d] |= bit;
+    held[d] ^= bit;
+
+    //The division itself, then every engaged coupler from it
+    if(on)
+        countUp(out[d], bit);
+    else
+        countDown(out[d], bit);
+    for(uint8_t c = 0; c < couplerCount; c++) {
+        if(!(engaged & (1 << c)) || divisionOf(table[c].from) != d)
+            continue;
+        CouplerOutput& o = out[divisionOf(table[c].to)];     //engaged, so a division
+        if(on)
+            countUp(o, bit);
+        else
+            countDown(o, bit);
+    }
+    return true;
+}
+
+bool couplerSend() {
+    for(uint8_t d = 0; d < divisions; d++) {
+        CouplerOutput& o = out[d];
+        uint64_t now = sounding(o);
+        uint64_t changed = now ^ o.sent;
+        while(changed) {
+            uint8_t k = __builtin_ctzll(changed);
+            uint64_t bit = 1ULL << k;
+            if(!emit(channelOf[d], k, now & bit, batchStamp))
+                return false;
+            o.sent ^= bit;
+            changed &= changed - 1;
+        }
+    }
+    for(uint8_t d = 0; d < divisions; d++)
+        batch[d] = 0;
+    batchStamp = 0;
+    return true;
+}
@@ -0,0 +1,49 @@
+#include "debounce.h"
+
+void debounceBegin(Debouncer& d, const DebounceConfig& config) {
+    d.config = config;
+    d.sounding = 0;
+    d.releasing = 0;
+    for(uint8_t k = 0; k < 64; k++) {
+        d.onTime[k] = 0;
+        d.openTime[k] = 0;
+    }
+}
+
+void debounceUpdate(Debouncer& d, uint64_t frame, uint64_t keys, uint32_t now, DebounceEmit emit) {
+    //New presses go out straight away
+    uint64_t bits = frame & ~d.sounding & keys;
+    while(bits) {
+        uint8_t k = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        if(!emit(k, true))
+            continue;
+        d.sounding |= 1ULL << k;
+        d.onTime[k] = now;
+    }
+
+    //A bounce closed again inside the release window: keep the note
+    d.releasing &= ~(frame & keys);
+
+    //Contacts that just opened start their release window
+    bits = ~frame & d.sounding & ~d.releasing & keys;
+    d.releasing |= bits;
+    while(bits) {
+        uint8_t k = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        d.openTime[k] = now;
+    }
+
+    //Release once the contact has stayed open long enough and the note has had its minimum length
+    bits = d.releasing & keys;
+    while(bits) {
+        uint8_t k = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        if(now - d.openTime[k] < d.config.releaseUs || now - d.onTime[k] < d.config.pressUs)
+            continue;
+        if(!emit(k, false))
+            continue;
+        d.sounding &= ~(1ULL << k);
+        d.releasing &= ~(1ULL << k);
+    }
+}
@@ -0,0 +1,79 @@
+#include "dinout.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+UsartRegs* dinUsart = USART0;
+#else
+UsartRegs* dinUsart;
+#endif
+
+uint32_t dinOutBytes;
+uint32_t dinOutRunning;
+
+static uint8_t block[2][DIN_BLOCK];
+static uint8_t fill;                    //the block not held by the PDC
+static uint8_t running;                 //status the receiver has, 0 = none
+static uint32_t lastSent;               //millis() the last block was queued
+
+void dinOutBegin() {
+#if defined(ARDUINO_ARCH_SAM)
+    //TX1 back to USART0 in case anything made pin 18 a PIO line since Serial1.begin()
+    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA11A_TXD0, PIO_DEFAULT);
+#endif
+    dinUsart->US_PTCR = US_PTCR_TXTDIS;
+    dinUsart->US_TCR = 0;
+    dinUsart->US_TNCR = 0;
+    dinUsart->US_PTCR = US_PTCR_TXTEN;
+    fill = 0;
+    running = 0;
+}
+
+uint16_t dinOutSend(const midiEventPacket_t* packets, uint16_t count) {
+    //One block on the line and one waiting is as far ahead as the PDC goes
+    if(dinUsart->US_TNCR)
+        return 0;
+
+    uint32_t now = millis();
+    if(now - lastSent >= DIN_STATUS_REFRESH_MS)
+        running = 0;
+
+    uint8_t* b = block[fill];
+    uint8_t length = 0;
+    uint16_t taken = 0;
+    for(; taken < count; taken++) {
+        const midiEventPacket_t& p = packets[taken];
+        uint8_t cin = p.header & 0x0F;
+        if(cin < 0x08 || cin > 0x0E)
+            continue;                   //SysEx and the rest are for the host
+
+        uint8_t size = cin == 0x0C || cin == 0x0D ? 2 : 3;
+        bool same = p.byte1 == running;
+        if(length + size - same > DIN_BLOCK)
+            break;
+        if(same)
+            dinOutRunning++;
+        else
+            b[length++] = running = p.byte1;
+        b[length++] = p.byte2;
+        if(size == 3)
+            b[length++] = p.byte3;
+    }
+
+    if(length) {
+        if(dinUsart->US_TCR == 0) {
+            dinUsart->US_TPR = (uintptr_t)b;
+            dinUsart->US_TCR = length;
+        }
+        else {
+            dinUsart->US_TNPR = (uintptr_t)b;
+            dinUsart->US_TNCR = length;
+        }
+        fill ^= 1;
+        lastSent = now;
+        dinOutBytes += length;
+    }
+    return taken;
+}
+
+bool dinOutConnected() {
+    return true;
+}
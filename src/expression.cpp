@@ -0,0 +1,44 @@
+#include "expression.h"
+
+void expressionBegin(ExpressionFilter& f, uint16_t deadband, uint8_t shift) {
+    f.deadband = deadband;
+    f.shift = shift;
+    f.primed = false;
+    f.smooth = 0;
+    f.out = 0;
+}
+
+static uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+    if(a > b) { uint16_t t = a; a = b; b = t; }
+    if(b > c) b = c;
+    return a > b ? a : b;
+}
+
+uint16_t expressionUpdate(ExpressionFilter& f, uint16_t value) {
+    //Start settled on the first reading rather than gliding up from 0
+    if(!f.primed) {
+        f.recent[1] = f.recent[2] = value;
+        f.smooth = (int32_t)value << 8;
+        f.out = value;
+        f.primed = true;
+    }
+    f.recent[0] = f.recent[1];
+    f.recent[1] = f.recent[2];
+    f.recent[2] = value;
+
+    int32_t x = (int32_t)median3(f.recent[0], f.recent[1], f.recent[2]) << 8;
+    f.smooth += (x - f.smooth) >> f.shift;
+
+    int32_t y = (f.smooth + 0x80) >> 8;
+    if(y > f.out + f.deadband)
+        f.out = y - f.deadband;
+    else if(y < f.out - f.deadband)
+        f.out = y + f.deadband;
+
+    //Let the ends through exactly so the pedal can reach fully open and closed
+    if(y >= EXPRESSION_MAX - f.deadband && y > f.out)
+        f.out = EXPRESSION_MAX;
+    else if(y <= f.deadband && y < f.out)
+        f.out = 0;
+    return f.out;
+}
@@ -0,0 +1,179 @@
+#include "flashlog.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+EfcRegs* flashRegs = EFC1;
+uint32_t* flashBase = (uint32_t*)(IFLASH1_ADDR + IFLASH1_SIZE - FLASH_LOG_PAGES * IFLASH1_PAGE_SIZE);
+uint16_t flashFirstPage = IFLASH1_SIZE / IFLASH1_PAGE_SIZE - FLASH_LOG_PAGES;
+#else
+EfcRegs* flashRegs;
+uint32_t* flashBase;
+uint16_t flashFirstPage;
+#endif
+
+#define FLASH_KEY       0x5A
+#define FCMD_WP         0x01            //write page
+#define FCMD_EWP        0x03            //erase and write page
+#define FCMD_CLB        0x09            //clear lock bit
+
+//Record: sequence, key, data[4], check, unused. A blank (erased) slot reads all 1s.
+enum { REC_SEQ, REC_KEY, REC_DATA, REC_CHECK = REC_DATA + FLASH_DATA_WORDS };
+
+static int16_t latest[FLASH_LOG_KEYS];  //slot holding each key's newest record, -1 = none
+static int16_t backup[FLASH_LOG_KEYS];  //another slot with that same record (a copy), -1 = none
+static uint32_t nextSeq;
+static uint16_t writeSlot;              //next slot to write
+
+static const uint32_t* slotRecord(uint16_t slot) {
+    return flashBase + slot * FLASH_RECORD_WORDS;
+}
+
+static uint32_t checkWord(const uint32_t* r) {
+    uint32_t c = 0xA5A5A5A5;
+    for(uint8_t w = 0; w < REC_CHECK; w++)
+        c ^= r[w];
+    return c;
+}
+
+//Blank, torn or foreign slots all fail this
+static bool recordValid(const uint32_t* r) {
+    return r[REC_SEQ] != 0xFFFFFFFF && r[REC_KEY] < FLASH_LOG_KEYS && r[REC_CHECK] == checkWord(r);
+}
+
+static bool slotBlank(uint16_t slot) {
+    const uint32_t* r = slotRecord(slot);
+    for(uint8_t w = 0; w < FLASH_RECORD_WORDS; w++) {
+        if(r[w] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+//Erasing the page would lose a key's newest record: it holds one with no copy elsewhere
+static bool pageLive(uint16_t page) {
+    for(uint8_t s = 0; s < FLASH_PAGE_RECORDS; s++) {
+        uint16_t slot = page * FLASH_PAGE_RECORDS + s;
+        const uint32_t* r = slotRecord(slot);
+        if(recordValid(r) && latest[r[REC_KEY]] == slot && backup[r[REC_KEY]] < 0)
+            return true;
+    }
+    return false;
+}
+
+//The page is about to be erased: the records it held on to live on in their copies
+static void pageErased(uint16_t page) {
+    for(uint16_t k = 0; k < FLASH_LOG_KEYS; k++) {
+        if(latest[k] >= 0 && latest[k] / FLASH_PAGE_RECORDS == page) {
+            latest[k] = backup[k];
+            backup[k] = -1;
+        }
+        if(backup[k] >= 0 && backup[k] / FLASH_PAGE_RECORDS == page)
+            backup[k] = -1;
+    }
+}
+
+static void command(uint8_t cmd, uint16_t page) {
+    flashRegs->EEFC_FCR = EEFC_FCR_FKEY(FLASH_KEY) | EEFC_FCR_FARG(flashFirstPage + page) | EEFC_FCR_FCMD(cmd);
+}
+
+bool flashLogBusy() {
+    return !(flashRegs->EEFC_FSR & EEFC_FSR_FRDY);
+}
+
+void flashLogBegin(void (*found)(uint16_t key, const uint32_t* data)) {
+    command(FCMD_CLB, 0);               //the log sits in one 16 KB lock region
+    while(flashLogBusy());
+
+    for(uint16_t k = 0; k < FLASH_LOG_KEYS; k++)
+        latest[k] = backup[k] = -1;
+
+    int32_t newest = -1;
+    for(uint16_t slot = 0; slot < FLASH_LOG_SLOTS; slot++) {
+        const uint32_t* r = slotRecord(slot);
+        if(!recordValid(r))
+            continue;
+        uint16_t k = r[REC_KEY];
+        if(latest[k] < 0 || r[REC_SEQ] > slotRecord(latest[k])[REC_SEQ]) {
+            latest[k] = slot;
+            backup[k] = -1;
+        }
+        else if(r[REC_SEQ] == slotRecord(latest[k])[REC_SEQ])
+            backup[k] = slot;
+        if(newest < 0 || r[REC_SEQ] > slotRecord(newest)[REC_SEQ])
+            newest = slot;
+    }
+
+    nextSeq = newest < 0 ? 0 : slotRecord(newest)[REC_SEQ] + 1;
+    writeSlot = newest < 0 ? 0 : (newest + 1) % FLASH_LOG_SLOTS;
+    //A cut while programming leaves the slot after the newest half written. Programming
+    //the next record over it would tear that one too, so skip it (a new page is erased).
+    while(writeSlot % FLASH_PAGE_RECORDS && !slotBlank(writeSlot))
+        writeSlot = (writeSlot + 1) % FLASH_LOG_SLOTS;
+
+    for(uint16_t k = 0; k < FLASH_LOG_KEYS; k++) {
+        if(latest[k] >= 0)
+            found(k, slotRecord(latest[k]) + REC_DATA);
+    }
+}
+
+bool flashLogWrite(uint16_t key, const uint32_t* data) {
+    if(key >= FLASH_LOG_KEYS || flashLogBusy())
+        return false;
+
+    uint32_t image[FLASH_PAGE_WORDS];
+    uint16_t page = writeSlot / FLASH_PAGE_RECORDS;
+    uint8_t used = writeSlot % FLASH_PAGE_RECORDS;
+    uint8_t cmd = FCMD_WP;
+
+    if(used == 0) {
+        //Starting a page. Its records were copied on when the page before it was started;
+        //now copy on the live records of the page after, the next one to be erased.
+        //Copies keep their sequence number, so a torn copy leaves the original in charge.
+        for(uint16_t tries = 0; tries < FLASH_LOG_PAGES && pageLive(page); tries++)
+            page = (page + 1) % FLASH_LOG_PAGES;
+        pageErased(page);
+        for(uint8_t w = 0; w < FLASH_PAGE_WORDS; w++)
+            image[w] = 0xFFFFFFFF;
+
+        uint16_t next = (page + 1) % FLASH_LOG_PAGES;
+        for(uint8_t s = 0; s < FLASH_PAGE_RECORDS; s++) {
+            uint16_t slot = next * FLASH_PAGE_RECORDS + s;
+            const uint32_t* r = slotRecord(slot);
+            if(!recordValid(r) || r[REC_KEY] == key || latest[r[REC_KEY]] != slot)
+                continue;
+            for(uint8_t w = 0; w < FLASH_RECORD_WORDS; w++)
+                image[used * FLASH_RECORD_WORDS + w] = r[w];
+            latest[r[REC_KEY]] = page * FLASH_PAGE_RECORDS + used;
+            backup[r[REC_KEY]] = slot;
+            used++;
+        }
+        cmd = FCMD_EWP;
+    }
+    else {
+        //Slots already written keep their contents; programming the same bits is a no-op
+        const uint32_t* p = flashBase + page * FLASH_PAGE_WORDS;
+        for(uint8_t w = 0; w < FLASH_PAGE_WORDS; w++)
+            image[w] = p[w];
+    }
+
+    //Copies can fill the page. The record then waits for the next write.
+    bool written = used < FLASH_PAGE_RECORDS;
+    if(written) {
+        uint32_t* r = image + used * FLASH_RECORD_WORDS;
+        r[REC_SEQ] = nextSeq++;
+        r[REC_KEY] = key;
+        for(uint8_t w = 0; w < FLASH_DATA_WORDS; w++)
+            r[REC_DATA + w] = data[w];
+        r[REC_CHECK] = checkWord(r);
+        latest[key] = page * FLASH_PAGE_RECORDS + used;
+        backup[key] = -1;
+        used++;
+    }
+    writeSlot = (page * FLASH_PAGE_RECORDS + used) % FLASH_LOG_SLOTS;
+
+    //Fill the page latch, then program it
+    volatile uint32_t* latch = flashBase + page * FLASH_PAGE_WORDS;
+    for(uint8_t w = 0; w < FLASH_PAGE_WORDS; w++)
+        latch[w] = image[w];
+    command(cmd, page);
+    return written;
+}
@@ -0,0 +1,280 @@
+#include "flightrec.h"
+#include "midiout.h"
+#include "profile.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+#define FLIGHT_LOCK()       uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define FLIGHT_UNLOCK()     __set_PRIMASK(primask)
+#else
+#define FLIGHT_LOCK()
+#define FLIGHT_UNLOCK()
+#endif
+
+#define RING_MASK           (FLIGHT_BYTES - 1)
+#define RECORD_MAX          (1 + 5 + 2 + SENSE_PORTS * 4)
+#define HEADER_MAX          (4 + 4 + 1 + FLIGHT_ROWS * SENSE_PORTS * 4)
+
+static_assert((FLIGHT_BYTES & RING_MASK) == 0, "FLIGHT_BYTES must be a power of two");
+static_assert(FLIGHT_CHUNK % 7 == 0, "FLIGHT_CHUNK must be whole groups of 7");
+
+uint32_t flightRecords;
+uint32_t flightOverwritten;
+
+static uint8_t ring[FLIGHT_BYTES];
+static uint32_t head, tail;             //free running, written under the lock
+static bool started;
+static uint32_t lastTime;               //time of the newest record
+static uint32_t baseTime;               //time the oldest record's dt counts from
+static uint32_t base[FLIGHT_ROWS][SENSE_PORTS];
+static uint32_t last[FLIGHT_ROWS][SENSE_PORTS];
+static uint32_t senseMask[SENSE_PORTS];
+
+static uint32_t scanNow;
+static uint8_t row;
+static uint8_t rowsUsed;
+static volatile bool frozen;
+
+//Dump in progress
+static bool dumping;
+static uint32_t dumpPos, dumpTotal;
+static uint8_t header[HEADER_MAX];
+static uint16_t headerLength;
+
+void flightBegin(const DriveRow& sense) {
+    for(uint8_t p = 0; p < SENSE_PORTS; p++)
+        senseMask[p] = sense.mask[p];
+    for(uint8_t r = 0; r < FLIGHT_ROWS; r++) {
+        for(uint8_t p = 0; p < SENSE_PORTS; p++)
+            base[r][p] = last[r][p] = 0;
+    }
+    head = tail = 0;
+    started = false;
+    rowsUsed = 0;
+    frozen = false;
+    dumping = false;
+}
+
+static uint8_t ringByte(uint32_t pos) {
+    return ring[pos & RING_MASK];
+}
+
+static uint8_t* putVarint(uint8_t* p, uint32_t value) {
+    while(value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+//Time since the newest record; a stamp read just before an interrupt recorded a later one counts as 0
+static uint32_t delta(uint32_t now) {
+    if(!started) {
+        baseTime = lastTime = now;
+        started = true;
+    }
+    int32_t dt = (int32_t)(now - lastTime);
+    if(dt < 0)
+        dt = 0;
+    lastTime += dt;
+    return dt;
+}
+
+//Fold the oldest record into the base frame
+static void dropOldest() {
+    uint32_t pos = tail;
+    uint8_t tag = ringByte(pos++);
+
+    uint32_t dt = 0;
+    for(uint8_t shift = 0;; shift += 7) {
+        uint8_t b = ringByte(pos++);
+        dt |= (uint32_t)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            break;
+    }
+    baseTime += dt;
+
+    uint8_t r = tag & 0x0F;
+    switch(tag & 0xF0) {
+    case FLIGHT_ROW_BIT: {
+        uint8_t bit = ringByte(pos++);
+        base[r][bit >> 5] ^= 1UL << (bit & 31);
+        break;
+    }
+    case FLIGHT_ROW_XOR: {
+        uint16_t bytes = ringByte(pos) | ringByte(pos + 1) << 8;
+        pos += 2;
+        for(; bytes; bytes &= bytes - 1) {
+            uint8_t n = __builtin_ctz(bytes);
+            base[r][n >> 2] ^= (uint32_t)ringByte(pos++) << (8 * (n & 3));
+        }
+        break;
+    }
+    case FLIGHT_EVENT:
+        pos += 3;
+        break;
+    default:
+        pos += 1;
+        break;
+    }
+    tail = pos;
+    flightOverwritten++;
+}
+
+static void put(const uint8_t* record, uint8_t length) {
+    while(FLIGHT_BYTES - (head - tail) < length)
+        dropOldest();
+    for(uint8_t n = 0; n < length; n++)
+        ring[(head + n) & RING_MASK] = record[n];
+    head += length;
+    flightRecords++;
+}
+
+void flightScan(uint32_t now) {
+    scanNow = now;
+    row = 0;
+}
+
+//Runs in the scan interrupt, which the lock in loop()'s writers keeps out
+void flightRow(const SenseSample& sense) {
+    uint32_t start = cyclesNow();
+    uint8_t r = row++;
+    if(frozen || r >= FLIGHT_ROWS)
+        return;
+    if(r >= rowsUsed)
+        rowsUsed = r + 1;
+
+    uint32_t x[SENSE_PORTS];
+    uint8_t changed = 0;
+    for(uint8_t p = 0; p < SENSE_PORTS; p++) {
+        x[p] = (sense.port[p] & senseMask[p]) ^ last[r][p];
+        last[r][p] ^= x[p];
+        changed += __builtin_popcount(x[p]);
+    }
+    if(!changed) {
+        profileEnd(PROF_RECORD, start);
+        return;
+    }
+
+    uint8_t record[RECORD_MAX];
+    uint8_t* p = record + 1;
+    p = putVarint(p, delta(scanNow));
+    if(changed == 1) {
+        record[0] = FLIGHT_ROW_BIT | r;
+        for(uint8_t port = 0; port < SENSE_PORTS; port++) {
+            if(x[port])
+                *p++ = port * 32 + __builtin_ctz(x[port]);
+        }
+    }
+    else {
+        record[0] = FLIGHT_ROW_XOR | r;
+        uint8_t* mask = p;
+        p += 2;
+        uint16_t bytes = 0;
+        for(uint8_t n = 0; n < SENSE_PORTS * 4; n++) {
+            uint8_t b = x[n >> 2] >> (8 * (n & 3));
+            if(b) {
+                bytes |= 1 << n;
+                *p++ = b;
+            }
+        }
+        mask[0] = bytes;
+        mask[1] = bytes >> 8;
+    }
+    put(record, p - record);
+    profileEnd(PROF_RECORD, start);
+}
+
+void flightEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t now) {
+    FLIGHT_LOCK();
+    if(!frozen) {
+        uint8_t record[RECORD_MAX];
+        record[0] = FLIGHT_EVENT;
+        uint8_t* p = putVarint(record + 1, delta(now));
+        *p++ = status;
+        *p++ = data1;
+        *p++ = data2;
+        put(record, p - record);
+    }
+    FLIGHT_UNLOCK();
+}
+
+void flightFreeze(uint8_t cause) {
+    FLIGHT_LOCK();
+    if(!frozen) {
+        uint8_t record[RECORD_MAX];
+        record[0] = FLIGHT_MARK;
+        uint8_t* p = putVarint(record + 1, delta(micros()));
+        *p++ = cause;
+        put(record, p - record);
+        frozen = true;
+    }
+    FLIGHT_UNLOCK();
+}
+
+void flightResume() {
+    dumping = false;
+    frozen = false;
+}
+
+bool flightFrozen() {
+    return frozen;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    for(uint8_t n = 0; n < 4; n++)
+        *p++ = value >> (8 * n);
+    return p;
+}
+
+void flightDumpStart() {
+    flightFreeze(FLIGHT_SYSEX);
+
+    uint8_t* p = put32(header, baseTime);
+    p = put32(p, head - tail);
+    *p++ = rowsUsed;
+    for(uint8_t r = 0; r < rowsUsed; r++) {
+        for(uint8_t port = 0; port < SENSE_PORTS; port++)
+            p = put32(p, base[r][port]);
+    }
+    headerLength = p - header;
+    dumpTotal = headerLength + (head - tail);
+    dumpPos = 0;
+    dumping = true;
+}
+
+static uint8_t streamByte(uint32_t pos) {
+    return pos < headerLength ? header[pos] : ringByte(tail + pos - headerLength);
+}
+
+//Half the output queue is left for the keys whatever the dump is doing
+void flightDumpService() {
+    const uint8_t packets = (4 + 3 + FLIGHT_CHUNK / 7 * 8 + 1 + 2) / 3;
+
+    while(dumping && midiOutSpace() >= MIDI_OUT_PACKETS / 2 + packets) {
+        uint8_t msg[4 + 3 + FLIGHT_CHUNK / 7 * 8 + 1] = {0xF0, 0x7D, 0x4F, 0x07};
+        uint32_t n = dumpTotal - dumpPos;
+        if(n > FLIGHT_CHUNK)
+            n = FLIGHT_CHUNK;
+        uint8_t* p = profilePut7(msg + 4, n ? dumpPos : dumpTotal, 3);
+
+        //8-to-7: a byte of high bits, then the low seven bits of up to seven bytes
+        for(uint32_t group = 0; group < n; group += 7) {
+            uint8_t* high = p++;
+            *high = 0;
+            for(uint8_t i = 0; i < 7 && group + i < n; i++) {
+                uint8_t b = streamByte(dumpPos + group + i);
+                *high |= (b >> 7) << i;
+                *p++ = b & 0x7F;
+            }
+        }
+        *p++ = 0xF7;
+
+        if(!midiOutSysEx(msg, p - msg))
+            return;
+        if(!n)
+            dumping = false;
+        dumpPos += n;
+    }
+}
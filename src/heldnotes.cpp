@@ -0,0 +1,108 @@
+#include "heldnotes.h"
+#include "midiout.h"
+
+uint32_t heldNotesStuck;
+uint32_t heldNotesResyncs;
+
+static uint64_t held[16][2];            //[channel - 1][notes 0 - 63, 64 - 127]
+static uint64_t suspect[16][2];         //held and released ever since suspectSince
+static uint32_t suspectSince[16];
+static uint16_t resyncChannels;
+static uint16_t resyncPending;          //channels still to send, bit n = channel n + 1
+static bool connected;
+
+void heldNotesBegin(uint16_t channels) {
+    resyncChannels = channels;
+}
+
+void heldNotesSent(byte status, byte data1, byte data2) {
+    uint64_t* c = held[status & 0x0F];
+
+    switch(status & 0xF0) {
+    case 0x90:
+        if(data2) {
+            c[data1 >> 6] |= 1ULL << (data1 & 63);
+            break;
+        }
+        c[data1 >> 6] &= ~(1ULL << (data1 & 63));       //velocity 0 = note off
+        break;
+    case 0x80:
+        c[data1 >> 6] &= ~(1ULL << (data1 & 63));
+        break;
+    case 0xB0:
+        if(data1 == 120 || data1 == 123)                //all sound / all notes off
+            c[0] = c[1] = 0;
+        break;
+    }
+}
+
+bool heldNote(byte channel, byte note) {
+    return held[channel - 1][note >> 6] & (1ULL << (note & 63));
+}
+
+void heldNotesResync() {
+    resyncPending = resyncChannels;
+}
+
+void heldNotesService() {
+    bool now = midiOutConnected();
+    if(now && !connected)
+        heldNotesResync();
+    connected = now;
+
+    //Anything still queued would land after the resync and undo it
+    if(!resyncPending || midiOutSpace() != MIDI_OUT_PACKETS)
+        return;
+
+    //A channel at a time, each one whole; whatever doesn't fit waits for the next call
+    while(resyncPending) {
+        byte ch = __builtin_ctz(resyncPending);
+        const uint64_t* c = held[ch];
+        uint16_t need = 1 + __builtin_popcountll(c[0]) + __builtin_popcountll(c[1]);
+        if(need > midiOutSpace())
+            return;
+
+        midiOutMessage(0xB0 | ch, 123, 0);
+        for(uint8_t w = 0; w < 2; w++) {
+            uint64_t bits = c[w];
+            while(bits) {
+                midiOutMessage(0x90 | ch, w * 64 + __builtin_ctzll(bits), 127);
+                bits &= bits - 1;
+            }
+        }
+        resyncPending &= ~(1U << ch);
+    }
+    heldNotesResyncs++;
+}
+
+uint8_t heldNotesWatch(byte channel, const uint64_t* sounding, uint32_t releaseUs, uint32_t now) {
+    //Note offs still queued aren't lost yet
+    if(resyncPending || midiOutSpace() != MIDI_OUT_PACKETS)
+        return 0;
+
+    //Suspects are the notes found held and released at the start of a period, less any
+    //seen sounding or let go since. Those left at the end of it are stuck, and the next
+    //period starts with what is held and released now.
+    const uint64_t* c = held[channel - 1];
+    uint64_t* s = suspect[channel - 1];
+    bool due = now - suspectSince[channel - 1] >= releaseUs + HELD_GRACE_US;
+    if(due)
+        suspectSince[channel - 1] = now;
+
+    uint8_t cleared = 0;
+    for(uint8_t w = 0; w < 2; w++) {
+        uint64_t open = c[w] & ~sounding[w];
+        uint64_t stuck = s[w] & open;
+        s[w] = due ? open : stuck;
+        if(!due)
+            continue;
+        while(stuck) {
+            if(!midiOutMessage(0x80 | (channel - 1), w * 64 + __builtin_ctzll(stuck), 0))
+                return cleared;
+            stuck &= stuck - 1;
+            heldNotesStuck++;
+            cleared++;
+        }
+    }
+    return cleared;
+}
@@ -0,0 +1,79 @@
+#include "idle.h"
+#include "cycles.h"
+
+volatile bool idleParked;
+uint32_t idleWakes;
+uint32_t idleAborts;
+
+static DriveRow allRows;
+static DriveRow senseLines;
+static uint32_t quietTime;
+static uint32_t quietSince;
+static bool restart = true;             //start the quiet period afresh on the next check
+
+static void senseInterrupts(bool on) {
+    for(uint8_t p = 0; p < SENSE_PORTS; p++) {
+        if(!senseLines.mask[p])
+            continue;
+        if(on) {
+            (void)pioPorts[p]->PIO_ISR;         //drop edges latched while scanning
+            pioPorts[p]->PIO_IER = senseLines.mask[p];
+        }
+        else
+            pioPorts[p]->PIO_IDR = senseLines.mask[p];
+    }
+}
+
+void idleBegin(const DriveRow& drive, const DriveRow& sense, uint32_t quietUs) {
+    allRows = drive;
+    senseLines = sense;
+    quietTime = quietUs;
+    senseInterrupts(false);
+}
+
+static bool anyClosed() {
+    SenseSample s = matrixSense();
+    for(uint8_t p = 0; p < SENSE_PORTS; p++) {
+        if(s.port[p] & senseLines.mask[p])
+            return true;
+    }
+    return false;
+}
+
+bool idleCheck(bool busy, uint32_t now) {
+    if(busy || restart) {
+        quietSince = now;
+        restart = false;
+        return false;
+    }
+    if(!quietTime || now - quietSince < quietTime)
+        return false;
+
+    matrixDrive(allRows);
+    cyclesWaitUntil(cyclesNow() + usToCycles(ROW_SETTLE_US));
+    senseInterrupts(true);
+
+    //A key that went down since the last scan made its edge too early to be seen
+    if(anyClosed()) {
+        senseInterrupts(false);
+        matrixRelease(allRows);
+        idleAborts++;
+        restart = true;
+        return false;
+    }
+
+    idleParked = true;
+    return true;
+}
+
+bool idleWake() {
+    if(!idleParked)
+        return false;
+
+    senseInterrupts(false);
+    matrixRelease(allRows);
+    idleParked = false;
+    idleWakes++;
+    restart = true;
+    return true;
+}
@@ -0,0 +1,111 @@
+#include "lcdframe.h"
+
+#define LCD_SET_DDRAM   0x80
+#define ADDR_UNKNOWN    0xFF
+#define CELL_UNKNOWN    0x100
+
+static LcdSend lcdSend;
+static uint8_t want[LCD_CELLS];         //what the sketch wants shown
+static uint16_t shown[LCD_CELLS];       //what the display has, or CELL_UNKNOWN
+static uint8_t addr;                    //frame index the display's address counter is at
+static uint8_t next;                    //where the next service starts looking
+
+//Row r starts this far into DDRAM order
+static const uint8_t rowStart[LCD_ROWS] = {0, 2 * LCD_COLS, LCD_COLS, 3 * LCD_COLS};
+
+static inline uint8_t cell(uint8_t col, uint8_t row) {
+    return rowStart[row] + col;
+}
+
+//DDRAM address of frame index i: rows 0/2 run 0x00 - 0x27, rows 1/3 0x40 - 0x67
+static inline uint8_t ddram(uint8_t i) {
+    return i < 2 * LCD_COLS ? i : 0x40 + i - 2 * LCD_COLS;
+}
+
+void lcdFrameBegin(LcdSend send) {
+    lcdSend = send;
+    for(uint8_t i = 0; i < LCD_CELLS; i++) {
+        want[i] = ' ';
+        shown[i] = ' ';
+    }
+    addr = ADDR_UNKNOWN;
+    next = 0;
+}
+
+void lcdFrameInvalidate() {
+    for(uint8_t i = 0; i < LCD_CELLS; i++)
+        shown[i] = CELL_UNKNOWN;
+    addr = ADDR_UNKNOWN;
+}
+
+void lcdFrameLoad(const char* screen) {
+    for(uint8_t i = 0; i < LCD_CELLS; i++)
+        want[i] = screen[i];
+}
+
+void lcdFrameChar(uint8_t col, uint8_t row, char c) {
+    if(col < LCD_COLS && row < LCD_ROWS)
+        want[cell(col, row)] = c;
+}
+
+void lcdFrameText(uint8_t col, uint8_t row, const char* text) {
+    while(*text && col < LCD_COLS)
+        lcdFrameChar(col++, row, *text++);
+}
+
+uint8_t lcdFrameNumber(uint8_t col, uint8_t row, uint32_t value, uint8_t width, char pad) {
+    uint8_t digits = 1;
+    for(uint32_t v = value; v >= 10; v /= 10)
+        digits++;
+    if(width == 0)
+        width = digits;
+
+    //Fill from the right; digits that don't fit are dropped from the left
+    for(uint8_t n = width; n > 0; n--) {
+        char c = pad;
+        if(width - n < digits) {
+            c = '0' + value % 10;
+            value /= 10;
+        }
+        lcdFrameChar(col + n - 1, row, c);
+    }
+    return col + width;
+}
+
+bool lcdFrameService(uint8_t budget) {
+    for(uint8_t seen = 0; seen < LCD_CELLS; seen++) {
+        uint8_t i = next;
+        if(want[i] == shown[i]) {
+            next = (next + 1) % LCD_CELLS;
+            continue;
+        }
+
+        if(budget == 0)
+            return false;
+
+        //Only move the cursor when the address counter isn't already there
+        if(addr != i) {
+            if(!lcdSend(LCD_SET_DDRAM | ddram(i), false))
+                return false;
+            addr = i;
+            budget--;
+            if(budget == 0)
+                return false;
+        }
+
+        if(!lcdSend(want[i], true))
+            return false;
+        shown[i] = want[i];
+        addr = (i + 1) % LCD_CELLS;     //DDRAM order is the controller's increment order
+        budget--;
+        next = (next + 1) % LCD_CELLS;
+    }
+    return true;
+}
+
+void lcdFrameFlush(void (*service)()) {
+    while(!lcdFrameService(LCD_CELLS * 2)) {
+        if(service)
+            service();
+    }
+}
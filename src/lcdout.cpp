@@ -0,0 +1,125 @@
+#include "lcdout.h"
+#include "twi.h"
+#include "cycles.h"
+
+//PCF8574 pins on the backpack
+#define EXP_RS          0x01
+#define EXP_EN          0x04
+#define EXP_BACKLIGHT   0x08
+
+uint32_t lcdOutResyncs;
+
+static uint8_t lcdAddress;
+static void (*lcdLost)();
+
+//Queued bytes, bit 8 set for characters
+static uint16_t queue[LCD_OUT_QUEUE];
+static uint16_t head, tail;
+
+static bool inFlight;
+static uint16_t settleUs;               //wait after the transfer in flight
+static uint32_t readyAt;                //cyclesNow() when the next transfer may start
+
+//Back into 4-bit mode from any state, then the settings lcd.init() and noCursor() left
+struct ResyncStep {
+    uint8_t value;
+    bool nibble;                        //high nibble only
+    uint16_t settleUs;
+};
+
+static const ResyncStep resync[] = {
+    {0x30, true, 4500},
+    {0x30, true, 150},
+    {0x30, true, 150},
+    {0x20, true, 150},                  //4-bit
+    {0x28, false, 60},                  //2 lines, 5x8
+    {0x0C, false, 60},                  //display on, cursor and blink off
+    {0x06, false, 60},                  //left to right, no shift
+};
+
+#define RESYNC_STEPS    (sizeof(resync) / sizeof(resync[0]))
+
+static uint8_t resyncStep = RESYNC_STEPS;
+
+//E high then low for one nibble (already in bits 4 - 7)
+static uint8_t* putNibble(uint8_t* out, uint8_t nibble, uint8_t flags) {
+    *out++ = nibble | flags | EXP_EN;
+    *out++ = nibble | flags;
+    return out;
+}
+
+static uint8_t* putByte(uint8_t* out, uint8_t value, uint8_t flags) {
+    out = putNibble(out, value & 0xF0, flags);
+    return putNibble(out, value << 4, flags);
+}
+
+static void startResync() {
+    tail = head;
+    resyncStep = 0;
+    readyAt = cyclesNow();
+    lcdOutResyncs++;
+    if(lcdLost)
+        lcdLost();
+}
+
+void lcdOutBegin(uint8_t address, void (*lost)()) {
+    lcdAddress = address;
+    lcdLost = lost;
+    head = tail = 0;
+    inFlight = false;
+    resyncStep = RESYNC_STEPS;
+    readyAt = cyclesNow();
+    twiBegin();
+}
+
+bool lcdOutByte(uint8_t value, bool data) {
+    if((uint16_t)(head - tail) >= LCD_OUT_QUEUE)
+        return false;
+    queue[head & (LCD_OUT_QUEUE - 1)] = value | (data ? 0x100 : 0);
+    head++;
+    return true;
+}
+
+bool lcdOutIdle() {
+    return !inFlight && head == tail && resyncStep == RESYNC_STEPS;
+}
+
+void lcdOutService() {
+    TwiResult r = twiService();
+    if(r == TWI_BUSY)
+        return;
+
+    if(inFlight) {
+        inFlight = false;
+        if(r != TWI_DONE) {
+            startResync();
+            return;
+        }
+        readyAt = cyclesNow() + usToCycles(settleUs);
+    }
+    if((int32_t)(cyclesNow() - readyAt) < 0)
+        return;
+
+    uint8_t buf[LCD_OUT_BATCH * 4];
+    uint8_t* p = buf;
+    settleUs = 0;
+
+    if(resyncStep < RESYNC_STEPS) {
+        const ResyncStep& s = resync[resyncStep++];
+        if(s.nibble)
+            p = putNibble(p, s.value & 0xF0, EXP_BACKLIGHT);
+        else
+            p = putByte(p, s.value, EXP_BACKLIGHT);
+        settleUs = s.settleUs;
+    }
+    else {
+        while(head != tail && p < buf + sizeof(buf)) {
+            uint16_t q = queue[tail & (LCD_OUT_QUEUE - 1)];
+            p = putByte(p, (uint8_t)q, EXP_BACKLIGHT | (q & 0x100 ? EXP_RS : 0));
+            tail++;
+        }
+    }
+
+    if(p != buf)
+        inFlight = twiWrite(lcdAddress, buf, p - buf);
+}
@@ -0,0 +1,84 @@
+#include "macro.h"
+#include "Arduino.h"
+#include <Keyboard.h>
+#include "lcdframe.h"
+
+#define PROGRESS_COL    9
+#define PROGRESS_ROW    2
+
+static const MacroStep* step;           //step being played, 0 = idle
+static const char* typing;              //next character of a MACRO_TYPE
+static bool entered;                    //step's action has been done, waiting it out
+static bool screen;
+static unsigned long stepStart;
+
+bool macroStart(const MacroStep* steps) {
+    if(step)
+        return false;
+    step = steps;
+    entered = false;
+    return true;
+}
+
+bool macroRunning() {
+    return step != 0;
+}
+
+bool macroScreen() {
+    return screen;
+}
+
+void macroService() {
+    if(!step)
+        return;
+
+    unsigned long now = millis();
+
+    if(!entered) {
+        switch(step->action) {
+        case MACRO_END:
+            step = 0;
+            screen = false;
+            return;
+
+        case MACRO_PRESS:
+            Keyboard.press(step->key);
+            break;
+
+        case MACRO_RELEASE_ALL:
+            Keyboard.releaseAll();
+            break;
+
+        case MACRO_TYPE:
+            if(!typing)
+                typing = step->text;
+            if(*typing) {
+                Keyboard.write(*typing++);
+                return;
+            }
+            typing = 0;
+            break;
+
+        case MACRO_SCREEN:
+            lcdFrameLoad(step->text);
+            screen = true;
+            break;
+
+        case MACRO_PROGRESS:
+            break;
+        }
+        entered = true;
+        stepStart = now;
+    }
+
+    if(step->action == MACRO_PROGRESS) {
+        unsigned long elapsed = now - stepStart < step->ms ? now - stepStart : step->ms;
+        byte done = step->ms ? elapsed * 100 / step->ms : 100;
+        lcdFrameChar(lcdFrameNumber(PROGRESS_COL, PROGRESS_ROW, done, 0, ' '), PROGRESS_ROW, '%');
+    }
+
+    if(now - stepStart >= step->ms) {
+        step++;
+        entered = false;
+    }
+}
@@ -21,6 +21,8 @@ Pins 16, 20, 18, 22, 24, 26, and 28 (Arduino pins 62 - 68) (**Arduino Due 47 - 5
 are then scanned to determine which keys are closed. LOW = switch closed. Output on Ch. 1
 Note! the wires running to pins 16, 20, 18, 22, 24, 26, and 28 on the pedal are to be detached from the 
 corresponding pins on the Great and Swell.
+DIN_MIDI_OUT is off by default. Setting it makes Arduino pin 18 TX1 for the DIN MIDI OUT socket, and the
+fifth pedal drive row (Allen pin 68) must then be rewired to Arduino pin 34 (see the README).
 
 Piston inputs for 1,2,3,4,5 and GC are Arduino pins 0 - 5. Output on Ch. 4
 
@@ -30,6 +32,7 @@ Pin 69: Reserved for analog input. The controllerArray values will have to be ed
 reflect the voltage range put out by device device. Connect 15k (+/-) pot across Arduino's
 5V and Ground. Centre tap goes to pin 69.Input must never exceed 5V.
 Note: ***** Unused analog inputs must be grounded to avoid spurious control messages *****
+The swell shoe on A1 works the crescendo instead while pin 35 is grounded.
                 
 Equipment: Arduino Mega with one MIDI shield 
 The connections for the pedal are partially covered by the MIDI shield. Either the MIDI shield can be mounted off 
@@ -45,34 +48,118 @@ the Arduino or right angle connectors can be used to bring out the connections.
 #define version "1.1.2"
 
 #include "Arduino.h"
-#include <USB-MIDI.h>
+#include <MIDIUSB.h>
 #include <Keyboard.h>
 #include <Mouse.h>
 #include <Wire.h>
 #include <Bounce2.h>
-//#include <DueTimer.h>
+#include <DueTimer.h>
 //#include <Scheduler.h>
 #include <LiquidCrystal_I2C.h>
+#include "matrix.h"
+#include "cycles.h"
+#include "debounce.h"
+#include "keyboard.h"
+#include "spsc_ring.h"
+#include "midiout.h"
+#include "midiin.h"
+#include "heldnotes.h"
+#include "scheduler.h"
+#include "idle.h"
+#include "profile.h"
+#include "lcdframe.h"
+#include "lcdout.h"
+#include "macro.h"
+#include "adc.h"
+#include "expression.h"
+#include "combination.h"
+#include "flightrec.h"
+#include "dinout.h"
+#include "transpose.h"
+#include "coupler.h"
 
 // Declarations==========================================
 
 #define MAC_BOOT_TIME		25000	//30 seconds
 #define SAMPLE_LOAD_TIME	45000	//50 seconds
 
+#define SCAN_RATE		1000	//keyboard scans per second (1000 - 2000)
+#define IDLE_AFTER_MS		10000	//quiet time before the matrix is parked (idle.h), 0 = never
+#define LCD_BYTES_PER_PASS	16	//LCD bytes queued per run of taskLcd()
+#define TRANSPOSE_STEP_US	2000	//spacing of the transpose reset's piston notes
+#define EXPRESSION_RATE		100	//most CC updates per second for each analog control
+#define MIDI_IN_BUDGET_US	200	//most time per pass spent on messages from the host
+#ifndef DIN_MIDI_OUT
+#define DIN_MIDI_OUT		0	//MIDI OUT on the DIN socket too (dinout.h); pedal drive row 18 rewired to 34
+#endif
+#ifndef FIRMWARE_TRANSPOSE
+#define FIRMWARE_TRANSPOSE	0	//transpose buttons shift the notes here (transpose.h), not in the host
+#endif
+#ifndef FIRMWARE_COUPLERS
+#define FIRMWARE_COUPLERS	0	//couplers worked here (coupler.h) by pistons 56 - 58, not in the host
+#endif
+#ifndef FIRMWARE_COMBINATIONS
+#define FIRMWARE_COMBINATIONS	0	//general pistons, GC and set worked here (combination.h), not in the host
+#endif
+
+//Task periods in microseconds (see the task table)
+#define PISTON_PERIOD		2000
+#define TRANSPOSE_PERIOD	2000
+#define EXPRESSION_PERIOD	5000
+#define MACRO_PERIOD		5000
+#define HELD_CHECK_PERIOD	20000	//reconnect check and stuck-note watchdog
+#define LCD_PERIOD		1000
+#define DISPLAY_PERIOD		300000
+#define REPORT_PERIOD		10000
+#define COMBO_SAVE_PERIOD	20000
+#define FLIGHT_DUMP_PERIOD	1000
+
 //Counters (old Fortran habit)
 int i, j, k;
 
-unsigned long lastDraw, lastExp, lastScan, trnspReset;
+unsigned long trnspReset;
 
 byte noteStatus;
 //byte noteNumber;        // low C = 36
 byte noteVelocity;
 
-const byte debounceCount = 3;           //Note ON if count > 0, OFF if count = 0
-byte greatDebounceArray [100];          //holds debounce count for each Great switch
-byte swellDebounceArray [100];          //holds debounce count for each Swell switch
-byte pedalDebounceArray [100];         //holds debounce count for each Piston switch
-byte pistonDebounceArray [100];         //holds debounce count for each Piston switch
+//Debounce windows in microseconds {press, release}. Note ON is always immediate; the
+//release must stay open for the release window. The pedal contacts are heavier and bouncier.
+const DebounceConfig manualWindows = {2000, 8000};
+const DebounceConfig pedalWindows  = {4000, 15000};
+const DebounceConfig pistonWindows = {5000, 20000};
+
+//Piston debounce state, bit n = piston n. The divisions keep theirs in Division<>::keys.
+Debouncer pistonKeys;
+
+//Pistons 0 - 5 (direct), 6 - 17 (matrix) and 56 - 58 (direct)
+#define PISTON_KEYS	(0x3FFFFULL | (0x7ULL << 56))
+#define TRANSPOSE_KEYS	((1ULL << 20) | (1ULL << 21))
+
+//Combination action: the matrixed general pistons 1 - 10, GC and set, with FIRMWARE_COMBINATIONS
+#define GENERAL_PISTON	6	//piston keys 6 - 15 = general pistons 1 - 10
+#define CANCEL_PISTON	16
+#define SET_PISTON	17
+#define STOP_CHANNEL	6	//stops as notes (note n = stop n), to and from the host
+#define COUPLER_PISTON	56	//piston keys 56 - 58 = couplers 0 - 2, with FIRMWARE_COUPLERS
+
+uint32_t scanTime;                      //micros() at the start of the current key scan
+uint32_t scanCycles;                    //cyclesNow() at the same point, for latency
+volatile uint32_t wakeCycles;           //cyclesNow() at the idle wake edge, 0 = none pending
+
+//Note event handed from the scan interrupt to loop()
+struct KeyEvent {
+    byte channel;
+    byte note;
+    byte velocity;              //0 = note off
+    uint32_t stamp;             //scanCycles of the scan that saw it
+};
+
+SpscRing<KeyEvent, 128> keyEvents;
+
+//Profile stages and tasks still to be reported over SysEx, bit n = stage / task n
+uint16_t profileRequests;
+uint16_t taskRequests;
 
 const char lcdArray[81] = "  St. John Cantius  "
 			  "Pist:      Trans:   "
@@ -94,6 +181,37 @@ const char lcdLoad2[81] = "                    "
 			  " Loading Organ Files"
 			  "                    ";
 
+//Keystroke macros {action, key, text, ms to wait after}. See macro.h.
+//Bring GrandOrgue to the front: Spotlight, type its name, return
+#define LAUNCH_GRANDORGUE \
+    {MACRO_PRESS, KEY_LEFT_GUI, 0, 10}, \
+    {MACRO_PRESS, ' ', 0, 300}, \
+    {MACRO_RELEASE_ALL, 0, 0, 600}, \
+    {MACRO_TYPE, 0, "GrandOrgue", 700}, \
+    {MACRO_PRESS, KEY_RETURN, 0, 10}, \
+    {MACRO_RELEASE_ALL, 0, 0, 10}
+
+//Panic button: ESC, back to GrandOrgue, ESC
+const MacroStep panicMacro[] = {
+    {MACRO_PRESS, KEY_ESC, 0, 10},
+    {MACRO_RELEASE_ALL, 0, 0, 0},
+    LAUNCH_GRANDORGUE,
+    {MACRO_PRESS, KEY_ESC, 0, 10},
+    {MACRO_RELEASE_ALL, 0, 0, 0},
+    {MACRO_END}
+};
+
+//Power-on: wait for the Mac, start GrandOrgue, wait for the samples to load
+const MacroStep bootMacro[] = {
+    {MACRO_SCREEN, 0, lcdLoad1, 0},
+    {MACRO_PROGRESS, 0, 0, MAC_BOOT_TIME},
+    LAUNCH_GRANDORGUE,
+    {MACRO_SCREEN, 0, lcdLoad2, 0},
+    {MACRO_PROGRESS, 0, 0, SAMPLE_LOAD_TIME},
+    {MACRO_SCREEN, 0, lcdArray, 0},
+    {MACRO_END}
+};
+
 // (C)
 byte newCharCopyright[8] = {
   B11111,
@@ -106,10 +224,26 @@ byte newCharCopyright[8] = {
   B00000
 };
 
-bool stopsState[70];
-
 byte swellPos, crescPos = 0;
 
+//Analog controls ==========================================
+//Sampled together in one ADC sequence. Each is sent as a 14-bit CC pair (cc, cc + 32).
+//{ADC channel, MIDI channel, CC, curve, deadband (14-bit steps), IIR shift}
+//Unused analog inputs must be grounded and left out of the table. A2 - A4 (56 - 58) are
+//direct pistons and A5 - A11 the piston matrix, so the swell shoe also works the
+//crescendo: both inputs sample A1 and pedSwitch picks which one follows it.
+constexpr ExpressionCurve swellCurve = linearCurve(1 << 7, 35 << 7);   //old map(pos, 1, 127, 35, 127)
+constexpr ExpressionCurve straightCurve = linearCurve(0, 0);
+
+enum { SWELL_PEDAL, CRESC_PEDAL };
+
+ExpressionInput expressionInputs[] = {
+    {ADC_CHANNEL_A1, 5, 11, &swellCurve,    24, 2},     //swell
+    {ADC_CHANNEL_A1, 5, 12, &straightCurve, 24, 2},     //crescendo, same shoe
+};
+
+#define EXPRESSION_INPUTS	(sizeof(expressionInputs) / sizeof(expressionInputs[0]))
+
 volatile int transpose = 0;
 volatile byte piston = 0;
 volatile byte noPedal = 0;
@@ -121,10 +255,8 @@ Bounce trnspUp = Bounce();
 Bounce trnspDn = Bounce();
 Bounce2::Button panic = Bounce2::Button();
 
-USBMIDI_CREATE_DEFAULT_INSTANCE();
-
 //Pin definitions
-const byte pedSwitch  = 35;	//switch for changing pedal function LOW = swell HIGH = cresc
+const byte pedSwitch  = 35;	//switch for changing pedal function HIGH (open) = swell LOW = cresc
 const byte pwrSwitch  = 55;	//power switch LOW = off HIGH = on
 const byte trnspUpBtn = 6;	//Transpose pins. keep track 'cause we'll do some transpose features in Arduino
 const byte trnspDnBtn = 7;
@@ -133,35 +265,146 @@ const byte trnspDnLgt = 9;
 const byte panicBtn   = 13;
 const byte initOvride = A0;
 
+//Keyboard matrix ==========================================
+//Drive rows are listed in scan order. The note maps are [drive row][sense line], 0 = not wired.
+//The Great and Swell are wired identically.
+constexpr byte manualNotes[6][11] = {
+    { 0, 37, 43, 49, 55, 61, 67, 73, 79, 85, 91},
+    { 0, 38, 44, 50, 56, 62, 68, 74, 80, 86, 92},
+    { 0, 39, 45, 51, 57, 63, 69, 75, 81, 87, 93},
+    { 0, 40, 46, 52, 58, 64, 70, 76, 82, 88, 94},
+    { 0, 41, 47, 53, 59, 65, 71, 77, 83, 89, 95},
+    {36, 42, 48, 54, 60, 66, 72, 78, 84, 90, 96}    //bottom C
+};
+
+constexpr byte pedalNotes[6][7] = {
+    { 0, 37, 43, 49, 55, 61, 67},
+    { 0, 38, 44, 50, 56, 62,  0},
+    { 0, 39, 45, 51, 57, 63,  0},
+    { 0, 40, 46, 52, 58, 64,  0},
+    { 0, 41, 47, 53, 59, 65,  0},
+    {36, 42, 48, 54, 60, 66,  0}                    //bottom C
+};
+
+typedef Pins<22, 23, 24, 25, 26, 27> SwellDrive;
+typedef Pins<28, 29, 30, 31, 32, 33> GreatDrive;
+#if DIN_MIDI_OUT
+typedef Pins<14, 15, 16, 17, 34, 19> PedalDrive;     //18 is TX1
+#else
+typedef Pins<14, 15, 16, 17, 18, 19> PedalDrive;
+#endif
+typedef Pins<36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46> ManualSense;
+typedef Pins<47, 48, 49, 50, 51, 52, 53> PedalSense;
+
+typedef Division<SwellDrive, ManualSense, manualNotes, 1> Swell;
+typedef Division<GreatDrive, ManualSense, manualNotes, 2> Great;
+typedef Division<PedalDrive, PedalSense,  pedalNotes,  3> Pedal;
+
+//Couplers (coupler.h), in piston order
+const CouplerDef couplers[] = {
+    {Swell::channel, Great::channel},       //Swell to Great
+    {Swell::channel, Pedal::channel},       //Swell to Pedal
+    {Great::channel, Pedal::channel},       //Great to Pedal
+};
+
+#define COUPLERS	(sizeof(couplers) / sizeof(couplers[0]))
+
+//Outputs fed from the MIDI queue (midiout.h)
+const MidiSink midiSinks[] = {
+    {midiOutUsbSend, midiOutConnected, true},
+#if DIN_MIDI_OUT
+    {dinOutSend, dinOutConnected, false},
+#endif
+};
+
+//Lamps the host drives with notes 20 - 22 (pins 10 - 12), written once per drain
+PortWrite lampWrite;
+
 //Function declarations
 //void loop1();
 void initializeComputer();
 void scanKeys();
+void wakeScan();
+void sendKeyEvents();
+void sendProfile();
+void lcdFlush();
+bool postNote(byte channel, byte pitch, byte velocity);
 void scanGreat();
 void scanGreatAndPedal();
-void turnOFFgreat(byte noteNumber);
-void turnONgreat(byte noteNumber);
 void scanSwell();
-void turnOFFswell(byte noteNumber);
-void turnONswell(byte noteNumber);
 void scanPedal();
-void turnOFFpedal(byte noteNumber);
-void turnONpedal(byte noteNumber);
+bool emitPiston(uint8_t key, bool on);
+bool emitCoupled(uint8_t channel, uint8_t key, bool on, uint32_t stamp);
+bool sendStop(uint8_t stop, bool on);
 void scanPistons();
 void scanTranspose();
-void turnOFFpiston(byte noteNumber);
-void turnONpiston(byte noteNumber);
 void scanExpression();
-void noteOff(byte channel, byte pitch, byte velocity);
-void noteOn(byte channel, byte pitch, byte velocity);
-void controlChange(byte channel, byte control, byte value);
-void OnMidiSysEx(byte* data, unsigned length);
+byte pedalFunction();
+bool noteOff(byte channel, byte pitch, byte velocity);
+bool noteOn(byte channel, byte pitch, byte velocity);
+bool controlChange(byte channel, byte control, byte value);
+void sysExTranspose(const byte* args, uint8_t length);
+void sysExProfile(const byte* args, uint8_t length);
+void sysExProfileReset(const byte* args, uint8_t length);
+void sysExComboLevel(const byte* args, uint8_t length);
+void sysExResync(const byte* args, uint8_t length);
+void sysExTasks(const byte* args, uint8_t length);
+void sysExFlight(const byte* args, uint8_t length);
+void sysExCoupler(const byte* args, uint8_t length);
+void taskMidiIn();
+void taskFlush();
+void taskTranspose();
+void taskMacro();
+void taskHeldNotes();
+void taskLcd();
+void taskDisplay();
 void OnNoteOn(byte channel, byte note, byte velocity);
 void OnNoteOff(byte channel, byte note, byte velocity);
 void drawDisplay();
 void lights();
+void setTranspose(int value);
 byte countDigits(int num);
 
+//Messages from the host (midiin.h). SysEx commands follow F0 <id> <id>.
+const SysExCommand sysExCommands[] = {
+    {0x01, sysExTranspose},
+    {0x02, sysExProfile},
+    {0x03, sysExProfileReset},
+    {0x04, sysExComboLevel},
+    {0x05, sysExResync},
+    {0x06, sysExTasks},
+    {0x07, sysExFlight},
+    {0x08, sysExCoupler},
+};
+
+const MidiInHandlers midiInHandlers = {{
+    OnNoteOff,            //MIDI_IN_NOTE_OFF
+    OnNoteOn,             //MIDI_IN_NOTE_ON
+}};
+
+//Everything loop() does (scheduler.h). The key scan isn't here: it runs from Timer3.
+//{task, period us (0 = every round), budget us, priority, profile stage}
+const Task tasks[] = {
+    {taskMidiIn,     0,                 MIDI_IN_BUDGET_US + 50, TASK_URGENT, PROF_MIDI_READ},
+    {sendKeyEvents,  0,                 100,    TASK_URGENT, PROF_SEND_KEYS},
+    {taskFlush,      0,                 100,    TASK_URGENT, PROF_FLUSH},
+    {scanPistons,    PISTON_PERIOD,     150,    TASK_NORMAL, PROF_PISTONS},
+    {taskTranspose,  TRANSPOSE_PERIOD,  50,     TASK_NORMAL, PROF_TRANSPOSE},
+    {scanExpression, EXPRESSION_PERIOD, 100,    TASK_NORMAL, PROF_EXPRESSION},
+    {taskMacro,      MACRO_PERIOD,      200,    TASK_NORMAL, PROF_STAGES},
+    {taskHeldNotes,  HELD_CHECK_PERIOD, 100,    TASK_NORMAL, PROF_STAGES},
+    {taskLcd,        LCD_PERIOD,        200,    TASK_IDLE,   PROF_LCD},
+    {taskDisplay,    DISPLAY_PERIOD,    500,    TASK_IDLE,   PROF_DISPLAY},
+    {sendProfile,    REPORT_PERIOD,     50,     TASK_IDLE,   PROF_STAGES},
+#if FIRMWARE_COMBINATIONS
+    {comboService,   COMBO_SAVE_PERIOD, 100,    TASK_IDLE,   PROF_STAGES},
+#endif
+    {flightDumpService, FLIGHT_DUMP_PERIOD, 200, TASK_IDLE,  PROF_STAGES},
+};
+
+#define TASKS	(sizeof(tasks) / sizeof(tasks[0]))
+static_assert(TASKS <= SCHED_MAX_TASKS, "too many tasks for the scheduler");
+
 
 //Initialize =========================================================
 void setup() {
@@ -174,9 +417,17 @@ void setup() {
     }
     
     for(i = 14; i < 20; i++) {
+#if DIN_MIDI_OUT
+        if(i == 18)
+            continue;           //TX1, left to USART0
+#endif
         pinMode (i, OUTPUT);  
         digitalWrite (i, HIGH);
     }
+#if DIN_MIDI_OUT
+    pinMode (34, OUTPUT);
+    digitalWrite (34, HIGH);
+#endif
     
     for(i = 59; i < 62; i++) {
         pinMode (i, OUTPUT);  
@@ -209,15 +460,13 @@ void setup() {
         pinMode (i, INPUT_PULLUP);
     }
         
-    //Initialize debounce count arrays to zero
-    for(i= 0; i < 100; i++) {
-        greatDebounceArray[i] = 0;
-        swellDebounceArray[i] = 0;
-        pedalDebounceArray[i] = 0;
-        pistonDebounceArray[i] = 0; 
-    }
+    //Initialize debounce state
+    Great::begin(manualWindows);
+    Swell::begin(manualWindows);
+    Pedal::begin(pedalWindows);
+    debounceBegin(pistonKeys, pistonWindows);
 
-    //pinMode(pedSwitch, INPUT_PULLUP);
+    pinMode(pedSwitch, INPUT_PULLUP);
     //pinMode(pwrSwitch, INPUT_PULLUP);
     pinMode(trnspUpBtn, INPUT_PULLUP);
     pinMode(trnspDnBtn, INPUT_PULLUP);
@@ -226,9 +475,37 @@ void setup() {
     pinMode(trnspUpLgt, OUTPUT);
     pinMode(trnspDnLgt, OUTPUT);
 
+    cyclesBegin();
+#if FIRMWARE_COMBINATIONS
+    comboBegin();
+#endif
+    //Resync the keyboards and pistons; the stop channel is left to the host
+    heldNotesBegin((1 << (Great::channel - 1)) | (1 << (Swell::channel - 1)) |
+                   (1 << (Pedal::channel - 1)) | (1 << (5 - 1)));
+    transposeBegin((1 << (Great::channel - 1)) | (1 << (Swell::channel - 1)) |
+                   (1 << (Pedal::channel - 1)));
+    couplerBegin((1 << (Great::channel - 1)) | (1 << (Swell::channel - 1)) |
+                 (1 << (Pedal::channel - 1)), couplers, COUPLERS, emitCoupled);
+    uint16_t adcChannels = 0;
+    for(i = 0; i < (int)EXPRESSION_INPUTS; i++) {
+        ExpressionInput& in = expressionInputs[i];
+        expressionBegin(in.filter, in.deadband, in.shift);
+        in.sent = 0xFFFF;
+        adcChannels |= 1 << in.adcChannel;
+    }
+    adcBegin(adcChannels);
+    profileReset();
+
     Keyboard.begin();
     Mouse.begin();
 
+    //Every message goes to USB and, without holding USB up, to the DIN socket
+#if DIN_MIDI_OUT
+    Serial1.begin(DIN_BAUD);
+    dinOutBegin();
+#endif
+    midiOutBegin(midiSinks, sizeof(midiSinks) / sizeof(midiSinks[0]));
+
     trnspUp.attach(trnspUpBtn);
     trnspUp.interval(6);
     trnspDn.attach(trnspDnBtn);
@@ -243,39 +520,55 @@ void setup() {
     lcd.init();
     lcd.backlight();
     lcd.createChar(0, newCharCopyright);
-    
-    lcd.setCursor(0,0);
-    lcd.print(lcdLoad0);
-    lcd.setCursor(0,2);
-    lcd.write(byte(0));
     lcd.noCursor();
+
+    //From here on the LCD is written without blocking (twi.h, lcdout.h)
+    lcdOutBegin(0x27, lcdFrameInvalidate);
+    lcdFrameBegin(lcdOutByte);
+
+    lcdFrameLoad(lcdLoad0);
+    lcdFrameChar(0, 2, 0);      //(C)
+    lcdFlush();
     delay(4000);
 
+    lcdFrameLoad(lcdArray);
+    lcdFlush();
+
     //Check for power off reset to initialise computer
     if(digitalRead(initOvride) == 0) {
         initializeComputer();
     }
 
-    lcd.setCursor(0,0);
-    lcd.print(lcdArray);
-    lcd.noCursor();
-
-    MIDI.begin(1);
-    MIDI.setHandleSystemExclusive(OnMidiSysEx);
-    MIDI.setHandleNoteOn(OnNoteOn);
-    MIDI.setHandleNoteOff(OnNoteOff);
+    midiInBegin(&midiInHandlers, sysExCommands, sizeof(sysExCommands) / sizeof(sysExCommands[0]));
 
-    //Timer3.attachInterrupt(scanKeys);
-    //Timer3.start(4000); // Calls every 2.5ms 400x/sec (400Hz)
+    //Park the matrix when nobody is playing; any sense line going LOW wakes the scan.
+    //The wake runs at the scan's priority so neither can interrupt the other.
+    for(i = 36; i < 54; i++)
+        attachInterrupt(i, wakeScan, FALLING);
+    DriveRow rows = SwellDrive::masks(), sense = ManualSense::masks();
+    for(i = 0; i < PORT_COUNT; i++) {
+        rows.mask[i] |= GreatDrive::masks().mask[i] | PedalDrive::masks().mask[i];
+        sense.mask[i] |= PedalSense::masks().mask[i];
+    }
+    idleBegin(rows, sense, IDLE_AFTER_MS * 1000UL);
+    flightBegin(sense);
+    NVIC_SetPriority(PIOA_IRQn, 8);
+    NVIC_SetPriority(PIOB_IRQn, 8);
+    NVIC_SetPriority(PIOC_IRQn, 8);
+
+    //Scan from a timer interrupt so the scan rate doesn't depend on what loop() is doing.
+    //Keep it below the USB interrupt so it can't hold off the host.
+    Timer3.attachInterrupt(scanKeys);
+    Timer3.setFrequency(SCAN_RATE);
+    NVIC_SetPriority(TC3_IRQn, 8);
+    Timer3.start();
+
+    schedBegin(tasks, TASKS);
 }
 
 //Main Loops ===========================================================
 void loop() {
-  trnspUp.update();
-  trnspDn.update();
-  panic.update();
-
-  MIDI.read();
+  uint32_t loopStart = cyclesNow();
 
   //power on mac
   //loop until confirmation message / for certain time
@@ -286,70 +579,149 @@ void loop() {
   //while(1) {
     //update lcd
 
-  if((micros() - lastScan) > 4000) {
-    scanKeys();
-    lastScan = micros();
-  }
+  //one round of whatever in the task table is due
+  schedRun();
 
-  if((millis() - lastDraw) > 300) {
-    drawDisplay();
-    lights();
-    lastDraw = millis();
-    //yield();
-  }
-    //manage stops
-  scanPistons(); 
-  scanTranspose();
+  profileEnd(PROF_LOOP, loopStart);
+}
 
-    //scanGreatAndPedal();
-    //scanSwell();
+//Tasks ================================================================
+void taskMidiIn() {
+  midiInService(usToCycles(MIDI_IN_BUDGET_US));
+  portWriteApply(lampWrite);
+}
 
-  //yield();
-    //manage pedal
-  if((millis() - lastExp) > 400) {
-    scanExpression();
-    lastExp = millis();
-    //yield();
-  }
+//send whatever the other tasks queued
+void taskFlush() {
+  midiOutFlush();
+}
+
+void taskTranspose() {
+  trnspUp.update();
+  trnspDn.update();
+  scanTranspose();
+}
 
+void taskMacro() {
+  panic.update();
   if(panic.pressed()) {
-    //send 'ESC'
-    Keyboard.press(KEY_ESC);
-    delay(10);
-    Keyboard.releaseAll();
-
-    //Switch to GrandOrgue App
-    Keyboard.press(KEY_LEFT_GUI);
-    delay(10);
-    Keyboard.press(' ');
-    delay(300);
-    Keyboard.releaseAll();
-    delay(600);
-    Keyboard.print("GrandOrgue");
-    delay(700);
-    Keyboard.press(KEY_RETURN);
-    delay(10);
-    Keyboard.releaseAll();
-    delay(10);
-
-    //send 'ESC'
-    Keyboard.press(KEY_ESC);
-    delay(10);
-    Keyboard.releaseAll();
+    flightFreeze(FLIGHT_PANIC);         //keep whatever made the organist reach for it
+    macroStart(panicMacro);
   }
+  macroService();
+}
+
+//tell the host what's sounding after a reconnect, and clear notes it's left holding
+void taskHeldNotes() {
+  heldNotesService();
+  uint32_t now = micros();
+  heldNotesWatch(Great::channel, transposeSounding(Great::channel), manualWindows.releaseUs, now);
+  heldNotesWatch(Swell::channel, transposeSounding(Swell::channel), manualWindows.releaseUs, now);
+  heldNotesWatch(Pedal::channel, transposeSounding(Pedal::channel), pedalWindows.releaseUs, now);
+}
 
+//send a few of the changed LCD cells
+void taskLcd() {
+  lcdFrameService(LCD_BYTES_PER_PASS);
+  lcdOutService();
 }
 
+void taskDisplay() {
+  if(!macroScreen())
+    drawDisplay();
+  lights();
+}
+
+//Runs in the Timer3 interrupt at SCAN_RATE. Note events go to keyEvents for loop() to send.
 void scanKeys() {
+    uint32_t start = cyclesNow();
+    if(wakeCycles) {
+        profileRecord(PROF_WAKE, start - wakeCycles);
+        scanCycles = wakeCycles;            //time the first notes from the key going down
+        wakeCycles = 0;
+    }
+    else {
+        profileScanTick(start, F_CPU / SCAN_RATE);
+        scanCycles = start | 1;             //0 means "not timed" to midiOutMessage
+    }
+    scanTime = micros();
+    flightScan(scanTime);
     if(!noPedal) {
         scanGreatAndPedal();
     }
     else {
         scanGreat();
-        delayMicroseconds(150);
     }
     scanSwell();
-    yield();
+    profileEnd(PROF_SCAN, start);
+
+    bool busy = Great::keys.sounding | Great::keys.releasing |
+                Swell::keys.sounding | Swell::keys.releasing |
+                Pedal::keys.sounding | Pedal::keys.releasing;
+    if(idleCheck(busy, scanTime)) {
+        Timer3.stop();
+        profileScanPause();
+    }
+}
+
+//Sense line interrupt: a key went down while the matrix was parked. Scan now rather
+//than a scan period from now.
+void wakeScan() {
+    uint32_t now = cyclesNow();
+    if(!idleWake())
+        return;
+    wakeCycles = now | 1;
+    Timer3.start();
+    NVIC_SetPendingIRQ(TC3_IRQn);
+}
+
+//Queue a note event from the scan interrupt. Returns false if the ring is full, in which
+//case the caller leaves its state alone so the same change is retried on the next scan.
+bool postNote(byte channel, byte pitch, byte velocity) {
+    KeyEvent e = {channel, pitch, velocity, scanCycles};
+    return keyEvents.push(e);
+}
+
+//Move everything the scan interrupt has queued into the USB-MIDI output and send it
+//as one transfer. If the host is behind, events wait in keyEvents until there is room.
+//Keys go through the couplers in batches, then become notes through the transposer.
+void sendKeyEvents() {
+    KeyEvent e;
+    while(couplerSend() && keyEvents.peek(e)) {
+        while(keyEvents.peek(e) && couplerKey(e.channel, e.note - 36, e.velocity, e.stamp))
+            keyEvents.pop(e);
+    }
+    midiOutFlush();
+}
+
+//Coupler output: a division's key as the host should hear it
+bool emitCoupled(uint8_t channel, uint8_t key, bool on, uint32_t stamp) {
+    if(midiOutSpace() == 0)
+        return false;
+    byte note = on ? transposeOn(channel, 36 + key) : transposeOff(channel, 36 + key);
+    if(note != TRANSPOSE_NONE)
+        midiOutMessage((on ? 0x90 : 0x80) | (channel - 1), note, on ? 127 : 0, stamp);
+    return true;
+}
+
+//Send the profile and task reports asked for over SysEx, one per call as output space allows
+void sendProfile() {
+    if(profileRequests) {
+        byte report[PROFILE_REPORT_BYTES];
+        uint8_t stage = __builtin_ctz(profileRequests);
+        //sendKeyEvents() drains keyEvents, so its report carries the ring's counters
+        bool ring = stage == PROF_SEND_KEYS;
+        uint16_t length = profileReport(stage, report, ring ? keyEvents.highWatermark() : 0,
+                                        ring ? keyEvents.overflows() : 0);
+        if(midiOutSysEx(report, length))
+            profileRequests &= ~(1U << stage);
+    }
+    else if(taskRequests) {
+        byte report[SCHED_REPORT_BYTES];
+        uint8_t task = __builtin_ctz(taskRequests);
+        if(midiOutSysEx(report, schedReport(task, report)))
+            taskRequests &= ~(1U << task);
+    }
 }
 
 /*void loop1() {
@@ -362,45 +734,9 @@ void scanKeys() {
     yield();
 }*/
 
+//Boot the computer and start GrandOrgue (bootMacro). Scanning carries on meanwhile.
 void initializeComputer() {
-    lcd.setCursor(0,0);
-    lcd.print(lcdLoad1);
-    char displayLine[5];
-    unsigned long initTime = millis();
-    while((millis() - initTime) < MAC_BOOT_TIME) {
-        lcd.setCursor(9,2);
-        byte time = map((millis() - initTime), 0, MAC_BOOT_TIME, 0, 100);
-        sprintf(displayLine, "%d%%", time);
-        lcd.print(displayLine);
-        delay(400);
-    }
-
-    Keyboard.press(KEY_LEFT_GUI);
-    delay(10);
-    Keyboard.press(' ');
-    delay(300);
-    Keyboard.releaseAll();
-    delay(600);
-    Keyboard.print("GrandOrgue");
-    delay(700);
-    Keyboard.press(KEY_RETURN);
-    delay(10);
-    Keyboard.releaseAll();
-
-    lcd.setCursor(0,0);
-    lcd.print(lcdLoad2);
-    initTime = millis();
-    while((millis() - initTime) < SAMPLE_LOAD_TIME) {
-        lcd.setCursor(9,2);
-        byte time = map((millis() - initTime), 0, SAMPLE_LOAD_TIME, 0, 100);
-        sprintf(displayLine, "%d%%", time);
-        lcd.print(displayLine);
-        delay(500);
-        //if(loaded)
-            //break;
-    }
-
-    //while(!loaded);
+    macroStart(bootMacro);
 }
         
 
@@ -408,619 +744,334 @@ void initializeComputer() {
 
 //Scan Great keyboard, convert to MIDI and output via port 0, channel 2.
 void scanGreat() {
-     digitalWrite (28, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (37);} else {turnOFFgreat (37);}
-     if  (digitalRead(38) == LOW) {turnONgreat (43);} else {turnOFFgreat (43);}
-     if  (digitalRead(39) == LOW) {turnONgreat (49);} else {turnOFFgreat (49);}
-     if  (digitalRead(40) == LOW) {turnONgreat (55);} else {turnOFFgreat (55);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (61);} else {turnOFFgreat (61);}
-     if  (digitalRead(42) == LOW) {turnONgreat (67);} else {turnOFFgreat (67);}
-     if  (digitalRead(43) == LOW) {turnONgreat (73);} else {turnOFFgreat (73);}
-     if  (digitalRead(44) == LOW) {turnONgreat (79);} else {turnOFFgreat (79);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (85);} else {turnOFFgreat (85);}
-     if  (digitalRead(46) == LOW) {turnONgreat (91);} else {turnOFFgreat (91);} 
-     digitalWrite (28, HIGH); 
-     digitalWrite (29, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (38);} else {turnOFFgreat (38);}
-     if  (digitalRead(38) == LOW) {turnONgreat (44);} else {turnOFFgreat (44);}
-     if  (digitalRead(39) == LOW) {turnONgreat (50);} else {turnOFFgreat (50);}
-     if  (digitalRead(40) == LOW) {turnONgreat (56);} else {turnOFFgreat (56);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (62);} else {turnOFFgreat (62);}
-     if  (digitalRead(42) == LOW) {turnONgreat (68);} else {turnOFFgreat (68);}
-     if  (digitalRead(43) == LOW) {turnONgreat (74);} else {turnOFFgreat (74);}
-     if  (digitalRead(44) == LOW) {turnONgreat (80);} else {turnOFFgreat (80);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (86);} else {turnOFFgreat (86);}
-     if  (digitalRead(46) == LOW) {turnONgreat (92);} else {turnOFFgreat (92);} 
-     digitalWrite (29, HIGH); 
-     digitalWrite (30, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (39);} else {turnOFFgreat (39);}
-     if  (digitalRead(38) == LOW) {turnONgreat (45);} else {turnOFFgreat (45);}
-     if  (digitalRead(39) == LOW) {turnONgreat (51);} else {turnOFFgreat (51);}
-     if  (digitalRead(40) == LOW) {turnONgreat (57);} else {turnOFFgreat (57);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (63);} else {turnOFFgreat (63);}
-     if  (digitalRead(42) == LOW) {turnONgreat (69);} else {turnOFFgreat (69);}
-     if  (digitalRead(43) == LOW) {turnONgreat (75);} else {turnOFFgreat (75);}
-     if  (digitalRead(44) == LOW) {turnONgreat (81);} else {turnOFFgreat (81);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (87);} else {turnOFFgreat (87);}
-     if  (digitalRead(46) == LOW) {turnONgreat (93);} else {turnOFFgreat (93);} 
-     digitalWrite (30, HIGH); 
-     digitalWrite (31, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (40);} else {turnOFFgreat (40);}
-     if  (digitalRead(38) == LOW) {turnONgreat (46);} else {turnOFFgreat (46);}
-     if  (digitalRead(39) == LOW) {turnONgreat (52);} else {turnOFFgreat (52);}
-     if  (digitalRead(40) == LOW) {turnONgreat (58);} else {turnOFFgreat (58);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (64);} else {turnOFFgreat (64);}
-     if  (digitalRead(42) == LOW) {turnONgreat (70);} else {turnOFFgreat (70);}
-     if  (digitalRead(43) == LOW) {turnONgreat (76);} else {turnOFFgreat (76);}
-     if  (digitalRead(44) == LOW) {turnONgreat (82);} else {turnOFFgreat (82);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (88);} else {turnOFFgreat (88);}
-     if  (digitalRead(46) == LOW) {turnONgreat (94);} else {turnOFFgreat (94);} 
-     digitalWrite (31, HIGH); 
-     digitalWrite (32, LOW);  
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (41);} else {turnOFFgreat (41);}
-     if  (digitalRead(38) == LOW) {turnONgreat (47);} else {turnOFFgreat (47);}
-     if  (digitalRead(39) == LOW) {turnONgreat (53);} else {turnOFFgreat (53);}
-     if  (digitalRead(40) == LOW) {turnONgreat (59);} else {turnOFFgreat (59);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (65);} else {turnOFFgreat (65);}
-     if  (digitalRead(42) == LOW) {turnONgreat (71);} else {turnOFFgreat (71);}
-     if  (digitalRead(43) == LOW) {turnONgreat (77);} else {turnOFFgreat (77);}
-     if  (digitalRead(44) == LOW) {turnONgreat (83);} else {turnOFFgreat (83);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (89);} else {turnOFFgreat (89);}
-     if  (digitalRead(46) == LOW) {turnONgreat (95);} else {turnOFFgreat (95);} 
-     digitalWrite (32, HIGH); 
-     digitalWrite (33, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(36) == LOW) {turnONgreat (36);} else {turnOFFgreat (36);}   //bottom C
-     if  (digitalRead(37) == LOW) {turnONgreat (42);} else {turnOFFgreat (42);}
-     if  (digitalRead(38) == LOW) {turnONgreat (48);} else {turnOFFgreat (48);}
-     if  (digitalRead(39) == LOW) {turnONgreat (54);} else {turnOFFgreat (54);}
-     if  (digitalRead(40) == LOW) {turnONgreat (60);} else {turnOFFgreat (60);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (66);} else {turnOFFgreat (66);}
-     if  (digitalRead(42) == LOW) {turnONgreat (72);} else {turnOFFgreat (72);}
-     if  (digitalRead(43) == LOW) {turnONgreat (78);} else {turnOFFgreat (78);}
-     if  (digitalRead(44) == LOW) {turnONgreat (84);} else {turnOFFgreat (84);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (90);} else {turnOFFgreat (90);}
-     if  (digitalRead(46) == LOW) {turnONgreat (96);} else {turnOFFgreat (96);} 
-     digitalWrite (33, HIGH);   
-     delayMicroseconds(17);
+    Scanner<Great>::run();
 }
 
 //Scan Great keyboard nad pedal, convert to MIDI
+//The Great and Pedal rows are driven together and read from the same port sample.
 void scanGreatAndPedal() {
-     digitalWrite (28, LOW);    
-     digitalWrite (14, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (37);} else {turnOFFgreat (37);}
-     if  (digitalRead(38) == LOW) {turnONgreat (43);} else {turnOFFgreat (43);}
-     if  (digitalRead(39) == LOW) {turnONgreat (49);} else {turnOFFgreat (49);}
-     if  (digitalRead(40) == LOW) {turnONgreat (55);} else {turnOFFgreat (55);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (61);} else {turnOFFgreat (61);}
-     if  (digitalRead(42) == LOW) {turnONgreat (67);} else {turnOFFgreat (67);}
-     if  (digitalRead(43) == LOW) {turnONgreat (73);} else {turnOFFgreat (73);}
-     if  (digitalRead(44) == LOW) {turnONgreat (79);} else {turnOFFgreat (79);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (85);} else {turnOFFgreat (85);}
-     if  (digitalRead(46) == LOW) {turnONgreat (91);} else {turnOFFgreat (91);} 
-     if  (digitalRead(48) == LOW) {turnONpedal (37);} else {turnOFFpedal (37);}
-     if  (digitalRead(49) == LOW) {turnONpedal (43);} else {turnOFFpedal (43);}
-     if  (digitalRead(50) == LOW) {turnONpedal (49);} else {turnOFFpedal (49);}
-     if  (digitalRead(51) == LOW) {turnONpedal (55);} else {turnOFFpedal (55);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (61);} else {turnOFFpedal (61);}
-     if  (digitalRead(53) == LOW) {turnONpedal (67);} else {turnOFFpedal (67);}
-     digitalWrite (28, HIGH); 
-     digitalWrite (29, LOW);    
-     digitalWrite (14, HIGH); 
-     digitalWrite (15, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (38);} else {turnOFFgreat (38);}
-     if  (digitalRead(38) == LOW) {turnONgreat (44);} else {turnOFFgreat (44);}
-     if  (digitalRead(39) == LOW) {turnONgreat (50);} else {turnOFFgreat (50);}
-     if  (digitalRead(40) == LOW) {turnONgreat (56);} else {turnOFFgreat (56);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (62);} else {turnOFFgreat (62);}
-     if  (digitalRead(42) == LOW) {turnONgreat (68);} else {turnOFFgreat (68);}
-     if  (digitalRead(43) == LOW) {turnONgreat (74);} else {turnOFFgreat (74);}
-     if  (digitalRead(44) == LOW) {turnONgreat (80);} else {turnOFFgreat (80);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (86);} else {turnOFFgreat (86);}
-     if  (digitalRead(46) == LOW) {turnONgreat (92);} else {turnOFFgreat (92);} 
-     if  (digitalRead(48) == LOW) {turnONpedal (38);} else {turnOFFpedal (38);}
-     if  (digitalRead(49) == LOW) {turnONpedal (44);} else {turnOFFpedal (44);}
-     if  (digitalRead(50) == LOW) {turnONpedal (50);} else {turnOFFpedal (50);}
-     if  (digitalRead(51) == LOW) {turnONpedal (56);} else {turnOFFpedal (56);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (62);} else {turnOFFpedal (62);}
-     digitalWrite (29, HIGH); 
-     digitalWrite (30, LOW);    
-     digitalWrite (15, HIGH); 
-     digitalWrite (16, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (39);} else {turnOFFgreat (39);}
-     if  (digitalRead(38) == LOW) {turnONgreat (45);} else {turnOFFgreat (45);}
-     if  (digitalRead(39) == LOW) {turnONgreat (51);} else {turnOFFgreat (51);}
-     if  (digitalRead(40) == LOW) {turnONgreat (57);} else {turnOFFgreat (57);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (63);} else {turnOFFgreat (63);}
-     if  (digitalRead(42) == LOW) {turnONgreat (69);} else {turnOFFgreat (69);}
-     if  (digitalRead(43) == LOW) {turnONgreat (75);} else {turnOFFgreat (75);}
-     if  (digitalRead(44) == LOW) {turnONgreat (81);} else {turnOFFgreat (81);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (87);} else {turnOFFgreat (87);}
-     if  (digitalRead(46) == LOW) {turnONgreat (93);} else {turnOFFgreat (93);} 
-     if  (digitalRead(48) == LOW) {turnONpedal (39);} else {turnOFFpedal (39);}
-     if  (digitalRead(49) == LOW) {turnONpedal (45);} else {turnOFFpedal (45);}
-     if  (digitalRead(50) == LOW) {turnONpedal (51);} else {turnOFFpedal (51);}
-     if  (digitalRead(51) == LOW) {turnONpedal (57);} else {turnOFFpedal (57);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (63);} else {turnOFFpedal (63);}
-     digitalWrite (30, HIGH); 
-     digitalWrite (31, LOW);    
-     digitalWrite (16, HIGH); 
-     digitalWrite (17, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (40);} else {turnOFFgreat (40);}
-     if  (digitalRead(38) == LOW) {turnONgreat (46);} else {turnOFFgreat (46);}
-     if  (digitalRead(39) == LOW) {turnONgreat (52);} else {turnOFFgreat (52);}
-     if  (digitalRead(40) == LOW) {turnONgreat (58);} else {turnOFFgreat (58);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (64);} else {turnOFFgreat (64);}
-     if  (digitalRead(42) == LOW) {turnONgreat (70);} else {turnOFFgreat (70);}
-     if  (digitalRead(43) == LOW) {turnONgreat (76);} else {turnOFFgreat (76);}
-     if  (digitalRead(44) == LOW) {turnONgreat (82);} else {turnOFFgreat (82);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (88);} else {turnOFFgreat (88);}
-     if  (digitalRead(46) == LOW) {turnONgreat (94);} else {turnOFFgreat (94);} 
-     if  (digitalRead(48) == LOW) {turnONpedal (40);} else {turnOFFpedal (40);}
-     if  (digitalRead(49) == LOW) {turnONpedal (46);} else {turnOFFpedal (46);}
-     if  (digitalRead(50) == LOW) {turnONpedal (52);} else {turnOFFpedal (52);}
-     if  (digitalRead(51) == LOW) {turnONpedal (58);} else {turnOFFpedal (58);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (64);} else {turnOFFpedal (64);}
-     digitalWrite (31, HIGH); 
-     digitalWrite (32, LOW);  
-     digitalWrite (17, HIGH); 
-     digitalWrite (18, LOW);  
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONgreat (41);} else {turnOFFgreat (41);}
-     if  (digitalRead(38) == LOW) {turnONgreat (47);} else {turnOFFgreat (47);}
-     if  (digitalRead(39) == LOW) {turnONgreat (53);} else {turnOFFgreat (53);}
-     if  (digitalRead(40) == LOW) {turnONgreat (59);} else {turnOFFgreat (59);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (65);} else {turnOFFgreat (65);}
-     if  (digitalRead(42) == LOW) {turnONgreat (71);} else {turnOFFgreat (71);}
-     if  (digitalRead(43) == LOW) {turnONgreat (77);} else {turnOFFgreat (77);}
-     if  (digitalRead(44) == LOW) {turnONgreat (83);} else {turnOFFgreat (83);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (89);} else {turnOFFgreat (89);}
-     if  (digitalRead(46) == LOW) {turnONgreat (95);} else {turnOFFgreat (95);} 
-     if  (digitalRead(48) == LOW) {turnONpedal (41);} else {turnOFFpedal (41);}
-     if  (digitalRead(49) == LOW) {turnONpedal (47);} else {turnOFFpedal (47);}
-     if  (digitalRead(50) == LOW) {turnONpedal (53);} else {turnOFFpedal (53);}
-     if  (digitalRead(51) == LOW) {turnONpedal (59);} else {turnOFFpedal (59);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (65);} else {turnOFFpedal (65);}
-     digitalWrite (32, HIGH); 
-     digitalWrite (33, LOW);    
-     digitalWrite (18, HIGH); 
-     digitalWrite (19, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(36) == LOW) {turnONgreat (36);} else {turnOFFgreat (36);}   //bottom C
-     if  (digitalRead(37) == LOW) {turnONgreat (42);} else {turnOFFgreat (42);}
-     if  (digitalRead(38) == LOW) {turnONgreat (48);} else {turnOFFgreat (48);}
-     if  (digitalRead(39) == LOW) {turnONgreat (54);} else {turnOFFgreat (54);}
-     if  (digitalRead(40) == LOW) {turnONgreat (60);} else {turnOFFgreat (60);}     
-     if  (digitalRead(41) == LOW) {turnONgreat (66);} else {turnOFFgreat (66);}
-     if  (digitalRead(42) == LOW) {turnONgreat (72);} else {turnOFFgreat (72);}
-     if  (digitalRead(43) == LOW) {turnONgreat (78);} else {turnOFFgreat (78);}
-     if  (digitalRead(44) == LOW) {turnONgreat (84);} else {turnOFFgreat (84);} 
-     if  (digitalRead(45) == LOW) {turnONgreat (90);} else {turnOFFgreat (90);}
-     if  (digitalRead(46) == LOW) {turnONgreat (96);} else {turnOFFgreat (96);} 
-     if  (digitalRead(47) == LOW) {turnONpedal (36);} else {turnOFFpedal (36);}   //bottom C
-     if  (digitalRead(48) == LOW) {turnONpedal (42);} else {turnOFFpedal (42);}
-     if  (digitalRead(49) == LOW) {turnONpedal (48);} else {turnOFFpedal (48);}
-     if  (digitalRead(50) == LOW) {turnONpedal (54);} else {turnOFFpedal (54);}
-     if  (digitalRead(51) == LOW) {turnONpedal (60);} else {turnOFFpedal (60);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (66);} else {turnOFFpedal (66);}
-     digitalWrite (33, HIGH);   
-     digitalWrite (19, HIGH);   
-     delayMicroseconds(17);
-}
-
-//MIDI ON message is sent only if note is not already ON.
-void turnONgreat(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(greatDebounceArray[noteNumber] == 0) {
-            noteOn(2, noteNumber, 127);
-            greatDebounceArray[noteNumber] = debounceCount;
-        }   
-    }
-}
-
-//MIDI OFF message is sent only if note is not already OFF.
-void turnOFFgreat(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(greatDebounceArray[noteNumber] == 1) {
-            noteOff(2, noteNumber, 0);
-        }  
-
-        if(greatDebounceArray[noteNumber] > 0)
-	    greatDebounceArray[noteNumber] -- ;
-    }
+    Scanner<Great, Pedal>::run();
 }
 
 //Scan Swell keyboard, convert to MIDI and output via port 0, channel 3.
 void scanSwell () {
-     digitalWrite (22, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONswell (37);} else {turnOFFswell (37);}
-     if  (digitalRead(38) == LOW) {turnONswell (43);} else {turnOFFswell (43);}
-     if  (digitalRead(39) == LOW) {turnONswell (49);} else {turnOFFswell (49);}
-     if  (digitalRead(40) == LOW) {turnONswell (55);} else {turnOFFswell (55);}     
-     if  (digitalRead(41) == LOW) {turnONswell (61);} else {turnOFFswell (61);}
-     if  (digitalRead(42) == LOW) {turnONswell (67);} else {turnOFFswell (67);}
-     if  (digitalRead(43) == LOW) {turnONswell (73);} else {turnOFFswell (73);}
-     if  (digitalRead(44) == LOW) {turnONswell (79);} else {turnOFFswell (79);} 
-     if  (digitalRead(45) == LOW) {turnONswell (85);} else {turnOFFswell (85);}
-     if  (digitalRead(46) == LOW) {turnONswell (91);} else {turnOFFswell (91);} 
-     digitalWrite (22, HIGH); 
-     digitalWrite (23, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONswell (38);} else {turnOFFswell (38);}
-     if  (digitalRead(38) == LOW) {turnONswell (44);} else {turnOFFswell (44);}
-     if  (digitalRead(39) == LOW) {turnONswell (50);} else {turnOFFswell (50);}
-     if  (digitalRead(40) == LOW) {turnONswell (56);} else {turnOFFswell (56);}     
-     if  (digitalRead(41) == LOW) {turnONswell (62);} else {turnOFFswell (62);}
-     if  (digitalRead(42) == LOW) {turnONswell (68);} else {turnOFFswell (68);}
-     if  (digitalRead(43) == LOW) {turnONswell (74);} else {turnOFFswell (74);}
-     if  (digitalRead(44) == LOW) {turnONswell (80);} else {turnOFFswell (80);} 
-     if  (digitalRead(45) == LOW) {turnONswell (86);} else {turnOFFswell (86);}
-     if  (digitalRead(46) == LOW) {turnONswell (92);} else {turnOFFswell (92);} 
-     digitalWrite (23, HIGH); 
-     digitalWrite (24, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONswell (39);} else {turnOFFswell (39);}
-     if  (digitalRead(38) == LOW) {turnONswell (45);} else {turnOFFswell (45);}
-     if  (digitalRead(39) == LOW) {turnONswell (51);} else {turnOFFswell (51);}
-     if  (digitalRead(40) == LOW) {turnONswell (57);} else {turnOFFswell (57);}     
-     if  (digitalRead(41) == LOW) {turnONswell (63);} else {turnOFFswell (63);}
-     if  (digitalRead(42) == LOW) {turnONswell (69);} else {turnOFFswell (69);}
-     if  (digitalRead(43) == LOW) {turnONswell (75);} else {turnOFFswell (75);}
-     if  (digitalRead(44) == LOW) {turnONswell (81);} else {turnOFFswell (81);} 
-     if  (digitalRead(45) == LOW) {turnONswell (87);} else {turnOFFswell (87);}
-     if  (digitalRead(46) == LOW) {turnONswell (93);} else {turnOFFswell (93);} 
-     digitalWrite (24, HIGH); 
-     digitalWrite (25, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONswell (40);} else {turnOFFswell (40);}
-     if  (digitalRead(38) == LOW) {turnONswell (46);} else {turnOFFswell (46);}
-     if  (digitalRead(39) == LOW) {turnONswell (52);} else {turnOFFswell (52);}
-     if  (digitalRead(40) == LOW) {turnONswell (58);} else {turnOFFswell (58);}     
-     if  (digitalRead(41) == LOW) {turnONswell (64);} else {turnOFFswell (64);}
-     if  (digitalRead(42) == LOW) {turnONswell (70);} else {turnOFFswell (70);}
-     if  (digitalRead(43) == LOW) {turnONswell (76);} else {turnOFFswell (76);}
-     if  (digitalRead(44) == LOW) {turnONswell (82);} else {turnOFFswell (82);} 
-     if  (digitalRead(45) == LOW) {turnONswell (88);} else {turnOFFswell (88);}
-     if  (digitalRead(46) == LOW) {turnONswell (94);} else {turnOFFswell (94);} 
-     digitalWrite (25, HIGH); 
-     digitalWrite (26, LOW);  
-     delayMicroseconds(17);
-     if  (digitalRead(37) == LOW) {turnONswell (41);} else {turnOFFswell (41);}
-     if  (digitalRead(38) == LOW) {turnONswell (47);} else {turnOFFswell (47);}
-     if  (digitalRead(39) == LOW) {turnONswell (53);} else {turnOFFswell (53);}
-     if  (digitalRead(40) == LOW) {turnONswell (59);} else {turnOFFswell (59);}     
-     if  (digitalRead(41) == LOW) {turnONswell (65);} else {turnOFFswell (65);}
-     if  (digitalRead(42) == LOW) {turnONswell (71);} else {turnOFFswell (71);}
-     if  (digitalRead(43) == LOW) {turnONswell (77);} else {turnOFFswell (77);}
-     if  (digitalRead(44) == LOW) {turnONswell (83);} else {turnOFFswell (83);} 
-     if  (digitalRead(45) == LOW) {turnONswell (89);} else {turnOFFswell (89);}
-     if  (digitalRead(46) == LOW) {turnONswell (95);} else {turnOFFswell (95);} 
-     digitalWrite (26, HIGH); 
-     digitalWrite (27, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(36) == LOW) {turnONswell (36);} else {turnOFFswell (36);}   //bottom C
-     if  (digitalRead(37) == LOW) {turnONswell (42);} else {turnOFFswell (42);}
-     if  (digitalRead(38) == LOW) {turnONswell (48);} else {turnOFFswell (48);}
-     if  (digitalRead(39) == LOW) {turnONswell (54);} else {turnOFFswell (54);}
-     if  (digitalRead(40) == LOW) {turnONswell (60);} else {turnOFFswell (60);}     
-     if  (digitalRead(41) == LOW) {turnONswell (66);} else {turnOFFswell (66);}
-     if  (digitalRead(42) == LOW) {turnONswell (72);} else {turnOFFswell (72);}
-     if  (digitalRead(43) == LOW) {turnONswell (78);} else {turnOFFswell (78);}
-     if  (digitalRead(44) == LOW) {turnONswell (84);} else {turnOFFswell (84);} 
-     if  (digitalRead(45) == LOW) {turnONswell (90);} else {turnOFFswell (90);}
-     if  (digitalRead(46) == LOW) {turnONswell (96);} else {turnOFFswell (96);} 
-     digitalWrite (27, HIGH);   
-     delayMicroseconds(17);
-}
-
-//MIDI ON message is sent only if note is not already ON.
-void turnONswell(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(swellDebounceArray[noteNumber] == 0) {
-            noteOn(1, noteNumber, 127);
-            swellDebounceArray[noteNumber] = debounceCount;
-        }   
-    }
-}
-
-//MIDI OFF message is sent only if note is not already OFF.
-void turnOFFswell(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(swellDebounceArray[noteNumber] == 1) {
-            noteOff(1, noteNumber, 0);
-        }  
-        if(swellDebounceArray[noteNumber] > 0)
-	    swellDebounceArray[noteNumber] -- ;       
-    }
+    Scanner<Swell>::run();
 }
 
 //Scan Pedal, convert to MIDI and output via port 0, channel 1.
 void scanPedal() {
-     digitalWrite (14, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(48) == LOW) {turnONpedal (37);} else {turnOFFpedal (37);}
-     if  (digitalRead(49) == LOW) {turnONpedal (43);} else {turnOFFpedal (43);}
-     if  (digitalRead(50) == LOW) {turnONpedal (49);} else {turnOFFpedal (49);}
-     if  (digitalRead(51) == LOW) {turnONpedal (55);} else {turnOFFpedal (55);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (61);} else {turnOFFpedal (61);}
-     if  (digitalRead(53) == LOW) {turnONpedal (67);} else {turnOFFpedal (67);}
-     digitalWrite (14, HIGH); 
-     digitalWrite (15, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(48) == LOW) {turnONpedal (38);} else {turnOFFpedal (38);}
-     if  (digitalRead(49) == LOW) {turnONpedal (44);} else {turnOFFpedal (44);}
-     if  (digitalRead(50) == LOW) {turnONpedal (50);} else {turnOFFpedal (50);}
-     if  (digitalRead(51) == LOW) {turnONpedal (56);} else {turnOFFpedal (56);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (62);} else {turnOFFpedal (62);}
-     digitalWrite (15, HIGH); 
-     digitalWrite (16, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(48) == LOW) {turnONpedal (39);} else {turnOFFpedal (39);}
-     if  (digitalRead(49) == LOW) {turnONpedal (45);} else {turnOFFpedal (45);}
-     if  (digitalRead(50) == LOW) {turnONpedal (51);} else {turnOFFpedal (51);}
-     if  (digitalRead(51) == LOW) {turnONpedal (57);} else {turnOFFpedal (57);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (63);} else {turnOFFpedal (63);}
-     digitalWrite (16, HIGH); 
-     digitalWrite (17, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(48) == LOW) {turnONpedal (40);} else {turnOFFpedal (40);}
-     if  (digitalRead(49) == LOW) {turnONpedal (46);} else {turnOFFpedal (46);}
-     if  (digitalRead(50) == LOW) {turnONpedal (52);} else {turnOFFpedal (52);}
-     if  (digitalRead(51) == LOW) {turnONpedal (58);} else {turnOFFpedal (58);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (64);} else {turnOFFpedal (64);}
-     digitalWrite (17, HIGH); 
-     digitalWrite (18, LOW);  
-     delayMicroseconds(17);
-     if  (digitalRead(48) == LOW) {turnONpedal (41);} else {turnOFFpedal (41);}
-     if  (digitalRead(49) == LOW) {turnONpedal (47);} else {turnOFFpedal (47);}
-     if  (digitalRead(50) == LOW) {turnONpedal (53);} else {turnOFFpedal (53);}
-     if  (digitalRead(51) == LOW) {turnONpedal (59);} else {turnOFFpedal (59);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (65);} else {turnOFFpedal (65);}
-     digitalWrite (18, HIGH); 
-     digitalWrite (19, LOW);    
-     delayMicroseconds(17);
-     if  (digitalRead(47) == LOW) {turnONpedal (36);} else {turnOFFpedal (36);}   //bottom C
-     if  (digitalRead(48) == LOW) {turnONpedal (42);} else {turnOFFpedal (42);}
-     if  (digitalRead(49) == LOW) {turnONpedal (48);} else {turnOFFpedal (48);}
-     if  (digitalRead(50) == LOW) {turnONpedal (54);} else {turnOFFpedal (54);}
-     if  (digitalRead(51) == LOW) {turnONpedal (60);} else {turnOFFpedal (60);}     
-     if  (digitalRead(52) == LOW) {turnONpedal (66);} else {turnOFFpedal (66);}
-     digitalWrite (19, HIGH);   
-}
-
-//MIDI ON message is sent only if note is not already ON.
-void turnONpedal(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(pedalDebounceArray[noteNumber] == 0) {
-            noteOn(3, noteNumber, 127);
-            pedalDebounceArray[noteNumber] = debounceCount;
-        }
-    }
-}
-
-//MIDI OFF message is sent only if note is not already OFF.
-void turnOFFpedal(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(pedalDebounceArray[noteNumber] == 1) {
-            noteOff(3, noteNumber, 0);
-        }
-        if(pedalDebounceArray[noteNumber] > 0)
-	    pedalDebounceArray[noteNumber] -- ;
-    }
+    Scanner<Pedal>::run();
 }
 
 void scanPistons() {  
+    uint64_t frame = 0;
+
     for (j = 0; j < 6; j++) {
-        if(digitalRead(j) == LOW) {turnONpiston (j);} else {turnOFFpiston (j);} 
+        if(digitalRead(j) == LOW) frame |= 1ULL << j;
     }    
 
     for (j = 56; j < 59; j++) {
-        if(digitalRead(j) == LOW) {turnONpiston (j);} else {turnOFFpiston (j);} 
+        if(digitalRead(j) == LOW) frame |= 1ULL << j;
     }    
 
-    digitalWrite (59, LOW);  
-    //delay(1);
-    delayMicroseconds(17);
-    if  (digitalRead(62) == LOW) {turnONpiston (6);} else {turnOFFpiston (6);}
-    if  (digitalRead(63) == LOW) {turnONpiston (7);} else {turnOFFpiston (7);}
-    if  (digitalRead(64) == LOW) {turnONpiston (8);} else {turnOFFpiston (8);}
-    if  (digitalRead(65) == LOW) {turnONpiston (9);} else {turnOFFpiston (9);}     
-    digitalWrite (59, HIGH); 
-    digitalWrite (60, LOW);    
-    //delay(1);
-    delayMicroseconds(17);
-    if  (digitalRead(62) == LOW) {turnONpiston (10);} else {turnOFFpiston (10);}
-    if  (digitalRead(63) == LOW) {turnONpiston (11);} else {turnOFFpiston (11);}
-    if  (digitalRead(64) == LOW) {turnONpiston (12);} else {turnOFFpiston (12);}
-    if  (digitalRead(65) == LOW) {turnONpiston (13);} else {turnOFFpiston (13);}     
-    digitalWrite (60, HIGH); 
-    digitalWrite (61, LOW);    
-    //delay(1);
-    delayMicroseconds(17);
-    if  (digitalRead(62) == LOW) {turnONpiston (14);} else {turnOFFpiston (14);}
-    if  (digitalRead(63) == LOW) {turnONpiston (15);} else {turnOFFpiston (15);}
-    if  (digitalRead(64) == LOW) {turnONpiston (16);} else {turnOFFpiston (16);}
-    if  (digitalRead(65) == LOW) {turnONpiston (17);} else {turnOFFpiston (17);}     
-    digitalWrite (61, HIGH); 
-        
+    //Pistons 6 - 17: drive 59 - 61 LOW in turn, read 62 - 65
+    for (j = 0; j < 3; j++) {
+        digitalWrite (59 + j, LOW);  
+        delayMicroseconds(17);
+        for (k = 0; k < 4; k++) {
+            if(digitalRead(62 + k) == LOW) frame |= 1ULL << (6 + 4 * j + k);
+        }
+        digitalWrite (59 + j, HIGH); 
+    }
+
+    debounceUpdate(pistonKeys, frame, PISTON_KEYS, micros(), emitPiston);
 }
 
 void scanTranspose() {
     byte value1 = trnspUp.read();
     byte value2 = trnspDn.read();
-    int dir;
 
     if((millis() - trnspReset) > 800) {
         if(value1 == LOW && value2 == LOW) {
+#if FIRMWARE_TRANSPOSE
+            setTranspose(0);
+            trnspReset = millis();
+#else
             //reset transpose
+            int dir;
             if(transpose > 0)
                 dir = 0;
             else
                 dir = 1;
 
-            for(j = 0; j < abs(transpose); j++) {
-                noteOn(5, 20 + dir, 127);
-                delay(2);
-                noteOff(5, 20 + dir, 0);
-                delay(2);
+            //One transpose step per note pair, paced out behind the key traffic.
+            //If the paced queue can't take them all, try again next pass.
+            int steps = abs(transpose);
+            if(midiOutPacedSpace() >= 2 * steps) {
+                for(j = 0; j < steps; j++) {
+                    midiOutPaced(0x90 | (5 - 1), 20 + dir, 127, TRANSPOSE_STEP_US);
+                    midiOutPaced(0x80 | (5 - 1), 20 + dir, 0, TRANSPOSE_STEP_US);
+                }
+                trnspReset = millis();
             }
-            trnspReset = millis();
+#endif
         }
         else {
-            if(value1 == LOW) {turnONpiston(20);} else {turnOFFpiston(20);}
-            if(value2 == LOW) {turnONpiston(21);} else {turnOFFpiston(21);}
+            uint64_t frame = 0;
+            if(value1 == LOW) frame |= 1ULL << 20;
+            if(value2 == LOW) frame |= 1ULL << 21;
+            debounceUpdate(pistonKeys, frame, TRANSPOSE_KEYS, micros(), emitPiston);
         }
     }
 }
 
-//MIDI ON message is sent only if note is not already ON.
-void turnONpiston(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(pistonDebounceArray[noteNumber] == 0) {
-            noteOn(5, noteNumber, 127);
-            pistonDebounceArray[noteNumber] = debounceCount;
-        }   
+//Piston debouncer output, bit n = piston n. The general pistons, GC and set work the
+//combination action here (FIRMWARE_COMBINATIONS); the rest go to the host as note n on
+//channel 5.
+bool emitPiston(uint8_t key, bool on) {
+#if FIRMWARE_COMBINATIONS
+    if(key >= GENERAL_PISTON && key < GENERAL_PISTON + COMBO_PISTONS) {
+        if(!on)
+            return true;
+        if(pistonKeys.sounding & (1ULL << SET_PISTON)) {
+            comboSet(key - GENERAL_PISTON);
+            return true;
+        }
+        //All the stop changes go in one burst; if they don't fit yet, retry next scan
+        if(!comboRecall(key - GENERAL_PISTON, midiOutSpace(), sendStop))
+            return false;
+        piston = key - GENERAL_PISTON + 1;
+        return true;
     }
-}
+    if(key == CANCEL_PISTON)
+        return on ? comboCancel(midiOutSpace(), sendStop) : true;
+    if(key == SET_PISTON)
+        return true;
+#endif
+#if FIRMWARE_COUPLERS
+    if(key >= COUPLER_PISTON && key < COUPLER_PISTON + COUPLERS) {
+        if(on)
+            couplerSet(key - COUPLER_PISTON, !couplerEngaged(key - COUPLER_PISTON));
+        return true;
+    }
+#endif
+#if FIRMWARE_TRANSPOSE
+    if(TRANSPOSE_KEYS & (1ULL << key)) {
+        if(on)
+            setTranspose(transpose + (key == 20 ? 1 : -1));
+        return true;
+    }
+#endif
 
-//MIDI OFF message is sent only if note is not already OFF.
-void turnOFFpiston(byte noteNumber) {
-    if(noteNumber < 100) {
-        if(pistonDebounceArray[noteNumber] == 1) {
-            noteOff(5, noteNumber, 0);
-        }  
+    if(on)
+        return noteOn(5, key, 127);
+    return noteOff(5, key, 0);
+}
 
-        if(pistonDebounceArray[noteNumber] > 0)
-            pistonDebounceArray[noteNumber] -- ;
-    }
+bool sendStop(uint8_t stop, bool on) {
+    if(on)
+        return noteOn(STOP_CHANNEL, stop, 127);
+    return noteOff(STOP_CHANNEL, stop, 0);
 }
 
+//Filter each new block of samples from the ADC, and send every analog control that
+//moved as its 14-bit CC pair, at most EXPRESSION_RATE times a second each
 void scanExpression() {
-    byte newCrescPos, newSwellPos;
-    //if(digitalRead(pedSwitch)) {
-        newSwellPos = analogRead(A1) >> 3;
-    //}
-    //else {
-    //    newCrescPos = map(analogRead(A1), PED_MIN, PED_MAX, 0, 127);
-    //}
-
-    //if(newSwellPos > (swellPos + 1) || newSwellPos < (swellPos - 1)) {
-    if(newSwellPos != swellPos) {
-        //send swell info
-        controlChange(5, 11, map(newSwellPos, 1, 127, 35, 127));
-        swellPos = newSwellPos;
+    AdcBlock block;
+    bool fresh = adcRead(block);
+    unsigned long now = millis();
+    byte shoe = pedalFunction();
+
+    for(byte n = 0; n < EXPRESSION_INPUTS; n++) {
+        ExpressionInput& in = expressionInputs[n];
+        //The shoe's other job stays where it was left
+        bool follows = n == shoe || (n != SWELL_PEDAL && n != CRESC_PEDAL);
+        if(fresh && follows)
+            in.value = expressionUpdate(in.filter, adcMean14(block, in.adcChannel));
+
+        if(!in.filter.primed || (now - in.sentAt) < 1000 / EXPRESSION_RATE)
+            continue;
+
+        uint16_t cc = curveApply(*in.curve, in.value);
+        if(cc != in.sent && midiOutSpace() >= 2) {
+            controlChange(in.midiChannel, in.cc, cc >> 7);
+            controlChange(in.midiChannel, in.cc + 32, cc & 0x7F);
+            in.sent = cc;
+            in.sentAt = now;
+        }
     }
 
-    /*if(crescPos != newCrescPos) {
-        //send cresc info
-        controlChange(5, 12, newCrescPos);
-        crescPos = newCrescPos;
-    }*/
+    swellPos = expressionInputs[SWELL_PEDAL].value >> 7;
+    crescPos = expressionInputs[CRESC_PEDAL].value >> 7;
+}
 
+//What the swell shoe works: the swell, or the crescendo while pedSwitch is closed
+byte pedalFunction() {
+    return digitalRead(pedSwitch) ? SWELL_PEDAL : CRESC_PEDAL;
 }
 
-void noteOn(byte channel, byte pitch, byte velocity) {
-  //midiEventPacket_t noteOn = {0x09, 0x90 | channel, pitch, velocity};
-  //MidiUSB.sendMIDI(noteOn);
-  delayMicroseconds(80);
-  MIDI.sendNoteOn(pitch, velocity, channel);
-  yield();
+//Messages are queued for the next midiOutFlush(). Channels are 1 - 16.
+//Returns false if the output queue is full.
+bool noteOn(byte channel, byte pitch, byte velocity) {
+  return midiOutMessage(0x90 | (channel - 1), pitch, velocity);
 }
 
-void noteOff(byte channel, byte pitch, byte velocity) {
-  //midiEventPacket_t noteOff = {0x08, 0x80 | channel, pitch, velocity};
-  //MidiUSB.sendMIDI(noteOff);
-  delayMicroseconds(80);
-  MIDI.sendNoteOff(pitch, velocity, channel);
-  yield();
+bool noteOff(byte channel, byte pitch, byte velocity) {
+  return midiOutMessage(0x80 | (channel - 1), pitch, velocity);
 }
 
-void controlChange(byte channel, byte control, byte value) {
-  //midiEventPacket_t event = {0x0B, 0xB0 | channel, control, value};
-  //MidiUSB.sendMIDI(event);
-  delayMicroseconds(20);
-  MIDI.sendControlChange(control, value, channel);
+bool controlChange(byte channel, byte control, byte value) {
+  return midiOutMessage(0xB0 | (channel - 1), control, value);
 }
 
-void OnMidiSysEx(byte* data, unsigned length) {
-  //Signal to the rest of the program that GrandOrgue is loaded
-  //if(!loaded)
-    //loaded = 1;
+//SysEx from the host, F0 <id> <id> <command> <args> F7 (see midiin.h)
+//Transpose as ASCII text, e.g. "-2" or "+3". Anything else is ignored, as is all of it
+//when the firmware transposes: the host's own transposition is then left at 0.
+void sysExTranspose(const byte* args, uint8_t length) {
+#if !FIRMWARE_TRANSPOSE
+  uint8_t n = 0;
+  bool negative = false;
+  int value = 0;
+
+  if(length > 3)
+    length = 3;
+  while(n < length && args[n] == ' ')
+    n++;
+  if(n < length && (args[n] == '-' || args[n] == '+'))
+    negative = args[n++] == '-';
+  if(n == length)
+    return;
+  for(; n < length; n++) {
+    if(args[n] < '0' || args[n] > '9')
+      return;
+    value = value * 10 + args[n] - '0';
+  }
+  transpose = negative ? -value : value;
+#endif
+}
 
-  char buf[4] = {0};
+//Profile query: stage, or 0x7F for all of them
+void sysExProfile(const byte* args, uint8_t length) {
+  if(length < 1)
+    return;
+  if(args[0] == 0x7F)
+    profileRequests = (1U << PROF_STAGES) - 1;
+  else if(args[0] < PROF_STAGES)
+    profileRequests |= 1U << args[0];
+}
 
-  if(data[3] == 0x01) {	//Message we're looking for is hex 0x01
-    memcpy(&buf, &data[4], 3);
-    transpose = atoi(buf);
-  }
+void sysExProfileReset(const byte* args, uint8_t length) {
+  profileReset();
+  keyEvents.resetStats();
+  schedReset();
+}
+
+//Combination memory level
+void sysExComboLevel(const byte* args, uint8_t length) {
+#if FIRMWARE_COMBINATIONS
+  if(length >= 1 && args[0] < COMBO_LEVELS)
+    comboLevel = args[0];
+#endif
+}
+
+//Host lost track (e.g. GrandOrgue restarted): All Notes Off, then what's held
+void sysExResync(const byte* args, uint8_t length) {
+  heldNotesResync();
+}
+
+//Coupler: coupler (piston order), then 0 = off, 1 = on
+void sysExCoupler(const byte* args, uint8_t length) {
+#if FIRMWARE_COUPLERS
+  if(length >= 2)
+    couplerSet(args[0], args[1]);
+#endif
+}
+
+//Task query: task, or 0x7F for all of them
+void sysExTasks(const byte* args, uint8_t length) {
+  if(length < 1)
+    return;
+  if(args[0] == 0x7F)
+    taskRequests = (1U << TASKS) - 1;
+  else if(args[0] < TASKS)
+    taskRequests |= 1U << args[0];
+}
+
+//Flight recorder (flightrec.h): 0 = freeze, 1 = freeze and dump, 2 = resume recording
+void sysExFlight(const byte* args, uint8_t length) {
+  if(length < 1)
+    return;
+  if(args[0] == 0)
+    flightFreeze(FLIGHT_SYSEX);
+  else if(args[0] == 1)
+    flightDumpStart();
+  else if(args[0] == 2)
+    flightResume();
 }
 
 void OnNoteOn(byte channel, byte note, byte velocity) {
+#if FIRMWARE_COMBINATIONS
+    if(channel == STOP_CHANNEL) {
+        comboStopChanged(note, true);
+        return;
+    }
+#endif
+
     if(note < 15)
         piston = note;
     else if(note >= 20 && note <= 22)
-        digitalWrite(note - 10, HIGH);
+        portWritePin(lampWrite, note - 10, true);
 
     if(note == 20)
         noPedal = 1;
 }
 
 void OnNoteOff(byte channel, byte note, byte velocity) {
+#if FIRMWARE_COMBINATIONS
+    if(channel == STOP_CHANNEL) {
+        comboStopChanged(note, false);
+        return;
+    }
+#endif
+
     if(note >= 20 && note <= 22)
-        digitalWrite(note - 10, LOW);
+        portWritePin(lampWrite, note - 10, false);
 
     if(note == 20)
         noPedal = 0;
 }
 
+//Update the LCD frame. Only what changed goes out, from lcdFrameService() in loop().
 void drawDisplay() {
-        lcd.setCursor(9, 3);
-        lcd.print("<-");
-    /*if(digitalRead(pedSwitch)) {
-        swellPos = analogRead(A1) >> 3;
-        lcd.setCursor(9, 3);
-        lcd.print("<-");
-    }
-    else {
-        crescPos = analogRead(A1) >> 3;
-        lcd.setCursor(9, 3);
-        lcd.print("->");
-    }*/
+    lcdFrameText(9, 3, pedalFunction() == SWELL_PEDAL ? "<-" : "->");
 
     //lcd.setCursor((8 - countDigits(swellPos)), 3);
-    char displayValue[4];
-
-    sprintf(displayValue, "%03d", swellPos);
-    lcd.setCursor(5, 3);
-    lcd.print(displayValue);
+    lcdFrameNumber(5, 3, swellPos, 3, '0');
     //lcd.setCursor((20 - countDigits(crescPos)), 3);
+    lcdFrameNumber(17, 3, crescPos, 3, '0');
 
-    sprintf(displayValue, "%03d", crescPos);
-    lcd.setCursor(17, 3);
-    lcd.print(displayValue);
+    lcdFrameNumber(5, 2, piston, 2, '0');
 
-    lcd.setCursor(5, 2);
-    if(countDigits(piston) == 1)
-        lcd.print('0');
-    lcd.print(piston);
+    int trnsp = transpose;
+    if(trnsp < 0) {lcdFrameChar(17, 2, '-');} else {lcdFrameChar(17, 2, '+');}
+    byte col = lcdFrameNumber(18, 2, abs(trnsp), 0, ' ');
+    if(countDigits(trnsp) == 1)
+        lcdFrameChar(col, 2, ' ');
+}
 
-    lcd.setCursor(17, 2);
-    if(transpose < 0) {lcd.print('-');} else {lcd.print('+');}
-    lcd.print(abs(transpose));
-    if(countDigits(transpose) == 1)
-        lcd.print(' ');
-    lcd.noCursor();
+//Get the whole frame onto the display before carrying on (start-up screens)
+void lcdFlush() {
+    lcdFrameFlush(lcdOutService);
+    while(!lcdOutIdle())
+        lcdOutService();
+}
+
+//Shift what's played from here on; held notes keep theirs. The lamps follow at once,
+//the LCD on its next redraw.
+void setTranspose(int value) {
+    transposeSet(value);
+    transpose = transposeOffset();
+    lights();
 }
 
 void lights() {
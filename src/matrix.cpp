@@ -0,0 +1,33 @@
+#include "matrix.h"
+#include "cycles.h"
+#include "flightrec.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+PioRegs* pioPorts[PORT_COUNT] = {PIOA, PIOB, PIOC, PIOD};
+#else
+PioRegs* pioPorts[PORT_COUNT];
+#endif
+
+//Pipelined scan: drive row N, and while it settles process the sample latched from
+//row N-1. The settle wait only covers whatever time the processing didn't use, so the
+//per-row work (flight recording, debounce, diff, event queueing) is hidden behind the
+//RC settle time.
+void matrixScan(const ScanStep* steps, uint8_t count) {
+    SenseSample sense = {{0, 0, 0}};
+    for(uint8_t n = 0; n <= count; n++) {
+        uint32_t settled = 0;
+        if(n < count) {
+            matrixDrive(steps[n].drive);
+            settled = cyclesNow() + usToCycles(ROW_SETTLE_US);
+        }
+        if(n > 0) {
+            flightRow(sense);
+            steps[n - 1].process(sense);
+        }
+        if(n < count) {
+            cyclesWaitUntil(settled);
+            sense = matrixSense();
+            matrixRelease(steps[n].drive);
+        }
+    }
+}
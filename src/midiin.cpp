@@ -0,0 +1,132 @@
+#include "midiin.h"
+#include <MIDIUSB.h>
+#include "cycles.h"
+
+#define MIDI_IN_BANK	64	//bytes in one endpoint bank
+
+uint32_t midiInSysExDropped;
+
+static const MidiInHandlers* handlers;
+static const SysExCommand* commands;
+static uint8_t commandCount;
+
+//SysEx in progress
+static struct {
+    uint8_t pos;                //bytes seen so far including F0, 0 = not in a message
+    byte command;
+    byte args[MIDI_IN_SYSEX_ARGS];
+    uint8_t length;
+    bool overflow;
+} sysEx;
+
+#if defined(ARDUINO_ARCH_SAM)
+//As in midiout.cpp: read MIDIUSB's protected endpoint number through a derived class
+struct MidiEndpoint : MIDI_ {
+    static uint8_t rx() {
+        return MidiUSB.*(&MidiEndpoint::pluggedEndpoint);
+    }
+};
+
+//Take what is left of the current bank; the core frees the bank once it is empty
+static uint32_t receive(uint8_t* data, uint32_t len) {
+    if(!USBDevice.configured() || !USBD_Available(MidiEndpoint::rx()))
+        return 0;
+    return USBD_Recv(MidiEndpoint::rx(), data, len);
+}
+#else
+static uint32_t receive(uint8_t* data, uint32_t len) {
+    return hostMidiRecv(data, len);
+}
+#endif
+
+void midiInBegin(const MidiInHandlers* h, const SysExCommand* c, uint8_t count) {
+    handlers = h;
+    commands = c;
+    commandCount = count;
+    sysEx.pos = 0;
+}
+
+static void sysExEnd() {
+    sysEx.pos = 0;
+    if(!sysEx.overflow) {
+        for(uint8_t n = 0; n < commandCount; n++) {
+            if(commands[n].command == sysEx.command) {
+                commands[n].run(sysEx.args, sysEx.length);
+                return;
+            }
+        }
+    }
+    midiInSysExDropped++;
+}
+
+static void sysExByte(byte b) {
+    if(b == 0xF0) {
+        sysEx.pos = 1;
+        sysEx.length = 0;
+        sysEx.overflow = false;
+        return;
+    }
+    if(!sysEx.pos)
+        return;
+    if(b == 0xF7) {
+        if(sysEx.pos > 3)
+            sysExEnd();
+        sysEx.pos = 0;
+        return;
+    }
+    if(b & 0x80) {              //any other status byte abandons the message
+        sysEx.pos = 0;
+        return;
+    }
+
+    if(sysEx.pos < 3)           //ID bytes
+        sysEx.pos++;
+    else if(sysEx.pos == 3) {
+        sysEx.command = b;
+        sysEx.pos++;
+    }
+    else if(sysEx.length < MIDI_IN_SYSEX_ARGS)
+        sysEx.args[sysEx.length++] = b;
+    else
+        sysEx.overflow = true;
+}
+
+static void dispatch(const uint8_t* p) {
+    uint8_t cin = p[0] & 0x0F;
+
+    if(cin >= 0x08 && cin <= 0x0E) {
+        //The status must be the one the CIN says, which also keeps type in the table.
+        //Anything else is a malformed packet and goes no further.
+        if((p[1] >> 4) != cin)
+            return;
+        uint8_t type = cin - 0x08;
+        if(type == MIDI_IN_NOTE_ON && p[3] == 0)
+            type = MIDI_IN_NOTE_OFF;
+        MidiInHandler h = handlers->voice[type];
+        if(h)
+            h((p[1] & 0x0F) + 1, p[2], p[3]);
+    }
+    else if(cin >= 0x04 && cin <= 0x07) {
+        //SysEx starts or continues (3 bytes), or ends with 1, 2 or 3 bytes
+        uint8_t n = cin == 0x04 ? 3 : cin - 0x04;
+        for(uint8_t i = 1; i <= n; i++)
+            sysExByte(p[i]);
+    }
+}
+
+uint16_t midiInService(uint32_t budget) {
+    uint32_t start = cyclesNow();
+    uint16_t packets = 0;
+    uint8_t bank[MIDI_IN_BANK];
+
+    do {
+        uint32_t n = receive(bank, sizeof(bank));
+        if(!n)
+            break;
+        for(uint32_t i = 0; i + 4 <= n; i += 4)
+            dispatch(bank + i);
+        packets += n / 4;
+    } while(cyclesNow() - start < budget);
+
+    return packets;
+}
@@ -0,0 +1,223 @@
+#include "midiout.h"
+#include <MIDIUSB.h>
+#include "profile.h"
+#include "heldnotes.h"
+#include "flightrec.h"
+
+#define RING_MASK	(MIDI_OUT_RING - 1)
+
+static_assert((MIDI_OUT_RING & RING_MASK) == 0, "MIDI_OUT_RING must be a power of two");
+static_assert(MIDI_OUT_PACKETS <= MIDI_OUT_RING, "the lossless backlog must fit in the ring");
+
+uint32_t midiOutLost;
+MidiSinkStats midiSinkStats[MIDI_SINKS_MAX];
+
+static midiEventPacket_t outQueue[MIDI_OUT_RING];
+static uint32_t outStamp[MIDI_OUT_RING];            //event time for latency, 0 = none
+static uint16_t outHead;
+
+static const MidiSink* sinks;
+static uint8_t sinkCount;
+static uint16_t sinkTail[MIDI_SINKS_MAX];           //each sink's read cursor
+
+struct PacedMessage {
+    byte status;
+    byte data1;
+    byte data2;
+    uint16_t spacingUs;
+};
+
+static PacedMessage paced[MIDI_PACED_MESSAGES];
+static uint16_t pacedHead, pacedTail;
+static uint32_t lastPaced;              //micros() the last paced message was released
+
+#if defined(ARDUINO_ARCH_SAM)
+//MIDIUSB keeps its endpoint number protected; a member pointer formed through a
+//derived class is the sanctioned way to read it from outside.
+struct MidiEndpoint : MIDI_ {
+    static uint8_t tx() {
+        return MidiUSB.*(&MidiEndpoint::pluggedEndpoint) + 1;     //IN endpoint follows OUT
+    }
+};
+
+//True when the MIDI IN endpoint has a free bank, i.e. a write won't spin in USBD_Send
+bool midiOutConnected() {
+    return USBDevice.configured();
+}
+
+static bool endpointReady() {
+    if(!midiOutConnected())
+        return false;
+    return UOTGHS->UOTGHS_DEVEPTISR[MidiEndpoint::tx()] & UOTGHS_DEVEPTISR_TXINI;
+}
+#else
+bool midiOutConnected() {
+    return true;
+}
+
+static bool endpointReady() {
+    return true;
+}
+#endif
+
+void midiOutBegin(const MidiSink* s, uint8_t count) {
+    sinks = s;
+    sinkCount = count < MIDI_SINKS_MAX ? count : MIDI_SINKS_MAX;
+    for(uint8_t n = 0; n < sinkCount; n++)
+        sinkTail[n] = outHead;
+}
+
+//Deepest backlog of the connected lossless sinks: what the callers wait for
+static uint16_t backlog() {
+    uint16_t deepest = 0;
+    for(uint8_t n = 0; n < sinkCount; n++) {
+        uint16_t b = outHead - sinkTail[n];
+        if(sinks[n].lossless && b > deepest)
+            deepest = b;
+    }
+    return deepest;
+}
+
+//Claim the next slot. A sink a whole ring behind loses its oldest packet.
+static midiEventPacket_t& claim() {
+    for(uint8_t n = 0; n < sinkCount; n++) {
+        if((uint16_t)(outHead - sinkTail[n]) == MIDI_OUT_RING) {
+            sinkTail[n]++;
+            midiSinkStats[n].dropped++;
+        }
+    }
+    return outQueue[outHead & RING_MASK];
+}
+
+bool midiOutMessage(byte status, byte data1, byte data2, uint32_t stamp) {
+    if(midiOutSpace() == 0)
+        return false;
+
+    midiEventPacket_t &p = claim();
+    p.header = status >> 4;         //cable 0, code index = message type
+    p.byte1 = status;
+    p.byte2 = data1;
+    p.byte3 = data2;
+    outStamp[outHead & RING_MASK] = stamp;
+    outHead++;
+    return true;
+}
+
+bool midiOutSysEx(const byte* data, uint16_t length) {
+    if(midiOutSpace() < (length + 2) / 3)
+        return false;
+
+    //Three bytes per packet; the last packet's code index says how many bytes it ends with
+    while(length) {
+        uint16_t n = length > 3 ? 3 : length;
+        midiEventPacket_t &p = claim();
+        p.header = length > 3 ? 0x04 : 0x04 + n;      //continues / ends with 1, 2 or 3 bytes
+        p.byte1 = data[0];
+        p.byte2 = n > 1 ? data[1] : 0;
+        p.byte3 = n > 2 ? data[2] : 0;
+        outStamp[outHead & RING_MASK] = 0;
+        outHead++;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool midiOutPaced(byte status, byte data1, byte data2, uint16_t spacingUs) {
+    if(midiOutPacedSpace() == 0)
+        return false;
+
+    PacedMessage &m = paced[pacedHead & (MIDI_PACED_MESSAGES - 1)];
+    m.status = status;
+    m.data1 = data1;
+    m.data2 = data2;
+    m.spacingUs = spacingUs;
+    pacedHead++;
+    return true;
+}
+
+uint16_t midiOutPacedSpace() {
+    return MIDI_PACED_MESSAGES - (uint16_t)(pacedHead - pacedTail);
+}
+
+//Hand the next paced message to the output once it is due and the host has taken the rest
+static void releasePaced() {
+    if(pacedHead == pacedTail || backlog())
+        return;
+
+    const PacedMessage &m = paced[pacedTail & (MIDI_PACED_MESSAGES - 1)];
+    uint32_t now = micros();
+    if(now - lastPaced < m.spacingUs)
+        return;
+
+    midiOutMessage(m.status, m.data1, m.data2);
+    pacedTail++;
+    lastPaced = now;
+}
+
+uint16_t midiOutSpace() {
+    return MIDI_OUT_PACKETS - backlog();
+}
+
+bool midiOutFlush() {
+    releasePaced();
+
+    bool empty = true;
+    for(uint8_t n = 0; n < sinkCount; n++) {
+        const MidiSink& sink = sinks[n];
+        MidiSinkStats& stats = midiSinkStats[n];
+        uint16_t& tail = sinkTail[n];
+
+        if(!sink.connected()) {
+            stats.dropped += (uint16_t)(outHead - tail);
+            tail = outHead;
+            continue;
+        }
+
+        //Up to the end of the array at a time; the sink takes what it can
+        while(tail != outHead) {
+            uint16_t start = tail & RING_MASK;
+            uint16_t count = outHead - tail;
+            if(count > MIDI_OUT_RING - start)
+                count = MIDI_OUT_RING - start;
+            uint16_t taken = sink.send(&outQueue[start], count);
+            if(!taken) {
+                stats.stalls++;
+                break;
+            }
+            stats.sent += taken;
+            tail += taken;
+        }
+        if(sink.lossless && tail != outHead)
+            empty = false;
+    }
+    return empty;
+}
+
+//One transfer of up to MIDI_OUT_BURST packets while the endpoint has a free bank
+uint16_t midiOutUsbSend(const midiEventPacket_t* packets, uint16_t count) {
+    if(!endpointReady())
+        return 0;
+    if(count > MIDI_OUT_BURST)
+        count = MIDI_OUT_BURST;
+
+    size_t bytes = count * sizeof(midiEventPacket_t);
+    if(MidiUSB.write((const uint8_t*)packets, bytes) != bytes) {
+        midiOutLost += count;
+        return count;
+    }
+
+    uint32_t now = cyclesNow();
+    uint32_t sent = micros();
+    const uint32_t* stamp = &outStamp[packets - outQueue];
+    for(uint16_t i = 0; i < count; i++) {
+        const midiEventPacket_t& p = packets[i];
+        if(p.header >= 0x08) {
+            heldNotesSent(p.byte1, p.byte2, p.byte3);
+            flightEvent(p.byte1, p.byte2, p.byte3, sent);
+        }
+        if(stamp[i])
+            profileRecord(PROF_KEY_LATENCY, now - stamp[i]);
+    }
+    return count;
+}
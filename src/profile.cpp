@@ -0,0 +1,96 @@
+#include "profile.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+#include "Arduino.h"
+#define PROFILE_LOCK()      uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define PROFILE_UNLOCK()    __set_PRIMASK(primask)
+#else
+#define PROFILE_LOCK()
+#define PROFILE_UNLOCK()
+#endif
+
+ProfileStat profileStats[PROF_STAGES];
+
+static uint32_t lastScan;
+static bool scanStarted;
+
+static void clearStat(ProfileStat& s) {
+    s.count = 0;
+    s.min = 0xFFFFFFFF;
+    s.max = 0;
+    s.total = 0;
+    for(uint8_t b = 0; b < PROFILE_BUCKETS; b++)
+        s.hist[b] = 0;
+}
+
+void profileReset() {
+    PROFILE_LOCK();
+    for(uint8_t i = 0; i < PROF_STAGES; i++)
+        clearStat(profileStats[i]);
+    scanStarted = false;
+    PROFILE_UNLOCK();
+}
+
+void profileSnapshot(uint8_t stage, ProfileStat& out) {
+    PROFILE_LOCK();
+    out = profileStats[stage];
+    PROFILE_UNLOCK();
+}
+
+void profileScanTick(uint32_t now, uint32_t periodCycles) {
+    if(scanStarted) {
+        int32_t late = (int32_t)(now - lastScan - periodCycles);
+        profileRecord(PROF_SCAN_JITTER, late < 0 ? -late : late);
+    }
+    lastScan = now;
+    scanStarted = true;
+}
+
+void profileScanPause() {
+    scanStarted = false;
+}
+
+uint32_t profilePercentile(const ProfileStat& s, uint8_t percent) {
+    if(!s.count)
+        return 0;
+    uint64_t want = ((uint64_t)s.count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for(uint8_t b = 0; b < PROFILE_BUCKETS - 1; b++) {
+        seen += s.hist[b];
+        if(seen >= want) {
+            uint32_t top = b ? (1UL << b) - 1 : 0;
+            return top < s.max ? top : s.max;
+        }
+    }
+    return s.max;                   //the last bucket has no top
+}
+
+uint8_t* profilePut7(uint8_t* out, uint32_t value, uint8_t bytes) {
+    for(uint8_t i = 0; i < bytes; i++) {
+        *out++ = value & 0x7F;
+        value >>= 7;
+    }
+    return out;
+}
+
+uint16_t profileReport(uint8_t stage, uint8_t* out, uint32_t ringHigh, uint32_t ringLost) {
+    ProfileStat s;
+    profileSnapshot(stage, s);
+
+    uint8_t* p = out;
+    *p++ = 0xF0;
+    *p++ = 0x7D;                    //non-commercial manufacturer ID
+    *p++ = 0x4F;                    //'O'
+    *p++ = 0x02;                    //profile report
+    *p++ = stage;
+    p = profilePut7(p, s.count, 5);
+    p = profilePut7(p, s.count ? s.min : 0, 5);
+    p = profilePut7(p, s.max, 5);
+    p = profilePut7(p, s.count ? (uint32_t)(s.total / s.count) : 0, 5);
+    for(uint8_t b = 0; b < PROFILE_BUCKETS; b++)
+        p = profilePut7(p, s.hist[b] < 0x1FFFFF ? s.hist[b] : 0x1FFFFF, 3);   //saturate at 21 bits
+    p = profilePut7(p, ringHigh, 5);
+    p = profilePut7(p, ringLost, 5);
+    *p++ = 0xF7;
+    return p - out;
+}
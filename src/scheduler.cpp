@@ -0,0 +1,116 @@
+#include "scheduler.h"
+#include "cycles.h"
+#include "profile.h"
+
+TaskStat taskStats[SCHED_MAX_TASKS];
+
+static const Task* table;
+static uint8_t taskCount;
+static uint32_t release[SCHED_MAX_TASKS];       //cyclesNow() of each task's latest release
+static uint16_t pending;                        //released and not yet run, bit n = task n
+
+void schedBegin(const Task* tasks, uint8_t count) {
+    table = tasks;
+    taskCount = count < SCHED_MAX_TASKS ? count : SCHED_MAX_TASKS;
+    pending = 0;
+
+    uint32_t now = cyclesNow();
+    for(uint8_t t = 0; t < taskCount; t++)
+        release[t] = now;
+    schedReset();
+}
+
+void schedReset() {
+    for(uint8_t t = 0; t < SCHED_MAX_TASKS; t++)
+        taskStats[t] = TaskStat();
+}
+
+static uint32_t deadline(uint8_t t) {
+    return release[t] + usToCycles(table[t].periodUs);
+}
+
+//Most urgent pending task, or -1
+static int8_t pick() {
+    int8_t best = -1;
+    for(uint16_t p = pending; p; p &= p - 1) {
+        uint8_t t = __builtin_ctz(p);
+        if(best < 0 || table[t].priority < table[best].priority ||
+           (table[t].priority == table[best].priority && (int32_t)(deadline(t) - deadline(best)) < 0))
+            best = t;
+    }
+    return best;
+}
+
+void schedRun() {
+    uint32_t now = cyclesNow();
+    for(uint8_t t = 0; t < taskCount; t++) {
+        if(!table[t].periodUs) {
+            release[t] = now;
+            pending |= 1U << t;
+        }
+        else if((int32_t)(now - release[t]) >= 0)
+            pending |= 1U << t;
+    }
+
+    int8_t t;
+    while((t = pick()) >= 0) {
+        const Task& task = table[t];
+        TaskStat& s = taskStats[t];
+        uint32_t period = usToCycles(task.periodUs);
+
+        uint32_t start = cyclesNow();
+        uint32_t lateness = start - release[t];
+        if(lateness > s.maxLateness)
+            s.maxLateness = lateness;
+        if(period && lateness > period)
+            s.late++;
+
+        task.run();
+
+        uint32_t end = cyclesNow();
+        if(end - start > usToCycles(task.budgetUs))
+            s.overruns++;
+        if(task.stage < PROF_STAGES)
+            profileRecord(task.stage, end - start);
+        s.runs++;
+        pending &= ~(1U << t);
+
+        //Periods that have already gone by are counted, not made up in a burst
+        if(period) {
+            release[t] += period;
+            if((int32_t)(end - release[t]) >= (int32_t)period) {
+                uint32_t missed = (end - release[t]) / period;
+                s.skipped += missed;
+                release[t] += missed * period;
+            }
+        }
+    }
+}
+
+uint32_t schedNextRelease() {
+    uint32_t now = cyclesNow();
+    uint32_t next = now + usToCycles(1000000);
+    for(uint8_t t = 0; t < taskCount; t++) {
+        if(table[t].periodUs && (int32_t)(release[t] - next) < 0)
+            next = release[t];
+    }
+    return next;
+}
+
+uint16_t schedReport(uint8_t task, uint8_t* out) {
+    TaskStat s = task < SCHED_MAX_TASKS ? taskStats[task] : TaskStat();
+
+    uint8_t* p = out;
+    *p++ = 0xF0;
+    *p++ = 0x7D;                    //non-commercial manufacturer ID
+    *p++ = 0x4F;                    //'O'
+    *p++ = 0x06;                    //task report
+    *p++ = task;
+    p = profilePut7(p, s.runs, 5);
+    p = profilePut7(p, s.late, 5);
+    p = profilePut7(p, s.skipped, 5);
+    p = profilePut7(p, s.overruns, 5);
+    p = profilePut7(p, s.maxLateness, 5);
+    *p++ = 0xF7;
+    return p - out;
+}
@@ -0,0 +1,82 @@
+#include "transpose.h"
+#include <string.h>
+
+struct TrackedChannel {
+    uint8_t sentFor[128];       //note each held key sent, TRANSPOSE_NONE = key up
+    uint8_t holders[128];       //keys holding each sent note
+    uint64_t sounding[2];       //holders != 0, as a bit map
+};
+
+static uint8_t shift[128];
+static int8_t offset;
+static int8_t slot[16];                 //channel - 1 -> tracked[], -1 = not tracked
+static TrackedChannel tracked[TRANSPOSE_CHANNELS];
+
+void transposeBegin(uint16_t channels) {
+    uint8_t used = 0;
+    for(uint8_t ch = 0; ch < 16; ch++) {
+        slot[ch] = -1;
+        if(!(channels & (1 << ch)) || used == TRANSPOSE_CHANNELS)
+            continue;
+        TrackedChannel& t = tracked[used];
+        memset(t.sentFor, TRANSPOSE_NONE, sizeof(t.sentFor));
+        memset(t.holders, 0, sizeof(t.holders));
+        t.sounding[0] = t.sounding[1] = 0;
+        slot[ch] = used++;
+    }
+    transposeSet(0);
+}
+
+void transposeSet(int8_t value) {
+    if(value > TRANSPOSE_RANGE)
+        value = TRANSPOSE_RANGE;
+    if(value < -TRANSPOSE_RANGE)
+        value = -TRANSPOSE_RANGE;
+    offset = value;
+    for(int note = 0; note < 128; note++) {
+        int to = note + value;
+        shift[note] = to < 0 || to > 127 ? TRANSPOSE_NONE : to;
+    }
+}
+
+int8_t transposeOffset() {
+    return offset;
+}
+
+uint8_t transposeOn(byte channel, byte key) {
+    int8_t s = slot[(channel - 1) & 0x0F];
+    if(s < 0)
+        return key;
+    TrackedChannel& t = tracked[s];
+    uint8_t note = shift[key & 0x7F];
+    if(t.sentFor[key & 0x7F] != TRANSPOSE_NONE || note == TRANSPOSE_NONE)
+        return TRANSPOSE_NONE;
+
+    t.sentFor[key & 0x7F] = note;
+    if(t.holders[note]++)
+        return TRANSPOSE_NONE;
+    t.sounding[note >> 6] |= 1ULL << (note & 63);
+    return note;
+}
+
+uint8_t transposeOff(byte channel, byte key) {
+    int8_t s = slot[(channel - 1) & 0x0F];
+    if(s < 0)
+        return key;
+    TrackedChannel& t = tracked[s];
+    uint8_t note = t.sentFor[key & 0x7F];
+    if(note == TRANSPOSE_NONE)
+        return TRANSPOSE_NONE;
+
+    t.sentFor[key & 0x7F] = TRANSPOSE_NONE;
+    if(--t.holders[note])
+        return TRANSPOSE_NONE;
+    t.sounding[note >> 6] &= ~(1ULL << (note & 63));
+    return note;
+}
+
+const uint64_t* transposeSounding(byte channel) {
+    static const uint64_t none[2] = {0, 0};
+    int8_t s = slot[(channel - 1) & 0x0F];
+    return s < 0 ? none : tracked[s].sounding;
+}
@@ -0,0 +1,190 @@
+#include "twi.h"
+#include "cycles.h"
+#include "matrix.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+TwiRegs* twiRegs = TWI1;
+#else
+TwiRegs* twiRegs;
+#endif
+
+#define SDA_PIN     20
+#define SCL_PIN     21
+
+uint32_t twiFaults;
+uint32_t twiNacks;
+
+enum TwiState {
+    TWI_STATE_IDLE,
+    TWI_STATE_SEND,             //PDC sending all but the last byte
+    TWI_STATE_LAST,             //STOP set, last byte written, waiting for TXCOMP
+    TWI_STATE_CLOCK,            //recovery: clocking SCL until SDA is released
+    TWI_STATE_STOP              //recovery: SCL low, SDA low, SCL high, SDA high
+};
+
+static TwiState state;
+static TwiResult result;
+static uint8_t txBuf[TWI_MAX_WRITE];
+static uint16_t txLength;
+static uint32_t started;                //cyclesNow() at the start of the transfer
+static uint32_t deadline;               //cycles allowed for it
+static uint32_t clockWave;              //TWI_CWGR as Wire set it up
+static uint8_t step;
+
+//Master mode, slave off, at the speed Wire configured
+static void twiReset() {
+    twiRegs->TWI_PTCR = TWI_PTCR_TXTDIS;
+    twiRegs->TWI_CR = TWI_CR_SWRST;
+    twiRegs->TWI_CWGR = clockWave;
+    twiRegs->TWI_CR = TWI_CR_SVDIS | TWI_CR_MSDIS;
+    twiRegs->TWI_CR = TWI_CR_MSEN;
+}
+
+//Open-drain by hand: driving = output LOW, releasing = input, the pull-up takes it HIGH
+static void pinLow(uint8_t pin) {
+    pioPorts[duePin(pin).port]->PIO_OER = 1UL << duePin(pin).bit;
+}
+
+static void pinRelease(uint8_t pin) {
+    pioPorts[duePin(pin).port]->PIO_ODR = 1UL << duePin(pin).bit;
+}
+
+static bool pinHigh(uint8_t pin) {
+    return pioPorts[duePin(pin).port]->PIO_PDSR & (1UL << duePin(pin).bit);
+}
+
+//Give the pins to the PIO, output data LOW, both released
+static void recoverStart() {
+    twiRegs->TWI_PTCR = TWI_PTCR_TXTDIS;
+    for(uint8_t pin = SDA_PIN; pin <= SCL_PIN; pin++) {
+        PioRegs* pio = pioPorts[duePin(pin).port];
+        uint32_t bit = 1UL << duePin(pin).bit;
+        pio->PIO_ODR = bit;
+        pio->PIO_CODR = bit;
+        pio->PIO_PER = bit;
+    }
+    step = 0;
+    state = TWI_STATE_CLOCK;
+}
+
+//Hand the pins back to the TWI and start over
+static void recoverEnd() {
+    for(uint8_t pin = SDA_PIN; pin <= SCL_PIN; pin++)
+        pioPorts[duePin(pin).port]->PIO_PDR = 1UL << duePin(pin).bit;
+    twiReset();
+    twiFaults++;
+    result = TWI_FAULT;
+    state = TWI_STATE_IDLE;
+}
+
+void twiBegin() {
+    clockWave = twiRegs->TWI_CWGR;
+    twiReset();
+    state = TWI_STATE_IDLE;
+    result = TWI_DONE;
+}
+
+bool twiIdle() {
+    return state == TWI_STATE_IDLE;
+}
+
+bool twiWrite(uint8_t address, const uint8_t* data, uint16_t length) {
+    if(state != TWI_STATE_IDLE || length == 0 || length > TWI_MAX_WRITE)
+        return false;
+
+    for(uint16_t i = 0; i < length; i++)
+        txBuf[i] = data[i];
+    txLength = length;
+    started = cyclesNow();
+    deadline = usToCycles(TWI_TIMEOUT_US + TWI_BYTE_US * (length + 1));
+    result = TWI_BUSY;
+
+    twiRegs->TWI_MMR = TWI_MMR_DADR(address);
+    if(length == 1) {
+        //Nothing for the PDC: STOP with the only byte
+        twiRegs->TWI_CR = TWI_CR_STOP;
+        twiRegs->TWI_THR = txBuf[0];
+        state = TWI_STATE_LAST;
+    }
+    else {
+        //The PDC sends all but the last byte, which has to go out with STOP
+        twiRegs->TWI_TPR = (uintptr_t)txBuf;
+        twiRegs->TWI_TCR = length - 1;
+        twiRegs->TWI_PTCR = TWI_PTCR_TXTEN;
+        state = TWI_STATE_SEND;
+    }
+    return true;
+}
+
+TwiResult twiService() {
+    uint32_t sr;
+
+    switch(state) {
+    case TWI_STATE_IDLE:
+        break;
+
+    case TWI_STATE_SEND:
+    case TWI_STATE_LAST:
+        sr = twiRegs->TWI_SR;                   //NACK and ARBLST clear on read
+        if(sr & TWI_SR_NACK) {
+            //The controller has already sent STOP
+            twiRegs->TWI_PTCR = TWI_PTCR_TXTDIS;
+            twiNacks++;
+            result = TWI_NACK;
+            state = TWI_STATE_IDLE;
+            break;
+        }
+        if((sr & TWI_SR_ARBLST) || cyclesNow() - started > deadline) {
+            recoverStart();
+            break;
+        }
+        if(state == TWI_STATE_SEND) {
+            if((sr & TWI_SR_ENDTX) && (sr & TWI_SR_TXRDY)) {
+                twiRegs->TWI_PTCR = TWI_PTCR_TXTDIS;
+                twiRegs->TWI_CR = TWI_CR_STOP;
+                twiRegs->TWI_THR = txBuf[txLength - 1];
+                state = TWI_STATE_LAST;
+            }
+        }
+        else if(sr & TWI_SR_TXCOMP) {
+            result = TWI_DONE;
+            state = TWI_STATE_IDLE;
+        }
+        break;
+
+    case TWI_STATE_CLOCK:
+        //Up to nine clocks (18 edges), stopping once SDA is free with SCL high
+        if(step & 1) {
+            pinRelease(SCL_PIN);
+        }
+        else {
+            if(pinHigh(SDA_PIN) && pinHigh(SCL_PIN)) {
+                step = 0;
+                state = TWI_STATE_STOP;
+                break;
+            }
+            pinLow(SCL_PIN);
+        }
+        if(++step >= 18) {
+            step = 0;
+            state = TWI_STATE_STOP;
+        }
+        break;
+
+    case TWI_STATE_STOP:
+        switch(step++) {
+        case 0: pinLow(SCL_PIN); break;
+        case 1: pinLow(SDA_PIN); break;
+        case 2: pinRelease(SCL_PIN); break;
+        case 3: pinRelease(SDA_PIN); break;     //SDA rising with SCL high = STOP
+        default: recoverEnd(); break;
+        }
+        break;
+    }
+
+    if(state != TWI_STATE_IDLE)
+        return TWI_BUSY;
+    TwiResult ended = result;
+    result = TWI_DONE;
+    return ended;
+}
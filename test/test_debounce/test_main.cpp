@@ -0,0 +1,100 @@
+#include <unity.h>
+#include "debounce.h"
+
+//Scripted contact traces through the debouncer, scanned every SCAN_US as the sketch
+//does at SCAN_RATE 1000. Each trace moves one key and checks exactly when its note
+//goes on and off.
+#define SCAN_US     1000
+#define KEY         5
+#define EVENTS      8
+
+struct Edge {
+    uint32_t at;                //us
+    bool closed;
+};
+
+struct Heard {
+    uint32_t at;
+    uint8_t key;
+    bool on;
+};
+
+static const DebounceConfig windows = {2000, 8000};     //the manuals' windows
+
+static Heard heard[EVENTS];
+static uint8_t heardCount;
+static uint32_t now;
+
+static bool emit(uint8_t key, bool on) {
+    if(heardCount < EVENTS)
+        heard[heardCount] = {now, key, on};
+    heardCount++;
+    return true;
+}
+
+//Scan from 0 to until, the contact following edges (sorted by time)
+static void play(const DebounceConfig& config, const Edge* edges, uint8_t count, uint32_t until) {
+    Debouncer d;
+    debounceBegin(d, config);
+    heardCount = 0;
+    bool closed = false;
+    uint8_t next = 0;
+    for(now = 0; now <= until; now += SCAN_US) {
+        while(next < count && edges[next].at <= now)
+            closed = edges[next++].closed;
+        debounceUpdate(d, closed ? 1ULL << KEY : 0, ~0ULL, now, emit);
+    }
+}
+
+static void expect(uint32_t onAt, uint32_t offAt) {
+    TEST_ASSERT_EQUAL(2, heardCount);
+    TEST_ASSERT_EQUAL(KEY, heard[0].key);
+    TEST_ASSERT_EQUAL(KEY, heard[1].key);
+    TEST_ASSERT_TRUE(heard[0].on);
+    TEST_ASSERT_EQUAL_UINT32(onAt, heard[0].at);
+    TEST_ASSERT_FALSE(heard[1].on);
+    TEST_ASSERT_EQUAL_UINT32(offAt, heard[1].at);
+}
+
+void setUp() {}
+void tearDown() {}
+
+//On at the first scan that sees it closed, off a release window after it opens
+void test_clean_press() {
+    const Edge trace[] = {{5000, true}, {50000, false}};
+    play(windows, trace, 2, 100000);
+    expect(5000, 58000);
+}
+
+//Make-chatter: the note starts with the first close and the opens don't end it
+void test_chatter_inside_window() {
+    const Edge trace[] = {{5000, true}, {6000, false}, {7000, true}, {8000, false},
+                          {9000, true}, {40000, false}};
+    play(windows, trace, 6, 100000);
+    expect(5000, 48000);
+}
+
+//Break-bounce: each close inside the release window starts it over from the next open
+void test_release_bounce() {
+    const Edge trace[] = {{5000, true}, {30000, false}, {31000, true}, {33000, false},
+                          {34000, true}, {36000, false}};
+    play(windows, trace, 6, 100000);
+    expect(5000, 44000);
+}
+
+//A tap shorter than pressUs still sounds for pressUs
+void test_tap_held_to_shortest_note() {
+    const DebounceConfig slow = {20000, 8000};
+    const Edge trace[] = {{5000, true}, {6000, false}};
+    play(slow, trace, 2, 100000);
+    expect(5000, 25000);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_clean_press);
+    RUN_TEST(test_chatter_inside_window);
+    RUN_TEST(test_release_bounce);
+    RUN_TEST(test_tap_held_to_shortest_note);
+    return UNITY_END();
+}
@@ -0,0 +1,194 @@
+#include <unity.h>
+#include <string.h>
+#include "flashlog.h"
+
+//The flash log against a model of the flash controller: a page command programs the
+//latch into the page (EWP erases it first), and a power cut can stop it part-way
+//through, leaving a word half erased or half programmed. After each cut the log is
+//loaded again with flashLogBegin and every key must still hold its latest value,
+//except the key being written, which may hold either the old value or the new one.
+#define FCMD_WP         0x01
+#define FCMD_EWP        0x03
+#define FIRST_PAGE      992             //the top of bank 1, as on the Due
+#define WRAPS           4               //times round the log
+#define CUTS            300
+
+enum Cut { NO_CUT, CUT_PROGRAM, CUT_ERASE };
+
+static uint32_t flash[FLASH_LOG_PAGES * FLASH_PAGE_WORDS];
+static uint32_t before[FLASH_LOG_PAGES * FLASH_PAGE_WORDS];
+static EfcRegs efc;
+static uint16_t erases[FLASH_LOG_PAGES];
+
+static uint32_t expected[FLASH_LOG_KEYS];
+static bool written[FLASH_LOG_KEYS];
+static uint32_t found[FLASH_LOG_KEYS];
+static bool seen[FLASH_LOG_KEYS];
+static bool foundTorn;
+
+static uint32_t seed;
+
+static uint32_t random32() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint32_t roll(uint32_t n) {
+    return random32() % n;
+}
+
+//Carry out the command flashLogWrite just issued. The latch writes went straight into
+//flash[]: they are the image, and the page goes back to how it was before the command.
+//Returns true if the power was cut.
+static bool finish(Cut cut) {
+    uint32_t fcr = efc.EEFC_FCR;
+    efc.EEFC_FCR = 0;
+    uint8_t cmd = fcr & 0xFF;
+    if(cmd != FCMD_WP && cmd != FCMD_EWP)
+        return false;
+
+    uint16_t page = ((fcr >> 8) & 0xFFFF) - FIRST_PAGE;
+    uint32_t* p = flash + page * FLASH_PAGE_WORDS;
+    uint32_t latch[FLASH_PAGE_WORDS];
+    memcpy(latch, p, sizeof(latch));
+    memcpy(p, before + page * FLASH_PAGE_WORDS, sizeof(latch));
+
+    if(cmd == FCMD_EWP) {
+        erases[page]++;
+        uint8_t stop = cut == CUT_ERASE ? roll(FLASH_PAGE_WORDS) : FLASH_PAGE_WORDS;
+        for(uint8_t w = 0; w < stop; w++)
+            p[w] = 0xFFFFFFFF;
+        if(stop < FLASH_PAGE_WORDS) {
+            p[stop] |= random32();
+            return true;
+        }
+    }
+    else if(cut == CUT_ERASE)
+        cut = NO_CUT;
+
+    //A cut lands on one of the words the command changes
+    uint8_t stop = FLASH_PAGE_WORDS;
+    if(cut == CUT_PROGRAM) {
+        uint8_t changing[FLASH_PAGE_WORDS];
+        uint8_t count = 0;
+        for(uint8_t w = 0; w < FLASH_PAGE_WORDS; w++) {
+            if((p[w] & latch[w]) != p[w])
+                changing[count++] = w;
+        }
+        if(count)
+            stop = changing[roll(count)];
+    }
+    for(uint8_t w = 0; w < stop; w++)
+        p[w] &= latch[w];
+    if(stop < FLASH_PAGE_WORDS) {
+        p[stop] &= latch[stop] | random32();
+        return true;
+    }
+    return false;
+}
+
+static void collect(uint16_t key, const uint32_t* data) {
+    seen[key] = true;
+    found[key] = data[0];
+    if(data[1] != ~data[0] || data[2] != data[0] * 3 || data[3] != key)
+        foundTorn = true;
+}
+
+//Power up: load the log and check every key against what was written
+static void reload(int16_t cutKey, uint32_t cutValue) {
+    memset(seen, 0, sizeof(seen));
+    foundTorn = false;
+    flashLogBegin(collect);
+    TEST_ASSERT_FALSE_MESSAGE(foundTorn, "a torn record was loaded");
+
+    for(uint16_t k = 0; k < FLASH_LOG_KEYS; k++) {
+        if(k == cutKey && seen[k] && found[k] == cutValue) {
+            expected[k] = cutValue;
+            written[k] = true;
+        }
+        TEST_ASSERT_EQUAL(written[k], seen[k]);
+        if(written[k])
+            TEST_ASSERT_EQUAL_UINT32(expected[k], found[k]);
+    }
+}
+
+//Write a new value for key, retrying while the page fills with copies. Returns true if
+//the power was cut, once the log has been loaded again.
+static bool write(uint16_t key, Cut cut) {
+    uint32_t value = random32();
+    uint32_t data[FLASH_DATA_WORDS] = {value, ~value, value * 3, key};
+    bool done;
+    do {
+        memcpy(before, flash, sizeof(flash));
+        done = flashLogWrite(key, data);
+        if(finish(cut)) {
+            reload(key, value);
+            return true;
+        }
+    } while(!done);
+    expected[key] = value;
+    written[key] = true;
+    return false;
+}
+
+static void start(uint32_t s) {
+    seed = s;
+    memset(flash, 0xFF, sizeof(flash));
+    memset(erases, 0, sizeof(erases));
+    memset(written, 0, sizeof(written));
+    efc.EEFC_FCR = 0;
+    efc.EEFC_FSR = EEFC_FSR_FRDY;       //commands finish at once here
+    flashRegs = &efc;
+    flashBase = flash;
+    flashFirstPage = FIRST_PAGE;
+    reload(-1, 0);
+}
+
+//Run round the log WRAPS times with a few keys, or with every key, loading it again
+//every so often
+static void wrap(uint16_t keys) {
+    for(uint32_t n = 0; n < WRAPS * FLASH_LOG_SLOTS * 2; n++) {
+        write(roll(keys), NO_CUT);
+        if(n % 97 == 0)
+            reload(-1, 0);
+    }
+    reload(-1, 0);
+    for(uint8_t p = 0; p < FLASH_LOG_PAGES; p++)
+        TEST_ASSERT_TRUE(erases[p] >= WRAPS);
+}
+
+//Cut the power on some write in every few, then carry on from what the log held
+static void cuts(Cut cut, uint16_t keys) {
+    uint32_t count = 0;
+    while(count < CUTS) {
+        uint8_t run = roll(20);
+        for(uint8_t n = 0; n < run; n++)
+            write(roll(keys), NO_CUT);
+        while(!write(roll(keys), cut));
+        count++;
+    }
+    reload(-1, 0);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_wraps_with_few_keys() { start(1); wrap(16); }
+void test_wraps_with_every_key() { start(2); wrap(FLASH_LOG_KEYS); }
+void test_cut_while_programming() { start(3); cuts(CUT_PROGRAM, 48); }
+void test_cut_while_programming_every_key() { start(4); cuts(CUT_PROGRAM, FLASH_LOG_KEYS); }
+void test_cut_while_erasing() { start(5); cuts(CUT_ERASE, 48); }
+void test_cut_while_erasing_every_key() { start(6); cuts(CUT_ERASE, FLASH_LOG_KEYS); }
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_wraps_with_few_keys);
+    RUN_TEST(test_wraps_with_every_key);
+    RUN_TEST(test_cut_while_programming);
+    RUN_TEST(test_cut_while_programming_every_key);
+    RUN_TEST(test_cut_while_erasing);
+    RUN_TEST(test_cut_while_erasing_every_key);
+    return UNITY_END();
+}
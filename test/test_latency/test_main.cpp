@@ -0,0 +1,65 @@
+#include <unity.h>
+#include <stdio.h>
+#include "sim.h"
+
+//Key-to-USB latency benchmark: the simulated console (sim.h) plays the benchmark cases
+//for a fixed seed, and the host times every note from its contact closing to the note
+//on reaching it. Each case reports p50, p99 and max and fails if p99 runs past its
+//limit, as does the whole run if the host heard a wrong note.
+#define BENCH_SECONDS       60          //per case
+#define BENCH_SEED          1
+#define LATENCY_P99_US      1500        //a scan period plus the trip out
+#define BOUNCING_P99_US     5000        //and the chatter of a contact just closed (3 ms)
+
+static const char* const names[SIM_PATTERNS] = {
+    "single notes", "10-note chords", "glissandi", "bouncing contacts"
+};
+
+static bool heardRight;
+
+static void benchCase(uint8_t pattern, bool loaded) {
+    SimLatency l;
+    hostBenchLatency(pattern + (loaded ? SIM_PATTERNS : 0), l);
+    TEST_ASSERT_TRUE(l.count > 0);
+
+    char line[128];
+    snprintf(line, sizeof(line), "%s%s over %u notes: p50 %u us, p99 %u us, max %u us",
+             names[pattern], loaded ? " with LCD and MIDI in load" : "", (unsigned)l.count,
+             (unsigned)l.p50, (unsigned)l.p99, (unsigned)l.max);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(pattern == SIM_BOUNCING ? BOUNCING_P99_US : LATENCY_P99_US, l.p99);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_heard_right() { TEST_ASSERT_TRUE_MESSAGE(heardRight, "the host heard notes the keys didn't play"); }
+void test_single_notes() { benchCase(SIM_NOTES, false); }
+void test_chords() { benchCase(SIM_CHORDS, false); }
+void test_glissandi() { benchCase(SIM_GLISSANDI, false); }
+void test_bouncing() { benchCase(SIM_BOUNCING, false); }
+void test_single_notes_loaded() { benchCase(SIM_NOTES, true); }
+void test_chords_loaded() { benchCase(SIM_CHORDS, true); }
+void test_glissandi_loaded() { benchCase(SIM_GLISSANDI, true); }
+void test_bouncing_loaded() { benchCase(SIM_BOUNCING, true); }
+
+int main() {
+    //The simulation runs once: every case is a stretch of the same run
+    simDefaults();
+    simConfig.seconds = BENCH_SECONDS;
+    simConfig.seed = BENCH_SEED;
+    simConfig.bench = true;
+    heardRight = simRun();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_heard_right);
+    RUN_TEST(test_single_notes);
+    RUN_TEST(test_chords);
+    RUN_TEST(test_glissandi);
+    RUN_TEST(test_bouncing);
+    RUN_TEST(test_single_notes_loaded);
+    RUN_TEST(test_chords_loaded);
+    RUN_TEST(test_glissandi_loaded);
+    RUN_TEST(test_bouncing_loaded);
+    return UNITY_END();
+}